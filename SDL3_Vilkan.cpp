@@ -1,20 +1,117 @@
 #define SDL_MAIN_USE_CALLBACKS
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_vulkan.h>
+#include <SDL3/SDL_ttf.h>
 #include <vulkan/vulkan.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <float.h>
 
+#include "menu_list.h"
+#include "frame_pacing.h"
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MATH_SSE 1
+#endif
+
+// Initial window size, and the fixed render target size in headless mode
 #define WINDOW_WIDTH 800
 #define WINDOW_HEIGHT 600
 
-// Vertex structure
+// Swapchains retired by a resize stay alive until the frames that used them finish
+#define MAX_RETIRED_SWAPCHAINS 4
+#define PRESENT_MODE_COUNT 4 // IMMEDIATE, MAILBOX, FIFO, FIFO_RELAXED
+
+// Number of frames the CPU may record ahead of the GPU. Each slot owns its own
+// command buffer and sync objects so frame N+1 can be recorded while frame N
+// is still executing.
+#define MAX_FRAMES_IN_FLIGHT 3
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+
+// Benchmark harness defaults
+#define DEFAULT_BENCH_FRAMES 1000
+#define BENCH_WARMUP_FRAMES 10
+#define DEFAULT_BENCH_OUTPUT "bench_results.json"
+
+// Profiler limits. GPU scopes beyond the per-frame limit are simply not timed.
+#define PROFILER_MAX_GPU_SCOPES 64
+#define PROFILER_HISTORY 240
+#define PROFILER_MAX_SERIES 32
+
+// Job system and parallel command recording. The calling thread counts as
+// worker 0 and helps out while it waits, so N threads means N-1 extra threads.
+#define MAX_JOB_THREADS 16
+#define JOB_QUEUE_SIZE 256 // Per worker, power of two
+#define RECORD_CHUNKS_PER_WORKER 4 // Spare chunks give idle workers something to steal
+#define MIN_DRAWS_PER_CHUNK 64     // Below this a secondary buffer costs more than it saves
+#define MAX_RECORD_CHUNKS (MAX_JOB_THREADS * RECORD_CHUNKS_PER_WORKER)
+
+// GPU-driven path: instances are culled by a compute pass that fills
+// indirect draw commands, one per mesh
+#define CULL_GROUP_SIZE 64 // Must match local_size_x in shaders/cull.comp
+
+// Mesh processing. Triangles are ordered for a small LRU post-transform cache
+// (the scoring model) and reported against a FIFO cache, as most GPUs have.
+#define VCACHE_SCORE_SIZE 32
+#define VCACHE_REPORT_SIZE 16
+
+// Level of detail. Each level targets half the triangles of the one before.
+// A level is used while its simplification error projects to less than
+// LOD_PIXEL_ERROR pixels; switching to a coarser level needs a further
+// LOD_HYSTERESIS margin so objects near a threshold do not flicker.
+#define LOD_MAX_LEVELS 4          // Must match the vec4 of errors in shaders/cull.comp
+#define LOD_MAX_ERROR 0.05f       // Relative to the mesh radius; coarser levels are not generated
+#define LOD_MIN_REDUCTION 0.8f    // Stop once a level keeps more than this share of triangles
+#define LOD_PIXEL_ERROR 1.0f
+#define LOD_HYSTERESIS 0.25f
+#define LOD_BORDER_WEIGHT 10.0    // Open edges resist moving off their line this much more than faces
+#define MAX_ROOM_DETAIL 128       // Keeps a tessellated room under 65535 vertices
+
+// Overlay UI (--overlay). Printable ASCII is rasterized into the atlas once at
+// startup; every quad of a frame goes into one draw.
+#define UI_FONT_SIZE 24
+#define UI_DEFAULT_FONT "arial.ttf"
+#define UI_ATLAS_SIZE 512
+#define UI_FIRST_GLYPH 32
+#define UI_GLYPH_COUNT 95
+#define UI_WHITE_SIZE 2      // Fully covered block at the atlas origin, sampled by solid rects
+#define UI_MAX_QUADS 4096    // Per frame; keeps the shared quad indices 16-bit
+#define UI_ROW_SPACING 12
+#define UI_LIST_MARGIN 20
+#define UI_WHEEL_ROWS 3
+
+// Source vertex, as authored
 typedef struct {
     float pos[3];
     float color[3];
 } Vertex;
 
+// Vertex as stored in the GPU vertex buffer: snorm16 position (w unused) and
+// RGBA8 color, 12 bytes instead of 24. Positions must lie in [-1, 1], which
+// holds for the room and for the grid it is baked into.
+typedef struct {
+    int16_t pos[4];
+    uint8_t color[4];
+} PackedVertex;
+
+// Symmetric 4x4 error quadric (Garland-Heckbert), stored as its 10 unique
+// entries, plus the summed weight of its planes
+typedef struct {
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+    double weight;
+} Quadric;
+
+// Candidate edge collapse: vertex from moves onto vertex to
+typedef struct {
+    uint32_t from;
+    uint32_t to;
+    float cost; // Mean squared distance to the planes of both vertices
+} LodCollapse;
+
 // Simple room vertices (cube)
 static const Vertex vertices[] = {
     // Floor
@@ -39,144 +136,1464 @@ static const uint32_t indices[] = {
     4, 5, 6, 6, 7, 4,    // Ceiling
     8, 9, 10, 10, 11, 8  // Back wall
 };
+#define ROOM_QUADS 3 // Each quad is vertices[4 * q .. 4 * q + 3], split as above
+
+// SPIR-V compiled offline by shaders/compile_shaders.sh
+static const uint32_t roomVertSpv[] = {
+#include "shaders/room.vert.spv.inc"
+};
+
+static const uint32_t roomFragSpv[] = {
+#include "shaders/room.frag.spv.inc"
+};
+
+static const uint32_t cullCompSpv[] = {
+#include "shaders/cull.comp.spv.inc"
+};
+
+static const uint32_t uiVertSpv[] = {
+#include "shaders/ui.vert.spv.inc"
+};
+
+static const uint32_t uiFragSpv[] = {
+#include "shaders/ui.frag.spv.inc"
+};
+
+// On-disk VkPipelineCache. The driver's own header is only checked for vendor,
+// device and cache UUID, so it is wrapped in ours, which also pins the driver
+// version and guards the payload with a checksum.
+#define PIPELINE_CACHE_FILE "pipeline_cache.bin"
+#define PIPELINE_CACHE_MAGIC 0x43504B56 // "VKPC"
+#define PIPELINE_CACHE_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint32_t checksum;
+    uint64_t dataSize;
+} PipelineCacheFileHeader;
+
+// The benchmark scene is the room above replicated on a grid. Every room owns
+// its vertices (positions are baked into the grid cell) and is drawn with its
+// own vkCmdDrawIndexed, reusing the room's index list through vertexOffset.
+typedef struct {
+    uint32_t indexCount;  // Level 0; the coarser levels come from the mesh's LOD table
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    float sphere[4]; // World-space bounding sphere: xyz center (the room's pivot), w radius
+    uint32_t mesh;   // LOD table in scene.meshes
+} SceneDraw;
+
+// One level of a mesh's LOD chain. Every level indexes the same vertices, and
+// the levels' indices follow each other in the index buffer.
+typedef struct {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error; // Simplification error relative to the mesh's bounding radius
+} SceneLod;
+
+// Per-instance data of the GPU-driven path, laid out as the std430 Instance
+// struct in shaders/cull.comp. The vertex shader only sees positionScale.
+typedef struct {
+    float positionScale[4]; // xyz offset, w uniform scale
+    uint32_t mesh;
+    uint32_t pad[3];
+} SceneInstance;
+
+typedef struct {
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    float sphere[4];        // Bounding sphere in mesh space: xyz center, w radius
+    uint32_t firstInstance; // Start of the mesh's range in the visible-instance buffer
+    uint32_t instanceCount; // Instances referencing this mesh, i.e. the range's capacity
+    uint32_t lodCount;
+    SceneLod lods[LOD_MAX_LEVELS];
+} SceneMesh;
+
+// Either every room is baked into the vertex buffer and drawn separately
+// (draws), or the room is stored once and placed by instances. Both paths
+// take their LOD chains from meshes.
+typedef struct {
+    PackedVertex* vertices;
+    uint32_t vertexCount;
+    void* indices;         // uint16_t or uint32_t, see indexType
+    uint32_t indexCount;
+    VkIndexType indexType; // 16-bit whenever every mesh has fewer than 65535 vertices
+    SceneDraw* draws;
+    uint32_t drawCount;
+    SceneMesh* meshes;
+    uint32_t meshCount;
+    SceneInstance* instances;
+    uint32_t instanceCount;
+} Scene;
+
+typedef struct {
+    uint32_t framesInFlight;
+    bool headless;           // Render to offscreen images, no window, surface or swapchain
+    bool bench;              // Collect frame timings and write them as JSON
+    uint32_t benchFrames;
+    uint32_t rooms;
+    const char* benchOutput;
+    bool checksum;           // Read back the final frame and hash it
+    const char* expectChecksum;
+    const char* traceOutput; // Chrome trace / Perfetto JSON, NULL when disabled
+    bool profileDraws;       // Timestamp every draw, not just the frame and render pass
+    VkPresentModeKHR presentMode;
+    uint32_t swapchainImages; // 0 picks a count suited to the present mode
+    uint32_t recordThreads;   // Threads recording draw commands, including the main thread
+    bool gpuDriven;           // Instanced rooms, compute culling and indirect draws
+    const char* sceneFile;    // Binary scene to stream in instead of the generated grid
+    const char* convertScene; // Write the generated scene to this file and exit
+    bool depthPrepass;        // Lay down depth first, then shade with an EQUAL depth test
+    uint32_t roomDetail;      // Quads per room face edge; 1 is the original six triangles
+    bool lod;                 // Select a level of detail per draw/instance, otherwise always level 0
+    bool overlay;             // Draw the menu overlay; Escape toggles it
+    const char* fontPath;
+    double targetFps;           // Frame pacing target, 0 leaves frames to the present mode
+    const char* latencyOutput;  // Latency histograms as JSON, NULL when not measuring
+    bool staticScene;           // Freeze the camera and object animation at time 0
+    bool cacheCommands;         // Replay recorded per-draw commands until something they bake in changes
+} AppConfig;
+
+typedef void (*JobFunction)(void* data, uint32_t worker);
+
+typedef struct {
+    JobFunction function;
+    void* data;
+    SDL_AtomicInt* counter; // Decremented when the job has run, see jobWait
+} Job;
+
+// The owner pushes and pops at the tail (LIFO, cache-warm), thieves take the
+// oldest job from the head. A spinlock is plenty for a handful of jobs a frame.
+typedef struct {
+    Job jobs[JOB_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    SDL_SpinLock lock;
+} JobQueue;
+
+typedef struct {
+    SDL_Thread* threads[MAX_JOB_THREADS];
+    SDL_ThreadID threadIds[MAX_JOB_THREADS]; // Set by each worker itself; 0 for the calling thread
+    JobQueue queues[MAX_JOB_THREADS];
+    uint32_t workerCount;     // Including the calling thread, which owns queue 0
+    SDL_Semaphore* wake;      // Posted once per submitted job
+    SDL_AtomicInt quit;
+    SDL_AtomicInt nextQueue;  // Round-robin submit target
+} JobSystem;
+
+// Initialization is a graph of stages run on the job system. Each stage
+// starts once every stage in its dependency mask has finished.
+#define MAX_STARTUP_TASKS 16
+
+typedef bool (*StartupFunction)(void);
+
+typedef struct {
+    const char* name;
+    StartupFunction function;
+    uint32_t dependencies;  // Bit i: waits for tasks[i]
+    bool mainThread;        // Window system and device calls stay on the calling thread
+    SDL_AtomicInt waiting;  // Dependencies not finished yet
+    SDL_AtomicInt ready;    // Main-thread task whose dependencies have finished
+    bool ran;               // False when skipped after an earlier stage failed
+    uint32_t worker;
+    Uint64 start;
+    Uint64 end;
+} StartupTask;
+
+typedef struct {
+    StartupTask tasks[MAX_STARTUP_TASKS];
+    uint32_t taskCount;
+    SDL_AtomicInt pending;  // Tasks that have not finished
+    SDL_AtomicInt failed;
+    SDL_AtomicInt jobs;     // Counter for tasks submitted to the job system
+    Uint64 start;
+    Uint64 end;
+} StartupGraph;
+
+// Secondary command buffers recorded by one worker for one frame slot. The
+// pool is only ever touched by that worker (or by the main thread while no
+// jobs are in flight), so no locking is needed.
+typedef struct {
+    VkCommandPool pool;
+    VkCommandBuffer* buffers;
+    uint32_t bufferCount;
+    uint32_t used;
+} RecordPool;
+
+typedef struct {
+    uint32_t slot;
+    uint32_t imageIndex;
+    uint32_t chunk;
+    uint32_t subpass;
+    uint32_t firstDraw;
+    uint32_t drawCount;
+} RecordChunk;
+
+// Rolling window of samples for one named CPU or GPU scope
+typedef struct {
+    const char* name;
+    double samples[PROFILER_HISTORY];
+    uint32_t next;
+    uint32_t count;
+} ProfilerSeries;
+
+typedef struct {
+    double last;
+    double average;
+    double min;
+    double max;
+    uint32_t samples;
+} ProfilerStats;
+
+typedef struct {
+    const char* name;
+    uint32_t drawIndex; // UINT32_MAX for named scopes
+} GpuScope;
+
+// Timestamp scopes recorded into one frame slot's command buffer. They are
+// resolved after that slot's fence has signaled, framesInFlight frames later.
+typedef struct {
+    GpuScope scopes[PROFILER_MAX_GPU_SCOPES];
+    uint32_t scopeCount;
+    Uint64 recordTicks; // CPU time the frame was recorded, anchors GPU events on the trace timeline
+    Uint64 frameIndex;
+    bool pending;
+} GpuFrameQueries;
+
+typedef struct {
+    FILE* trace;
+    bool traceHasEvents;
+    Uint64 originTicks;
+    ProfilerSeries series[PROFILER_MAX_SERIES];
+    uint32_t seriesCount;
+    VkQueryPool queryPool;
+    float timestampPeriod;
+    uint64_t timestampMask;
+    GpuFrameQueries gpuFrames[MAX_FRAMES_IN_FLIGHT];
+} Profiler;
+
+// GPU memory sub-allocator. Device memory is carved out of large blocks so the
+// number of vkAllocateMemory calls stays far below maxMemoryAllocationCount.
+// Blocks are segregated by memory type and by resource kind (linear buffers vs.
+// optimally tiled images) so neighbouring allocations can never violate
+// bufferImageGranularity.
+#define GPU_BLOCK_SIZE (64ull * 1024 * 1024)
+#define GPU_MAX_BLOCKS 128
+#define STAGING_BUFFER_SIZE (16ull * 1024 * 1024)
+#define MAX_STAGING_COPIES 256
+
+typedef enum {
+    GPU_RESOURCE_BUFFER,
+    GPU_RESOURCE_IMAGE,
+} GpuResourceKind;
+
+typedef struct {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+} GpuRange;
+
+// A single VkDeviceMemory with a sorted, coalesced free list (best fit)
+typedef struct {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    VkDeviceSize used;
+    uint32_t memoryTypeIndex;
+    GpuResourceKind kind;
+    bool dedicated;
+    void* mapped;
+    uint32_t allocationCount;
+    GpuRange* freeRanges;
+    uint32_t freeRangeCount;
+    uint32_t freeRangeCapacity;
+} GpuBlock;
+
+typedef struct {
+    GpuBlock* block;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void* mapped; // Non-NULL for host-visible memory, which stays persistently mapped
+} GpuAllocation;
+
+typedef struct {
+    VkBuffer buffer;
+    VkDeviceSize size;
+    GpuAllocation allocation;
+} GpuBuffer;
+
+// Linear/ring strategy: one persistently mapped buffer handed out front to back.
+// Space is reclaimed in FIFO order by releasing up to a marker taken when the
+// work that used it was submitted.
+typedef struct {
+    GpuBuffer buffer;
+    VkDeviceSize head;
+    VkDeviceSize tail;
+} GpuRing;
+
+typedef struct {
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    VkDeviceSize bufferImageGranularity;
+    VkDeviceSize nonCoherentAtomSize;
+    GpuBlock* blocks[GPU_MAX_BLOCKS];
+    uint32_t blockCount;
+    SDL_Mutex* lock; // Startup stages allocate from several threads
+    VkDeviceSize heapUsage[VK_MAX_MEMORY_HEAPS]; // Bytes of VkDeviceMemory held per heap
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2; // NULL without VK_EXT_memory_budget
+    uint32_t downgradeCount; // Allocations placed outside their preferred heap to stay within budget
+    VkDeviceSize evictedBytes;
+} GpuAllocator;
+
+typedef struct {
+    VkDeviceSize usage;
+    VkDeviceSize budget;
+} GpuHeapBudget;
+
+typedef struct {
+    uint32_t blockCount;
+    uint32_t allocationCount;
+    VkDeviceSize bytesAllocated; // Sum of VkDeviceMemory sizes
+    VkDeviceSize bytesUsed;      // Sum of live sub-allocations
+    VkDeviceSize largestFreeRange;
+    float fragmentation;         // 1 - largest free range / total free bytes
+} GpuAllocatorStats;
+
+// Batches buffer uploads through a host-visible staging ring so any number of
+// copies into device-local memory go out in a single transfer submit
+typedef struct {
+    VkBuffer dst;
+    VkBufferCopy region;
+} StagingCopy;
+
+typedef struct {
+    GpuRing ring;
+    VkCommandPool commandPool;      // Graphics family: ownership acquires and readbacks
+    VkCommandBuffer commandBuffer;
+    VkCommandPool transferPool;     // Transfer family, only with a dedicated transfer queue
+    VkCommandBuffer transferCommandBuffer;
+    VkFence fence;
+    StagingCopy copies[MAX_STAGING_COPIES];
+    uint32_t copyCount;
+    VkDeviceSize pendingBytes;
+    VkBuffer written[MAX_STAGING_COPIES]; // Copied into since the last handover to the graphics family
+    uint32_t writtenCount;
+} StagingUploader;
+
+// Binary scene files, read with --scene and written with --convert-scene.
+// Raw little-endian structs in the in-memory layout. Every section starts on a
+// SCENE_FILE_ALIGNMENT boundary, so it can be mapped or read straight into a
+// staging buffer and copied to the GPU as is.
+#define SCENE_FILE_MAGIC 0x43534B56 // "VKSC"
+#define SCENE_FILE_VERSION 3 // 2: SceneDraw bounding sphere, 3: LOD tables
+#define SCENE_FILE_ALIGNMENT 256
+
+typedef enum {
+    SCENE_SECTION_VERTICES,  // PackedVertex[vertexCount]
+    SCENE_SECTION_INDICES,   // uint16_t or uint32_t[indexCount]
+    SCENE_SECTION_DRAWS,     // SceneDraw[drawCount]
+    SCENE_SECTION_MESHES,    // SceneMesh[meshCount]
+    SCENE_SECTION_INSTANCES, // SceneInstance[instanceCount]
+    SCENE_SECTION_COUNT
+} SceneSection;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} SceneFileSection;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertexStride; // sizeof(PackedVertex) of the writer
+    uint32_t indexType;    // VkIndexType
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t drawCount;
+    uint32_t meshCount;
+    uint32_t instanceCount;
+    uint32_t reserved;
+    SceneFileSection sections[SCENE_SECTION_COUNT];
+} SceneFileHeader;
+
+// Streaming loader. A background thread reads the GPU-only sections of a scene
+// file into a staging ring in chunks; the render thread records the copies
+// into its frame command buffers and frees ring space as those frames retire.
+#define STREAM_RING_SIZE (8ull * 1024 * 1024)
+#define STREAM_CHUNK_SIZE (1024 * 1024)
+#define STREAM_MAX_CHUNKS 64
+#define STREAM_MAX_SECTIONS 3 // Vertices, indices and instances
+#define STREAM_MAX_BATCHES 8  // Transfer submits in flight with a dedicated transfer queue
+
+typedef struct {
+    GpuBuffer* dst;
+    uint64_t fileOffset;
+    uint64_t size;
+} StreamSection;
+
+typedef struct {
+    VkBuffer dst;
+    VkBufferCopy region;
+} StreamChunk;
+
+// One chunk submitted to the transfer queue by the loader thread. Its ring
+// space is free again once uploadTimeline reaches value.
+typedef struct {
+    VkCommandBuffer commandBuffer;
+    uint64_t value;
+    VkDeviceSize ringMarker;
+} StreamBatch;
+
+typedef struct {
+    const char* path;
+    SceneFileHeader header;
+    StreamSection sections[STREAM_MAX_SECTIONS];
+    uint32_t sectionCount;
+    SDL_Thread* thread;
+    GpuRing ring;
+    SDL_Mutex* lock;          // Guards ring and the chunk FIFO
+    SDL_Condition* spaceFreed;
+    StreamChunk chunks[STREAM_MAX_CHUNKS]; // Read, not yet recorded
+    uint32_t chunkHead;
+    uint32_t chunkCount;
+    VkDeviceSize releaseMarkers[MAX_FRAMES_IN_FLIGHT]; // Ring head to release once the slot retires
+    bool releasePending[MAX_FRAMES_IN_FLIGHT];
+    // Dedicated transfer queue: the loader records and submits the copies itself
+    VkCommandPool transferPool;
+    StreamBatch batches[STREAM_MAX_BATCHES];
+    uint32_t batchHead;
+    uint32_t batchCount;
+    uint64_t finalValue;       // Timeline value of the last batch, valid once submitted is set
+    SDL_AtomicInt submitted;
+    SDL_AtomicInt quit;
+    SDL_AtomicInt failed;
+    uint64_t totalBytes;
+    uint64_t recordedBytes; // Render thread only
+    Uint64 startTicks;
+    bool active;
+} SceneStreamer;
+
+// Compute culling and indirect drawing. Everything the cull pass writes is
+// per frame slot so a frame never waits for the previous one to stop reading.
+typedef struct {
+    bool enabled;
+    bool multiDrawIndirect;
+    bool drawIndirectFirstInstance; // Needed for every mesh level but the first
+    PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount; // NULL without VK_KHR_draw_indirect_count
+    GpuBuffer instanceBuffer;  // SceneInstance for every instance
+    GpuBuffer meshBuffer;      // CullMesh per mesh
+    GpuBuffer lodBuffer;       // Level each instance used last frame, for hysteresis
+    GpuBuffer drawTemplate;    // One VkDrawIndexedIndirectCommand per mesh and level with instanceCount 0
+    uint32_t commandCount;     // meshCount * LOD_MAX_LEVELS
+    GpuBuffer drawBuffers[MAX_FRAMES_IN_FLIGHT];
+    GpuBuffer visibleBuffers[MAX_FRAMES_IN_FLIGHT]; // Instance-rate vertex data of the survivors
+    GpuBuffer countBuffers[MAX_FRAMES_IN_FLIGHT];
+    GpuBuffer statsBuffers[MAX_FRAMES_IN_FLIGHT];   // Host copy of the draws, for visibility stats
+    bool statsPending[MAX_FRAMES_IN_FLIGHT];
+    VkDescriptorSetLayout setLayout;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet sets[MAX_FRAMES_IN_FLIGHT];
+    VkPipelineLayout pipelineLayout;
+    VkPipeline pipeline;
+    uint64_t visibleTotal;
+    uint32_t visibleSamples;
+} GpuCuller;
+
+// Push constants of shaders/cull.comp, 128 bytes: the guaranteed minimum
+typedef struct {
+    float planes[6][4];
+    float eye[4]; // xyz camera position, w pixels per unit at distance 1
+    uint32_t instanceCount;
+    uint32_t lodEnabled;
+    float pixelError;
+    float hysteresis;
+} CullConstants;
+
+// Mesh entry of shaders/cull.comp (std430)
+typedef struct {
+    float sphere[4];
+    float lodError[LOD_MAX_LEVELS];
+    uint32_t lodCount;
+    uint32_t pad[3];
+} CullMesh;
+
+// Math. Matrices are column-major like GLSL, so they are copied into push
+// constant and uniform blocks as they are. Matrix products, the hot path when
+// thousands of objects move every frame, use SSE where the target has it.
+typedef struct {
+    float m[16];
+} Mat4;
+
+// Push constants of shaders/room.vert
+typedef struct {
+    Mat4 viewProj;
+} CameraConstants;
+
+// Per-object uniform block of shaders/room.vert, one ring slice per object
+typedef struct {
+    Mat4 model;
+} ObjectUniforms;
+
+typedef struct {
+    Mat4 view;
+    Mat4 viewProj;
+    float planes[6][4]; // Frustum planes of viewProj, inward-facing and normalized, for the culler
+    float eye[3];
+    float projScale;    // Pixels per world unit at distance 1, for projected sizes
+    bool moved;         // viewProj differs from the previous frame's
+} Camera;
+
+// Per-draw LOD selection on the CPU; the GPU-driven path selects in the cull
+// shader. Triangle counts cover both paths.
+typedef struct {
+    uint8_t* drawLevels;     // Level each draw used last frame, for hysteresis
+    float (*centers)[4];     // Draw bounding sphere centers, w = 1
+    float (*viewCenters)[4]; // Scratch: centers in view space
+    uint64_t triangles;      // Last selection's triangle count
+    bool settled;            // The last update changed no level, so an unmoved camera cannot change any
+    uint64_t triangleTotal;
+    uint32_t samples;
+} LodState;
+
+// Per-draw path: every room sways about the center of its bounding sphere.
+// The pivot translations never change, so a frame only builds one rotation
+// per object and then runs two batched matrix products straight into the ring.
+typedef struct {
+    Mat4* toPivot;   // Translation to the room's center
+    Mat4* fromPivot; // Translation back to the origin
+    Mat4* rotation;  // Scratch, rebuilt every frame
+    Mat4* swayed;    // Scratch: toPivot * rotation
+    float* phase;
+    uint32_t count;
+} ObjectAnimation;
+
+// Per-object uniforms live in one persistently mapped ring. Each frame takes
+// a slice per object, aligned to minUniformBufferOffsetAlignment, and binds
+// them through a single dynamic uniform buffer descriptor. A slot's slices are
+// released once its fence has been waited on, as with the streaming ring.
+typedef struct {
+    GpuRing ring;
+    VkDeviceSize objectStride; // sizeof(ObjectUniforms) rounded up to the offset alignment
+    uint32_t objectCount;      // One per draw, or a single identity object for the GPU-driven path
+    VkDeviceSize frameBase;    // Ring offset of the current frame's first object
+    VkDeviceSize releaseMarkers[MAX_FRAMES_IN_FLIGHT];
+    bool releasePending[MAX_FRAMES_IN_FLIGHT];
+    bool frozen;               // Static scene: the one slice written is never released
+    VkDescriptorSetLayout setLayout;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet set;
+    ObjectAnimation animation;
+} FrameUniforms;
+
+// Fragment shader invocations per frame from a pipeline statistics query,
+// which shows how much shading the depth pre-pass saves
+typedef struct {
+    VkQueryPool pool;   // One query per frame slot, null without pipelineStatisticsQuery
+    bool inherited;     // inheritedQueries: the query may stay active across secondaries
+    bool pending[MAX_FRAMES_IN_FLIGHT];
+    uint64_t fragmentTotal;
+    uint32_t samples;
+} ShadingStats;
+
+typedef struct {
+    float pos[2]; // Pixels from the top left of the framebuffer
+    float uv[2];
+    uint8_t color[4];
+} UiVertex;
+
+typedef struct {
+    SDL_Rect src; // Atlas pixels, empty for glyphs without pixels
+    int advance;
+} UiGlyph;
+
+// Immediate-mode overlay. Each frame rebuilds its quads from scratch into the
+// frame slot's part of one persistently mapped vertex buffer; the menu items,
+// layout and hit testing are the MenuList shared with SDL3_menu.cpp.
+typedef struct {
+    bool enabled;        // Font and GPU resources exist
+    bool visible;
+    TTF_Font* font;
+    UiGlyph glyphs[UI_GLYPH_COUNT];
+    MenuList list;
+    float mouseX;
+    float mouseY;
+    VkImage atlasImage;
+    GpuAllocation atlasMemory;
+    VkImageView atlasView;
+    VkSampler sampler;
+    VkDescriptorSetLayout setLayout;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet set;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline pipeline;
+    GpuBuffer vertexBuffer; // UI_MAX_QUADS quads per frame slot
+    GpuBuffer indexBuffer;  // The same two triangles per quad, built once
+    UiVertex* vertices;     // The current slot's quads while a frame is built
+    uint32_t quadCount;
+    uint32_t droppedQuads;
+    Uint64 lastFrameTicks;
+    double frameMs;         // Smoothed frame interval for the stats line
+    uint64_t quadTotal;
+    uint32_t samples;
+} UiOverlay;
+
+typedef struct {
+    VkCommandBuffer commandBuffer;
+    VkSemaphore imageAvailableSemaphore;
+    VkFence inFlightFence;
+    RecordPool recordPools[MAX_JOB_THREADS];
+    VkCommandBuffer secondaries[MAX_RECORD_CHUNKS + 1]; // Executed in chunk order by the primary, then the overlay
+    VkCommandBuffer cached[2];  // --cache-commands: the per-draw commands of each subpass
+    uint64_t cachedGeneration;  // commandCache.generation they were recorded at, 0 for never
+} FrameData;
+
+// Command caching (--cache-commands). Each frame slot keeps its per-draw
+// commands in secondaries that outlive the frame. The slot's primary is still
+// recorded every frame, but it only wraps them in the render pass, the
+// queries and the overlay. Anything the draws bake in (viewport, camera push
+// constant, uniform offsets, LOD levels, buffers) bumps the generation when it
+// changes, and each slot re-records once it sees the new value.
+typedef struct {
+    uint64_t generation;
+    uint32_t replays;
+    uint32_t records;
+} CommandCache;
+
+// Depth buffer of one framebuffer. Depth never outlives the render pass, so on
+// tiled GPUs it is a transient attachment in lazily allocated memory and never
+// gets physical backing.
+typedef struct {
+    VkImage image;
+    VkImageView view;
+    GpuAllocation memory;
+} DepthTarget;
+
+// A swapchain replaced by recreateSwapchain along with everything that
+// referenced its images. Destroyed once retireFrame's fence has been waited on.
+typedef struct {
+    VkSwapchainKHR swapchain;
+    VkImage* images;
+    VkImageView* imageViews;
+    VkFramebuffer* framebuffers;
+    DepthTarget* depthTargets;
+    VkSemaphore* renderFinished;
+    uint32_t imageCount;
+    Uint64 retireFrame;
+} RetiredSwapchain;
+
+// Queue families picked for one physical device
+typedef struct {
+    uint32_t graphics;
+    uint32_t present;  // The graphics family when headless
+    uint32_t transfer; // The graphics family when there is no separate one
+    uint32_t compute;
+} QueueFamilies;
 
 typedef struct {
     VkInstance instance;
     VkPhysicalDevice physicalDevice;
     VkDevice device;
     VkQueue graphicsQueue;
+    VkQueue presentQueue;
+    VkQueue transferQueue;  // Uploads; the graphics queue when there is no separate transfer family
+    VkQueue computeQueue;   // Async compute; the graphics queue when there is no separate compute family
+    uint32_t graphicsFamily;
+    uint32_t presentFamily;
+    uint32_t transferFamily;
+    uint32_t computeFamily;
+    // Set when uploads run on their own queue family. Buffers written there are
+    // released to the graphics family and the graphics queue waits on
+    // uploadTimeline before it acquires them.
+    bool dedicatedTransfer;
+    VkSemaphore uploadTimeline;
+    uint64_t uploadValue;      // Last value signaled on uploadTimeline
+    uint64_t frameUploadWait;  // Timeline value the next frame submit waits for, 0 for none
+    PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue;
+    PFN_vkWaitSemaphoresKHR waitSemaphores;
     VkSurfaceKHR surface;
     VkSwapchainKHR swapchain;
     VkImage* swapchainImages;
     uint32_t swapchainImageCount;
     VkImageView* swapchainImageViews;
+    VkExtent2D extent;
+    VkPresentModeKHR presentMode;
+    bool swapchainDirty; // Resized or reported out of date; rebuilt before the next acquire
+    bool swapchainLost;  // Rebuilding failed after the old swapchain was retired; fatal
+    RetiredSwapchain retired[MAX_RETIRED_SWAPCHAINS];
+    uint32_t retiredCount;
     VkRenderPass renderPass;
     VkPipelineLayout pipelineLayout;
-    VkPipeline graphicsPipeline;
+    VkPipeline graphicsPipeline;  // Shading subpass: the only one, or the one after the pre-pass
+    VkPipeline depthPipeline;     // Depth-only pre-pass subpass, null without --depth-prepass
+    VkFormat depthFormat;
+    bool depthLazy;               // Depth targets landed in LAZILY_ALLOCATED memory
+    VkPipelineCache pipelineCache;
+    bool pipelineCacheWarm;
     VkFramebuffer* framebuffers;
+    DepthTarget* depthTargets; // One per framebuffer
     VkCommandPool commandPool;
-    VkCommandBuffer commandBuffer;
-    VkSemaphore imageAvailableSemaphore;
-    VkSemaphore renderFinishedSemaphore;
-    VkFence inFlightFence;
-    VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
-    VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
+    FrameData frames[MAX_FRAMES_IN_FLIGHT];
+    uint32_t framesInFlight;
+    uint32_t currentFrame;
+    VkFence* imagesInFlight; // Fence of the frame slot that last rendered each swapchain image
+    // Present waits, one per swapchain image. A slot's fence does not say when
+    // the presentation engine is done with a semaphore, but the image's next
+    // acquire does, so they are indexed by imageIndex rather than frame slot.
+    VkSemaphore* renderFinishedSemaphores;
+    GpuBuffer vertexBuffer;
+    GpuBuffer indexBuffer;
+    GpuBuffer identityInstanceBuffer; // Single {0, 0, 0, 1} instance for the per-draw path
+    bool headless;
+    bool properties2; // VK_KHR_get_physical_device_properties2 is enabled on the instance
+    GpuAllocation offscreenMemory[MAX_FRAMES_IN_FLIGHT]; // Backing for headless render targets
 } VulkanContext;
 
+// Per-frame samples gathered by the benchmark harness
+typedef struct {
+    double* cpuFrameMs;      // Time spent in SDL_AppIterate minus the frame fence wait
+    double* gpuFrameMs;      // Top-to-bottom-of-pipe timestamp delta of the frame's command buffer
+    double* frameIntervalMs; // Wall time between consecutive frame starts
+    double* recordMs;        // Time to record the frame's command buffers
+    uint32_t cpuCount;
+    uint32_t gpuCount;
+    uint32_t intervalCount;
+    Uint64 lastFrameStart;
+    Uint64 startTicks;
+} BenchState;
+
 VulkanContext vkContext = {0};
+static GpuAllocator gpuAllocator = {0};
+static StagingUploader stagingUploader = {0};
+static AppConfig appConfig = {0};
+static Scene scene = {0};
+static BenchState bench = {0};
+static Profiler profiler = {0};
+static JobSystem jobs = {0};
+static StartupGraph startup = {0};
+static GpuCuller culler = {0};
+static SceneStreamer streamer = {0};
+static Camera camera = {0};
+static ShadingStats shadingStats = {0};
+static FrameUniforms frameUniforms = {0};
+static LodState lodState = {0};
+static UiOverlay ui = {0};
+static CommandCache commandCache = {1};
+// False until every GPU buffer the scene draws from holds its data. Frames
+// are still rendered (cleared) while a scene file streams in.
+static bool sceneResident = false;
+static RecordChunk recordChunks[MAX_RECORD_CHUNKS];
 SDL_Window* window;
 
+// Throughput counters, reported at shutdown
+static Uint64 frameCount = 0;
+static Uint64 firstFrameTicks = 0;
+
+// Startup timing, reported once the first frame has been presented
+static Uint64 appStartTicks = 0;
+static double pipelineCreateMs = 0.0;
+
+// Oldest input event not yet picked up by a recorded frame (SDL_GetTicksNS time base)
+static Uint64 pendingInputNs = 0;
+// Input-to-present latency per present mode, so modes can be compared within
+// one session (P cycles through the supported modes)
+static LatencyHistogram latencyByMode[PRESENT_MODE_COUNT];
+static LatencyHistogram presentIntervals;
+static Uint64 lastPresentNs = 0;
+static FramePacer pacer = {0};
+
 // Forward declarations
-static bool initVulkan(SDL_Window* window);
+static bool initVulkan(void);
+static bool createInstance(void);
+static bool createDevice(void);
+static void createPipelineLayout(void);
 static void cleanupVulkan(void);
 static void createRenderPass(void);
 static void createGraphicsPipeline(void);
-static void createFramebuffers(void);
+static bool createFramebuffers(void);
+static VkFormat chooseDepthFormat(void);
+static DepthTarget* createDepthTargets(uint32_t count);
+static void destroyDepthTargets(DepthTarget* targets, uint32_t count);
+static void shadingStatsInit(void);
+static void shadingStatsCollect(uint32_t slot);
 static void createCommandBuffers(void);
 static void createSyncObjects(void);
-static void createVertexBuffer(void);
-static void createIndexBuffer(void);
+static bool createVertexBuffer(void);
+static bool createIndexBuffer(void);
+static bool cullerInit(void);
+static void cullerDestroy(void);
+static void cullerRecord(VkCommandBuffer cmd, uint32_t slot);
+static void cullerDraw(VkCommandBuffer cmd, uint32_t slot, uint32_t subpass);
+static VkPipeline subpassPipeline(uint32_t subpass);
+static void cullerCollectStats(uint32_t slot);
+static void mat4Identity(Mat4* out);
+static void mat4Translation(Mat4* out, float x, float y, float z);
+static void mat4RotationY(Mat4* out, float angle);
+static void mat4Perspective(Mat4* out, float fovY, float aspect, float zNear, float zFar);
+static void mat4LookAt(Mat4* out, const float eye[3], const float target[3], const float up[3]);
+static void mat4Multiply(Mat4* out, const Mat4* a, const Mat4* b);
+static void mat4MultiplyBatch(void* out, size_t outStride, const Mat4* a, const Mat4* b, uint32_t count);
+static void mat4FrustumPlanes(const Mat4* m, float planes[6][4]);
+static void vec4TransformBatch(float (*out)[4], const Mat4* m, const float (*in)[4], uint32_t count);
+static void cameraUpdate(double seconds);
+static bool uniformsInit(void);
+static void uniformsDestroy(void);
+static void uniformsUpdate(uint32_t slot, double seconds);
+static void uniformsRelease(uint32_t slot);
+static void bindFrameUniforms(VkCommandBuffer cmd, uint32_t object);
+static bool uiInit(void);
+static void uiDestroy(void);
+static void uiBuild(uint32_t slot);
+static void uiDraw(VkCommandBuffer cmd, uint32_t slot);
+static void uiHandleEvent(const SDL_Event* event, bool* quit);
+static void gpuAllocatorInit(void);
+static void gpuAllocatorDestroy(void);
+static uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred);
+static bool gpuAlloc(const VkMemoryRequirements* requirements, VkMemoryPropertyFlags required,
+                     VkMemoryPropertyFlags preferred, GpuResourceKind kind, GpuAllocation* allocation);
+static void gpuFree(GpuAllocation* allocation);
+static void gpuFlush(const GpuAllocation* allocation, VkDeviceSize offset, VkDeviceSize size);
+static bool gpuCreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required,
+                            VkMemoryPropertyFlags preferred, GpuBuffer* buffer);
+static void gpuDestroyBuffer(GpuBuffer* buffer);
+static bool gpuRingCreate(GpuRing* ring, VkDeviceSize size, VkBufferUsageFlags usage);
+static bool gpuRingAlloc(GpuRing* ring, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset);
+static void gpuRingRelease(GpuRing* ring, VkDeviceSize marker);
+static void gpuGetStats(GpuAllocatorStats* stats);
+static void gpuLogStats(const char* label);
+static void gpuGetBudget(GpuHeapBudget budgets[VK_MAX_MEMORY_HEAPS]);
+static VkDeviceSize gpuTrim(uint32_t heapIndex);
+static bool stagingInit(void);
+static void stagingDestroy(void);
+static bool stagingUpload(GpuBuffer* dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+static void stagingFlush(bool handover);
+static void parseCommandLine(int argc, char* argv[]);
+static void buildScene(uint32_t roomCount);
+static uint32_t meshOptimize(Vertex* vertices, uint32_t vertexCount, uint32_t* indices, uint32_t indexCount);
+static void buildRoomMesh(uint32_t detail, Vertex** roomVertices, uint32_t* vertexCount, uint32_t** roomIndices,
+                          uint32_t* indexCount);
+static uint32_t simplifyMesh(const Vertex* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount,
+                             uint32_t targetIndexCount, float maxError, uint32_t* destination, float* resultError);
+static uint32_t buildLods(const Vertex* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount,
+                          float radius, SceneMesh* mesh, uint32_t** lodIndices);
+static uint32_t selectLod(const SceneMesh* mesh, float screenRadius, uint32_t current);
+static bool lodInit(void);
+static void lodDestroy(void);
+static void lodUpdate(void);
+static void optimizeVertexCache(uint32_t* indices, uint32_t indexCount, uint32_t vertexCount);
+static uint32_t optimizeVertexFetch(Vertex* vertices, uint32_t vertexCount, uint32_t* indices, uint32_t indexCount);
+static float meshAcmr(const uint32_t* indices, uint32_t indexCount, uint32_t vertexCount);
+static PackedVertex packVertex(const float pos[3], const float color[3]);
+static uint32_t indexTypeSize(VkIndexType type);
+static void destroyScene(void);
+static bool writeSceneFile(const char* path);
+static bool loadSceneFile(const char* path);
+static void streamerAddSection(GpuBuffer* dst, SceneSection section);
+static bool streamerStart(void);
+static void streamerStop(void);
+static void streamerDestroy(void);
+static void streamerRecord(VkCommandBuffer cmd, uint32_t slot);
+static void streamerRelease(uint32_t slot);
+static bool findQueueFamilies(VkPhysicalDevice device, QueueFamilies* selection);
+static bool selectQueueFamilies(void);
+static int64_t scorePhysicalDevice(VkPhysicalDevice device, const char** reason);
+static bool selectPhysicalDevice(void);
+static void recordOwnershipTransfer(VkCommandBuffer cmd, const VkBuffer* buffers, uint32_t bufferCount, bool release);
+static uint64_t submitTransfer(VkCommandBuffer cmd);
+static bool createSwapchain(VkSwapchainKHR oldSwapchain);
+static bool recreateSwapchain(void);
+static void destroyRetiredSwapchains(bool all);
+static void cyclePresentMode(void);
+static const char* presentModeName(VkPresentModeKHR mode);
+static void recordLatency(Uint64 inputNs);
+static void logLatencyStats(void);
+static bool writeLatencyFile(const char* path);
+static bool createOffscreenTargets(void);
+static void createImageViews(void);
+static void profilerInit(void);
+static void profilerShutdown(void);
+static Uint64 profilerBegin(void);
+static void profilerEnd(const char* name, Uint64 start);
+static void profilerTraceEvent(const char* name, uint32_t drawIndex, int tid, double startUs, double durationUs);
+static void profilerGpuBeginFrame(VkCommandBuffer cmd, uint32_t slot);
+static uint32_t profilerGpuBegin(VkCommandBuffer cmd, uint32_t slot, const char* name, uint32_t drawIndex);
+static void profilerGpuEnd(VkCommandBuffer cmd, uint32_t slot, uint32_t scope);
+static double profilerResolveGpu(uint32_t slot);
+static bool profilerGetStats(const char* name, ProfilerStats* stats);
+static void profilerLogStats(void);
+static void recordCommandBuffer(FrameData* frame, uint32_t imageIndex);
+static void commandCacheInvalidate(void);
+static void jobSystemInit(uint32_t workerCount);
+static void jobSystemShutdown(void);
+static void jobSubmit(JobFunction function, void* data, SDL_AtomicInt* counter);
+static void jobWait(SDL_AtomicInt* counter);
+static bool jobTryRun(uint32_t worker);
+static uint32_t startupAdd(const char* name, StartupFunction function, uint32_t dependencies, bool mainThread);
+static void startupJob(void* data, uint32_t worker);
+static bool startupRun(void);
+static void startupReport(void);
+static bool startupScene(void);
+static void benchInit(void);
+static void benchAddGpuTime(double ms);
+static int benchEndFrame(Uint64 frameStart, Uint64 waitTicks, Uint64 recordTicks);
+static int benchFinish(void);
+static bool readbackChecksum(uint32_t imageIndex, uint32_t* checksum);
+static void gpuInvalidate(const GpuAllocation* allocation, VkDeviceSize offset, VkDeviceSize size);
+static void loadPipelineCache(void);
+static void savePipelineCache(void);
+static double ticksToMs(Uint64 ticks);
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment);
 
 int SDL_AppInit(void** appstate, int argc, char* argv[]) {
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+    appStartTicks = SDL_GetPerformanceCounter();
+    parseCommandLine(argc, argv);
+    pacerInit(&pacer, appConfig.targetFps);
+    vkContext.framesInFlight = appConfig.framesInFlight;
+    vkContext.headless = appConfig.headless;
+
+    // Headless runs (CI without a display) never touch the video subsystem
+    if (SDL_Init(appConfig.headless || appConfig.convertScene ? 0 : SDL_INIT_VIDEO) < 0) {
         SDL_Log("SDL initialization failed: %s", SDL_GetError());
         return 1;
     }
 
-    window = SDL_CreateWindow("Vulkan 3D Room",
-                            SDL_WINDOWPOS_CENTERED,
-                            SDL_WINDOWPOS_CENTERED,
-                            WINDOW_WIDTH, WINDOW_HEIGHT,
-                            SDL_WINDOW_VULKAN | SDL_WINDOW_SHOWN);
-    if (!window) {
-        SDL_Log("Window creation failed: %s", SDL_GetError());
-        return 1;
+    if (!appConfig.headless && !appConfig.convertScene) {
+        window = SDL_CreateWindow("Vulkan 3D Room",
+                                SDL_WINDOWPOS_CENTERED,
+                                SDL_WINDOWPOS_CENTERED,
+                                WINDOW_WIDTH, WINDOW_HEIGHT,
+                                SDL_WINDOW_VULKAN | SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+        if (!window) {
+            SDL_Log("Window creation failed: %s", SDL_GetError());
+            return 1;
+        }
     }
 
-    if (!initVulkan(window)) {
+    if (appConfig.convertScene) {
+        return startupScene() && writeSceneFile(appConfig.convertScene) ? 1 : -1;
+    }
+    // The scene is built or loaded by the startup graph, alongside device setup
+    jobSystemInit(appConfig.recordThreads);
+
+    if (!initVulkan()) {
         SDL_Log("Vulkan initialization failed");
         return 1;
     }
 
+    if (appConfig.bench) {
+        benchInit();
+    }
+
     return 0;
 }
 
 int SDL_AppEvent(void* appstate, SDL_Event* event) {
-    if (event->type == SDL_EVENT_QUIT) {
+    bool quit = false;
+    uiHandleEvent(event, &quit);
+    if (quit) {
         return 1;
     }
+    switch (event->type) {
+    case SDL_EVENT_QUIT:
+        return 1;
+    case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+        vkContext.swapchainDirty = true;
+        break;
+    case SDL_EVENT_KEY_DOWN:
+        if (event->key.keysym.sym == SDLK_p && !vkContext.headless) {
+            cyclePresentMode();
+        }
+        // fallthrough
+    case SDL_EVENT_MOUSE_MOTION:
+    case SDL_EVENT_MOUSE_BUTTON_DOWN:
+        if (pendingInputNs == 0) {
+            pendingInputNs = event->common.timestamp;
+        }
+        break;
+    }
     return 0;
 }
 
 int SDL_AppIterate(void* appstate) {
-    vkWaitForFences(vkContext.device, 1, &vkContext.inFlightFence, VK_TRUE, UINT64_MAX);
-    vkResetFences(vkContext.device, 1, &vkContext.inFlightFence);
+    Uint64 frameStart = SDL_GetPerformanceCounter();
+    FrameData* frame = &vkContext.frames[vkContext.currentFrame];
 
-    uint32_t imageIndex;
-    vkAcquireNextImageKHR(vkContext.device, vkContext.swapchain, UINT64_MAX,
-                         vkContext.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+    // Only wait for the GPU to finish the frame that last used this slot; the
+    // other slots may still be executing while we record this one.
+    vkWaitForFences(vkContext.device, 1, &frame->inFlightFence, VK_TRUE, UINT64_MAX);
+    Uint64 waitTicks = SDL_GetPerformanceCounter() - frameStart;
+    profilerEnd("fence wait", frameStart);
 
-    vkResetCommandBuffer(vkContext.commandBuffer, 0);
-    
-    VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-    vkBeginCommandBuffer(vkContext.commandBuffer, &beginInfo);
+    // The slot's previous timestamps are guaranteed to be available now
+    double gpuFrameMs = profilerResolveGpu(vkContext.currentFrame);
+    if (appConfig.bench && gpuFrameMs >= 0.0) {
+        benchAddGpuTime(gpuFrameMs);
+    }
+    cullerCollectStats(vkContext.currentFrame);
+    streamerRelease(vkContext.currentFrame);
+    uniformsRelease(vkContext.currentFrame);
+    shadingStatsCollect(vkContext.currentFrame);
 
-    VkRenderPassBeginInfo renderPassInfo = {VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
-    renderPassInfo.renderPass = vkContext.renderPass;
-    renderPassInfo.framebuffer = vkContext.framebuffers[imageIndex];
-    renderPassInfo.renderArea.offset = (VkOffset2D){0, 0};
-    renderPassInfo.renderArea.extent = (VkExtent2D){WINDOW_WIDTH, WINDOW_HEIGHT};
-    VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
-
-    vkCmdBeginRenderPass(vkContext.commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(vkContext.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vkContext.graphicsPipeline);
-    VkBuffer vertexBuffers[] = {vkContext.vertexBuffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(vkContext.commandBuffer, 0, 1, vertexBuffers, offsets);
-    vkCmdBindIndexBuffer(vkContext.commandBuffer, vkContext.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-    vkCmdDrawIndexed(vkContext.commandBuffer, sizeof(indices)/sizeof(indices[0]), 1, 0, 0, 0);
-    vkCmdEndRenderPass(vkContext.commandBuffer);
-    vkEndCommandBuffer(vkContext.commandBuffer);
+    // Everything retired at least framesInFlight frames ago is idle now
+    destroyRetiredSwapchains(false);
+
+    // Headless targets are owned one-to-one by frame slots, so there is nothing to acquire
+    Uint64 scope = profilerBegin();
+    uint32_t imageIndex = vkContext.currentFrame;
+    if (!vkContext.headless) {
+        if (vkContext.swapchainDirty && !recreateSwapchain()) {
+            // Closed on every early return, so rebuild frames count toward acquire
+            profilerEnd("acquire", scope);
+            if (vkContext.swapchainLost) {
+                SDL_Log("Failed to recreate the framebuffers");
+                return -1;
+            }
+            // Minimized: nothing to render into until the window has a size again
+            SDL_Delay(10);
+            return 0;
+        }
+        VkResult acquired = vkAcquireNextImageKHR(vkContext.device, vkContext.swapchain, UINT64_MAX,
+                                                  frame->imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+        if (acquired == VK_ERROR_OUT_OF_DATE_KHR) {
+            // The semaphore was not signaled and the fence not reset, so the slot can simply be retried
+            vkContext.swapchainDirty = true;
+            profilerEnd("acquire", scope);
+            return 0;
+        }
+        // SUBOPTIMAL still signals the semaphore; present this frame and rebuild afterwards
+        if (acquired == VK_SUBOPTIMAL_KHR) {
+            vkContext.swapchainDirty = true;
+        }
+    }
+
+    // The swapchain may hand back an image that a different frame slot is still rendering to
+    if (vkContext.imagesInFlight[imageIndex] != VK_NULL_HANDLE &&
+        vkContext.imagesInFlight[imageIndex] != frame->inFlightFence) {
+        vkWaitForFences(vkContext.device, 1, &vkContext.imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+    }
+    vkContext.imagesInFlight[imageIndex] = frame->inFlightFence;
+    profilerEnd("acquire", scope);
+
+    // A paced frame sleeps here, then pumps events so that input arriving
+    // during the sleep still reaches it. SDL dispatches pumped events to
+    // SDL_AppEvent immediately.
+    scope = profilerBegin();
+    pacerWait(&pacer);
+    SDL_PumpEvents();
+    Uint64 workStartNs = SDL_GetTicksNS();
+    profilerEnd("pace", scope);
+
+    // This frame is the first to see any input that arrived before recording
+    Uint64 inputNs = pendingInputNs;
+    pendingInputNs = 0;
+
+    // Headless runs advance a fixed 1/60 s per frame so the final frame, and
+    // its checksum, does not depend on how fast the machine is
+    double seconds = vkContext.headless ? (double)frameCount / 60.0
+                                        : ticksToMs(SDL_GetPerformanceCounter() - appStartTicks) / 1000.0;
+    if (appConfig.staticScene) {
+        seconds = 0.0;
+    }
+    scope = profilerBegin();
+    cameraUpdate(seconds);
+    lodUpdate();
+    uniformsUpdate(vkContext.currentFrame, seconds);
+    uiBuild(vkContext.currentFrame);
+    profilerEnd("update", scope);
+
+    scope = profilerBegin();
+    recordCommandBuffer(frame, imageIndex);
+    Uint64 recordTicks = SDL_GetPerformanceCounter() - scope;
+    profilerEnd("record", scope);
 
     VkSubmitInfo submitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
-    VkSemaphore waitSemaphores[] = {vkContext.imageAvailableSemaphore};
+    VkSemaphore waitSemaphores[] = {frame->imageAvailableSemaphore};
     VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = waitSemaphores;
-    submitInfo.pWaitDstStageMask = waitStages;
+    VkSemaphore signalSemaphores[1] = {VK_NULL_HANDLE};
+    if (!vkContext.headless) {
+        signalSemaphores[0] = vkContext.renderFinishedSemaphores[imageIndex];
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = waitSemaphores;
+        submitInfo.pWaitDstStageMask = waitStages;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = signalSemaphores;
+    }
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &vkContext.commandBuffer;
-    VkSemaphore signalSemaphores[] = {vkContext.renderFinishedSemaphore};
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = signalSemaphores;
+    submitInfo.pCommandBuffers = &frame->commandBuffer;
+
+    // The first frame to draw streamed data waits for its transfer. It has
+    // already completed when this frame was recorded, so this never stalls.
+    VkSemaphore frameWaits[2];
+    VkPipelineStageFlags frameWaitStages[2];
+    uint64_t frameWaitValues[2] = {0, 0};
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    if (vkContext.frameUploadWait) {
+        uint32_t waitCount = submitInfo.waitSemaphoreCount;
+        if (waitCount) {
+            frameWaits[0] = waitSemaphores[0];
+            frameWaitStages[0] = waitStages[0];
+        }
+        frameWaits[waitCount] = vkContext.uploadTimeline;
+        frameWaitStages[waitCount] = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        frameWaitValues[waitCount] = vkContext.frameUploadWait;
+        submitInfo.waitSemaphoreCount = waitCount + 1;
+        submitInfo.pWaitSemaphores = frameWaits;
+        submitInfo.pWaitDstStageMask = frameWaitStages;
+        timelineInfo.waitSemaphoreValueCount = waitCount + 1;
+        timelineInfo.pWaitSemaphoreValues = frameWaitValues;
+        submitInfo.pNext = &timelineInfo;
+        vkContext.frameUploadWait = 0;
+    }
+
+    // Reset as late as possible so an early-out above never leaves the slot unsignaled
+    scope = profilerBegin();
+    vkResetFences(vkContext.device, 1, &frame->inFlightFence);
+    vkQueueSubmit(vkContext.graphicsQueue, 1, &submitInfo, frame->inFlightFence);
+    profilerEnd("submit", scope);
 
-    vkQueueSubmit(vkContext.graphicsQueue, 1, &submitInfo, vkContext.inFlightFence);
+    scope = profilerBegin();
+    if (!vkContext.headless) {
+        VkPresentInfoKHR presentInfo = {VK_STRUCTURE_TYPE_PRESENT_INFO_KHR};
+        presentInfo.waitSemaphoreCount = 1;
+        presentInfo.pWaitSemaphores = signalSemaphores;
+        VkSwapchainKHR swapchains[] = {vkContext.swapchain};
+        presentInfo.swapchainCount = 1;
+        presentInfo.pSwapchains = swapchains;
+        presentInfo.pImageIndices = &imageIndex;
+        VkResult presented = vkQueuePresentKHR(vkContext.presentQueue, &presentInfo);
+        if (presented == VK_ERROR_OUT_OF_DATE_KHR || presented == VK_SUBOPTIMAL_KHR) {
+            vkContext.swapchainDirty = true;
+        }
+        if (inputNs) {
+            recordLatency(inputNs);
+        }
+        Uint64 presentNs = SDL_GetTicksNS();
+        if (lastPresentNs) {
+            histogramAdd(&presentIntervals, (double)(presentNs - lastPresentNs) / 1e6);
+        }
+        lastPresentNs = presentNs;
+    }
+    profilerEnd("present", scope);
+    pacerFrameDone(&pacer, SDL_GetTicksNS() - workStartNs);
+    profilerEnd("frame", frameStart);
+
+    vkContext.currentFrame = (vkContext.currentFrame + 1) % vkContext.framesInFlight;
 
-    VkPresentInfoKHR presentInfo = {VK_STRUCTURE_TYPE_PRESENT_INFO_KHR};
-    presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = signalSemaphores;
-    VkSwapchainKHR swapchains[] = {vkContext.swapchain};
-    presentInfo.swapchainCount = 1;
-    presentInfo.pSwapchains = swapchains;
-    presentInfo.pImageIndices = &imageIndex;
-    vkQueuePresentKHR(vkContext.graphicsQueue, &presentInfo);
+    if (frameCount++ == 0) {
+        firstFrameTicks = SDL_GetPerformanceCounter();
+        SDL_Log("Time to first presented frame: %.2f ms (%s pipeline cache, pipeline creation %.2f ms)",
+                ticksToMs(firstFrameTicks - appStartTicks),
+                vkContext.pipelineCacheWarm ? "warm" : "cold", pipelineCreateMs);
+    }
 
+    if (appConfig.bench) {
+        return benchEndFrame(frameStart, waitTicks, recordTicks);
+    }
     return 0;
 }
 
+// Subpass 0 is the depth pre-pass when there is one
+static VkPipeline subpassPipeline(uint32_t subpass) {
+    return appConfig.depthPrepass && subpass == 0 ? vkContext.depthPipeline : vkContext.graphicsPipeline;
+}
+
+// Shared by the inline path and the secondary buffers. Per-draw timestamps
+// need the frame's scope list, which is not thread safe, so workers pass
+// UINT32_MAX as profileSlot.
+static void recordDraws(VkCommandBuffer commandBuffer, uint32_t subpass, uint32_t firstDraw, uint32_t drawCount,
+                        uint32_t profileSlot) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, subpassPipeline(subpass));
+    VkViewport viewport = {0.0f, 0.0f, (float)vkContext.extent.width, (float)vkContext.extent.height, 0.0f, 1.0f};
+    VkRect2D scissor = {{0, 0}, vkContext.extent};
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    VkBuffer vertexBuffers[] = {vkContext.vertexBuffer.buffer, vkContext.identityInstanceBuffer.buffer};
+    VkDeviceSize offsets[] = {0, 0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, vkContext.indexBuffer.buffer, 0, scene.indexType);
+    CameraConstants constants = {camera.viewProj};
+    vkCmdPushConstants(commandBuffer, vkContext.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                       sizeof(constants), &constants);
+    bool profileDraws = appConfig.profileDraws && profileSlot != UINT32_MAX;
+    for (uint32_t i = firstDraw; i < firstDraw + drawCount; i++) {
+        const SceneDraw* draw = &scene.draws[i];
+        uint32_t drawScope = profileDraws ? profilerGpuBegin(commandBuffer, profileSlot, "draw", i) : UINT32_MAX;
+        const SceneLod* lod = &scene.meshes[draw->mesh].lods[lodState.drawLevels[i]];
+        bindFrameUniforms(commandBuffer, i);
+        vkCmdDrawIndexed(commandBuffer, lod->indexCount, 1, lod->firstIndex, draw->vertexOffset, 0);
+        profilerGpuEnd(commandBuffer, profileSlot, drawScope);
+    }
+}
+
+// Begins a secondary buffer that continues the given subpass. Without a
+// framebuffer it can run inside any framebuffer of the render pass.
+static void beginSubpassSecondary(VkCommandBuffer commandBuffer, uint32_t subpass, VkFramebuffer framebuffer,
+                                  VkCommandBufferUsageFlags flags) {
+    VkCommandBufferInheritanceInfo inheritance = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO};
+    inheritance.renderPass = vkContext.renderPass;
+    inheritance.subpass = subpass;
+    inheritance.framebuffer = framebuffer;
+    if (shadingStats.pool) {
+        inheritance.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+    }
+    VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = flags | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritance;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+}
+
+// Takes the next secondary buffer from a worker's pool for this frame slot
+// and begins it inside the given subpass
+static VkCommandBuffer beginSecondary(FrameData* frame, uint32_t worker, uint32_t imageIndex, uint32_t subpass) {
+    RecordPool* pool = &frame->recordPools[worker];
+    if (pool->used == pool->bufferCount) {
+        VkCommandBufferAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        allocInfo.commandPool = pool->pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+        pool->buffers = realloc(pool->buffers, sizeof(VkCommandBuffer) * (pool->bufferCount + 1));
+        vkAllocateCommandBuffers(vkContext.device, &allocInfo, &pool->buffers[pool->bufferCount++]);
+    }
+    VkCommandBuffer commandBuffer = pool->buffers[pool->used++];
+    beginSubpassSecondary(commandBuffer, subpass, vkContext.framebuffers[imageIndex],
+                          VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    return commandBuffer;
+}
+
+// Job: records one contiguous range of the draw list into a secondary
+// buffer taken from the calling worker's pool for this frame slot
+static void recordChunkJob(void* data, uint32_t worker) {
+    const RecordChunk* chunk = data;
+    FrameData* frame = &vkContext.frames[chunk->slot];
+    VkCommandBuffer commandBuffer = beginSecondary(frame, worker, chunk->imageIndex, chunk->subpass);
+    recordDraws(commandBuffer, chunk->subpass, chunk->firstDraw, chunk->drawCount, UINT32_MAX);
+    vkEndCommandBuffer(commandBuffer);
+
+    frame->secondaries[chunk->chunk] = commandBuffer;
+}
+
+// Splits the draw list into chunks, records them on the job system and
+// returns how many secondaries the primary has to execute
+static uint32_t recordSecondaries(uint32_t slot, uint32_t imageIndex, uint32_t subpass) {
+    uint32_t chunkCount = jobs.workerCount * RECORD_CHUNKS_PER_WORKER;
+    if (chunkCount > scene.drawCount / MIN_DRAWS_PER_CHUNK) {
+        chunkCount = scene.drawCount / MIN_DRAWS_PER_CHUNK;
+    }
+    uint32_t drawsPerChunk = (scene.drawCount + chunkCount - 1) / chunkCount;
+
+    SDL_AtomicInt pending = {0};
+    uint32_t firstDraw = 0;
+    uint32_t chunk = 0;
+    while (firstDraw < scene.drawCount) {
+        RecordChunk* recordChunk = &recordChunks[chunk];
+        recordChunk->slot = slot;
+        recordChunk->imageIndex = imageIndex;
+        recordChunk->chunk = chunk++;
+        recordChunk->subpass = subpass;
+        recordChunk->firstDraw = firstDraw;
+        recordChunk->drawCount = SDL_min(drawsPerChunk, scene.drawCount - firstDraw);
+        firstDraw += recordChunk->drawCount;
+        jobSubmit(recordChunkJob, recordChunk, &pending);
+    }
+    jobWait(&pending);
+    return chunk;
+}
+
+static void commandCacheInvalidate(void) {
+    commandCache.generation++;
+}
+
+// Records every subpass's draws into the slot's cached secondaries. Nothing
+// is lost by recording on one thread, since this only happens after a change.
+// Each slot has its own copies, which are idle once its fence has been
+// waited on. No copy is ever pending twice, so SIMULTANEOUS_USE is not needed.
+static void recordCachedDraws(FrameData* frame, uint32_t subpassCount) {
+    for (uint32_t subpass = 0; subpass < subpassCount; subpass++) {
+        if (!frame->cached[subpass]) {
+            VkCommandBufferAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+            allocInfo.commandPool = vkContext.commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+            vkAllocateCommandBuffers(vkContext.device, &allocInfo, &frame->cached[subpass]);
+        }
+        beginSubpassSecondary(frame->cached[subpass], subpass, VK_NULL_HANDLE, 0);
+        recordDraws(frame->cached[subpass], subpass, 0, scene.drawCount, UINT32_MAX);
+        vkEndCommandBuffer(frame->cached[subpass]);
+    }
+    frame->cachedGeneration = commandCache.generation;
+    commandCache.records++;
+}
+
+static void recordCommandBuffer(FrameData* frame, uint32_t imageIndex) {
+    VkCommandBuffer commandBuffer = frame->commandBuffer;
+    vkResetCommandBuffer(commandBuffer, 0);
+    
+    VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    uint32_t slot = (uint32_t)(frame - vkContext.frames);
+    profilerGpuBeginFrame(commandBuffer, slot);
+    uint32_t frameScope = profilerGpuBegin(commandBuffer, slot, "gpu frame", UINT32_MAX);
+    streamerRecord(commandBuffer, slot);
+    bool cull = culler.enabled && sceneResident;
+    if (cull) {
+        uint32_t cullScope = profilerGpuBegin(commandBuffer, slot, "gpu cull", UINT32_MAX);
+        cullerRecord(commandBuffer, slot);
+        profilerGpuEnd(commandBuffer, slot, cullScope);
+    }
+    uint32_t passScope = profilerGpuBegin(commandBuffer, slot, "gpu render pass", UINT32_MAX);
+
+    VkRenderPassBeginInfo renderPassInfo = {VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO};
+    renderPassInfo.renderPass = vkContext.renderPass;
+    renderPassInfo.framebuffer = vkContext.framebuffers[imageIndex];
+    renderPassInfo.renderArea.offset = (VkOffset2D){0, 0};
+    renderPassInfo.renderArea.extent = vkContext.extent;
+    VkClearValue clearValues[2];
+    clearValues[0].color = (VkClearColorValue){{0.0f, 0.0f, 0.0f, 1.0f}};
+    clearValues[1].depthStencil = (VkClearDepthStencilValue){1.0f, 0};
+    renderPassInfo.clearValueCount = 2;
+    renderPassInfo.pClearValues = clearValues;
+
+    // Small scenes and single-threaded runs record inline; the secondary
+    // buffer overhead only pays off once there is enough work to split
+    // Per-draw GPU scopes write this frame's query slots, so they are never cached
+    bool cached = appConfig.cacheCommands && sceneResident && !cull && !appConfig.profileDraws;
+    bool parallel = !cached && sceneResident && !cull && jobs.workerCount > 1 &&
+                    scene.drawCount >= MIN_DRAWS_PER_CHUNK * 2;
+    bool secondaries = cached || parallel;
+    // Without inheritedQueries a query cannot stay active across secondaries
+    bool stats = shadingStats.pool && sceneResident && (!secondaries || shadingStats.inherited);
+    if (stats) {
+        vkCmdResetQueryPool(commandBuffer, shadingStats.pool, slot, 1);
+        vkCmdBeginQuery(commandBuffer, shadingStats.pool, slot, 0);
+    }
+    VkSubpassContents contents = secondaries ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                                             : VK_SUBPASS_CONTENTS_INLINE;
+    uint32_t subpassCount = appConfig.depthPrepass ? 2 : 1;
+    // The slot's fence has been waited on, so its secondaries are idle
+    for (uint32_t i = 0; i < jobs.workerCount && secondaries; i++) {
+        vkResetCommandPool(vkContext.device, frame->recordPools[i].pool, 0);
+        frame->recordPools[i].used = 0;
+    }
+    if (cached && frame->cachedGeneration != commandCache.generation) {
+        recordCachedDraws(frame, subpassCount);
+    } else if (cached) {
+        commandCache.replays++;
+    }
+    for (uint32_t subpass = 0; subpass < subpassCount; subpass++) {
+        if (subpass == 0) {
+            vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, contents);
+        } else {
+            vkCmdNextSubpass(commandBuffer, contents);
+        }
+        // The overlay goes last, over the shaded scene
+        bool overlay = subpass == subpassCount - 1;
+        if (cull) {
+            cullerDraw(commandBuffer, slot, subpass);
+        } else if (secondaries) {
+            uint32_t secondaryCount = 0;
+            if (cached) {
+                frame->secondaries[secondaryCount++] = frame->cached[subpass];
+            } else {
+                secondaryCount = recordSecondaries(slot, imageIndex, subpass);
+            }
+            // Every chunk has been recorded, so worker 0's pool is free on this thread
+            if (overlay && ui.quadCount > 0) {
+                VkCommandBuffer overlayBuffer = beginSecondary(frame, 0, imageIndex, subpass);
+                uiDraw(overlayBuffer, slot);
+                vkEndCommandBuffer(overlayBuffer);
+                frame->secondaries[secondaryCount++] = overlayBuffer;
+            }
+            vkCmdExecuteCommands(commandBuffer, secondaryCount, frame->secondaries);
+        } else if (sceneResident) {
+            recordDraws(commandBuffer, subpass, 0, scene.drawCount, slot);
+        }
+        if (overlay && !secondaries) {
+            uiDraw(commandBuffer, slot);
+        }
+    }
+    vkCmdEndRenderPass(commandBuffer);
+    if (stats) {
+        vkCmdEndQuery(commandBuffer, shadingStats.pool, slot);
+        shadingStats.pending[slot] = true;
+    }
+    profilerGpuEnd(commandBuffer, slot, passScope);
+
+    if (cull) {
+        // Visible counts are summed on the CPU once this slot's fence has signaled
+        VkBufferCopy region = {0, 0, sizeof(VkDrawIndexedIndirectCommand) * culler.commandCount};
+        vkCmdCopyBuffer(commandBuffer, culler.drawBuffers[slot].buffer, culler.statsBuffers[slot].buffer, 1, &region);
+        VkMemoryBarrier hostBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                             0, 1, &hostBarrier, 0, NULL, 0, NULL);
+        culler.statsPending[slot] = true;
+    }
+    profilerGpuEnd(commandBuffer, slot, frameScope);
+    vkEndCommandBuffer(commandBuffer);
+}
+
 void SDL_AppQuit(void* appstate) {
-    cleanupVulkan();
-    SDL_DestroyWindow(window);
+    if (frameCount > 1) {
+        double seconds = (double)(SDL_GetPerformanceCounter() - firstFrameTicks) / (double)SDL_GetPerformanceFrequency();
+        SDL_Log("%llu frames, %.1f fps with %u frame(s) in flight",
+                (unsigned long long)frameCount, (double)(frameCount - 1) / seconds, vkContext.framesInFlight);
+    }
+    free(bench.cpuFrameMs);
+    free(bench.gpuFrameMs);
+    free(bench.frameIntervalMs);
+    free(bench.recordMs);
+    profilerLogStats();
+    profilerShutdown();
+    logLatencyStats();
+    if (appConfig.latencyOutput) {
+        writeLatencyFile(appConfig.latencyOutput);
+    }
+    if (culler.visibleSamples) {
+        SDL_Log("Culling: %.1f of %u instances visible on average",
+                (double)culler.visibleTotal / culler.visibleSamples, scene.instanceCount);
+    }
+    if (lodState.samples) {
+        SDL_Log("Geometry: %.0f triangles per frame%s", (double)lodState.triangleTotal / lodState.samples,
+                appConfig.lod ? "" : " (LOD disabled)");
+    }
+    if (appConfig.cacheCommands) {
+        SDL_Log("Command cache: %u frames replayed, %u recorded", commandCache.replays, commandCache.records);
+    }
+    if (ui.samples) {
+        SDL_Log("Overlay: %.1f quads per frame in one draw, %u dropped", (double)ui.quadTotal / ui.samples,
+                ui.droppedQuads);
+    }
+    if (shadingStats.samples) {
+        double fragments = (double)shadingStats.fragmentTotal / shadingStats.samples;
+        SDL_Log("Shading: %.0f fragment shader invocations per frame, %.2fx overdraw%s", fragments,
+                fragments / ((double)vkContext.extent.width * vkContext.extent.height),
+                appConfig.depthPrepass ? " (with depth pre-pass)" : "");
+    }
+
+    streamerStop();
+
+    // Frames may still be executing; nothing can be destroyed until they finish
+    // Nothing was created when only converting a scene
+    if (vkContext.device) {
+        vkDeviceWaitIdle(vkContext.device);
+        savePipelineCache();
+        cleanupVulkan();
+    }
+    jobSystemShutdown();
+    destroyScene();
+    if (window) {
+        SDL_DestroyWindow(window);
+    }
     SDL_Quit();
 }
 
-// Vulkan initialization functions (simplified)
-static bool initVulkan(SDL_Window* window) {
-    // Create instance
+// Creates the instance and, with a window, its surface
+static bool createInstance(void) {
     VkApplicationInfo appInfo = {VK_STRUCTURE_TYPE_APPLICATION_INFO};
     appInfo.pApplicationName = "Vulkan Room";
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
@@ -184,59 +1601,874 @@ static bool initVulkan(SDL_Window* window) {
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.apiVersion = VK_API_VERSION_1_0;
 
-    const char* extensions[] = {VK_KHR_SURFACE_EXTENSION_NAME, "VK_KHR_win32_surface"};
+    // Ask SDL for the platform surface extensions instead of assuming win32,
+    // so the same binary runs on Linux software ICDs such as lavapipe
+    Uint32 sdlExtensionCount = 0;
+    const char* const* sdlExtensions = NULL;
+    if (!vkContext.headless) {
+        sdlExtensions = SDL_Vulkan_GetInstanceExtensions(&sdlExtensionCount);
+    }
+    const char** instanceExtensions = malloc(sizeof(const char*) * (sdlExtensionCount + 1));
+    uint32_t instanceExtensionCount = 0;
+    for (uint32_t i = 0; i < sdlExtensionCount; i++) {
+        instanceExtensions[instanceExtensionCount++] = sdlExtensions[i];
+    }
+
+    // Device extensions written against Vulkan 1.0 (timeline semaphores among
+    // them) depend on this one
+    uint32_t availableCount = 0;
+    vkEnumerateInstanceExtensionProperties(NULL, &availableCount, NULL);
+    VkExtensionProperties* availableInstance = malloc(sizeof(VkExtensionProperties) * availableCount);
+    vkEnumerateInstanceExtensionProperties(NULL, &availableCount, availableInstance);
+    for (uint32_t i = 0; i < availableCount; i++) {
+        if (strcmp(availableInstance[i].extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+            vkContext.properties2 = true;
+            instanceExtensions[instanceExtensionCount++] = VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME;
+        }
+    }
+    free(availableInstance);
+
     VkInstanceCreateInfo createInfo = {VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO};
     createInfo.pApplicationInfo = &appInfo;
-    createInfo.enabledExtensionCount = 2;
-    createInfo.ppEnabledExtensionNames = extensions;
+    createInfo.enabledExtensionCount = instanceExtensionCount;
+    createInfo.ppEnabledExtensionNames = instanceExtensions;
 
-    if (vkCreateInstance(&createInfo, NULL, &vkContext.instance) != VK_SUCCESS) {
+    VkResult instanceResult = vkCreateInstance(&createInfo, NULL, &vkContext.instance);
+    free(instanceExtensions);
+    if (instanceResult != VK_SUCCESS) {
         return false;
     }
 
     // Create surface
-    if (!SDL_Vulkan_CreateSurface(window, vkContext.instance, NULL, &vkContext.surface)) {
+    if (!vkContext.headless && !SDL_Vulkan_CreateSurface(window, vkContext.instance, NULL, &vkContext.surface)) {
         return false;
     }
+    return true;
+}
+
+// Picks the physical device and creates the logical device, its queues and
+// everything that depends on nothing but the device
+static bool createDevice(void) {
+    if (!selectPhysicalDevice() || !selectQueueFamilies()) {
+        return false;
+    }
+
+    // One queue from each distinct family
+    uint32_t families[4] = {vkContext.graphicsFamily, vkContext.presentFamily,
+                            vkContext.transferFamily, vkContext.computeFamily};
+    VkDeviceQueueCreateInfo queueCreateInfos[4];
+    uint32_t queueCreateInfoCount = 0;
+    float queuePriority = 1.0f;
+    for (uint32_t i = 0; i < 4; i++) {
+        bool seen = false;
+        for (uint32_t j = 0; j < queueCreateInfoCount; j++) {
+            seen = seen || queueCreateInfos[j].queueFamilyIndex == families[i];
+        }
+        if (!seen) {
+            VkDeviceQueueCreateInfo* info = &queueCreateInfos[queueCreateInfoCount++];
+            *info = (VkDeviceQueueCreateInfo){VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO};
+            info->queueFamilyIndex = families[i];
+            info->queueCount = 1;
+            info->pQueuePriorities = &queuePriority;
+        }
+    }
+
+    uint32_t availableDeviceCount = 0;
+    vkEnumerateDeviceExtensionProperties(vkContext.physicalDevice, NULL, &availableDeviceCount, NULL);
+    VkExtensionProperties* availableDevice = malloc(sizeof(VkExtensionProperties) * availableDeviceCount);
+    vkEnumerateDeviceExtensionProperties(vkContext.physicalDevice, NULL, &availableDeviceCount, availableDevice);
+
+    const char* deviceExtensions[4];
+    uint32_t deviceExtensionCount = 0;
+    if (!vkContext.headless) {
+        deviceExtensions[deviceExtensionCount++] = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+    }
+
+    // Timeline semaphores order transfer-queue uploads against rendering. The
+    // feature is mandatory wherever the extension is exposed.
+    VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES};
+    bool timelineSemaphore = false;
+    for (uint32_t i = 0; i < availableDeviceCount && vkContext.properties2; i++) {
+        if (strcmp(availableDevice[i].extensionName, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) == 0) {
+            timelineSemaphore = true;
+            timelineFeatures.timelineSemaphore = VK_TRUE;
+            deviceExtensions[deviceExtensionCount++] = VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME;
+        }
+    }
+
+    // The GPU-driven path issues one indirect command per mesh and culls into
+    // ranges that start at firstInstance; both are optional 1.0 features
+    VkPhysicalDeviceFeatures supported;
+    vkGetPhysicalDeviceFeatures(vkContext.physicalDevice, &supported);
+    VkPhysicalDeviceFeatures features = {0};
+    // Fragment invocation counts; inheritedQueries keeps them on with parallel recording
+    features.pipelineStatisticsQuery = supported.pipelineStatisticsQuery;
+    features.inheritedQueries = supported.pipelineStatisticsQuery && supported.inheritedQueries;
+    bool drawIndirectCount = false;
+    if (appConfig.gpuDriven) {
+        features.multiDrawIndirect = supported.multiDrawIndirect;
+        features.drawIndirectFirstInstance = supported.drawIndirectFirstInstance;
+        for (uint32_t i = 0; i < availableDeviceCount; i++) {
+            if (strcmp(availableDevice[i].extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0) {
+                drawIndirectCount = true;
+                deviceExtensions[deviceExtensionCount++] = VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
+            }
+        }
+    }
+    // Lets the allocator see how much memory the OS grants this process
+    bool memoryBudget = false;
+    for (uint32_t i = 0; i < availableDeviceCount && vkContext.properties2; i++) {
+        if (strcmp(availableDevice[i].extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0) {
+            memoryBudget = true;
+            deviceExtensions[deviceExtensionCount++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+        }
+    }
+    free(availableDevice);
+
+    VkDeviceCreateInfo deviceCreateInfo = {VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO};
+    deviceCreateInfo.pNext = timelineSemaphore ? &timelineFeatures : NULL;
+    deviceCreateInfo.queueCreateInfoCount = queueCreateInfoCount;
+    deviceCreateInfo.pQueueCreateInfos = queueCreateInfos;
+    deviceCreateInfo.enabledExtensionCount = deviceExtensionCount;
+    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions;
+    deviceCreateInfo.pEnabledFeatures = &features;
+
+    if (vkCreateDevice(vkContext.physicalDevice, &deviceCreateInfo, NULL, &vkContext.device) != VK_SUCCESS) {
+        return false;
+    }
+    vkGetDeviceQueue(vkContext.device, vkContext.graphicsFamily, 0, &vkContext.graphicsQueue);
+    vkGetDeviceQueue(vkContext.device, vkContext.presentFamily, 0, &vkContext.presentQueue);
+    vkGetDeviceQueue(vkContext.device, vkContext.transferFamily, 0, &vkContext.transferQueue);
+    vkGetDeviceQueue(vkContext.device, vkContext.computeFamily, 0, &vkContext.computeQueue);
+
+    // Without timeline semaphores a separate transfer family is not worth the
+    // extra binary semaphore plumbing; uploads then stay on the graphics queue
+    vkContext.dedicatedTransfer = vkContext.transferFamily != vkContext.graphicsFamily && timelineSemaphore;
+    if (vkContext.dedicatedTransfer) {
+        vkContext.getSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR)
+            vkGetDeviceProcAddr(vkContext.device, "vkGetSemaphoreCounterValueKHR");
+        vkContext.waitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(vkContext.device, "vkWaitSemaphoresKHR");
+        VkSemaphoreTypeCreateInfo typeInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        typeInfo.initialValue = 0;
+        VkSemaphoreCreateInfo semaphoreInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+        semaphoreInfo.pNext = &typeInfo;
+        vkCreateSemaphore(vkContext.device, &semaphoreInfo, NULL, &vkContext.uploadTimeline);
+    } else {
+        vkContext.transferFamily = vkContext.graphicsFamily;
+        vkContext.transferQueue = vkContext.graphicsQueue;
+    }
+    SDL_Log("Queue families: graphics %u, present %u, transfer %u%s, compute %u%s",
+            vkContext.graphicsFamily, vkContext.presentFamily, vkContext.transferFamily,
+            vkContext.dedicatedTransfer ? " (dedicated)" : "", vkContext.computeFamily,
+            vkContext.computeFamily != vkContext.graphicsFamily ? " (async)" : "");
+
+    culler.multiDrawIndirect = features.multiDrawIndirect;
+    culler.drawIndirectFirstInstance = features.drawIndirectFirstInstance;
+    shadingStats.inherited = features.inheritedQueries;
+    if (features.pipelineStatisticsQuery) {
+        shadingStatsInit();
+    }
+    if (drawIndirectCount) {
+        culler.cmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)
+            vkGetDeviceProcAddr(vkContext.device, "vkCmdDrawIndexedIndirectCountKHR");
+    }
+
+    gpuAllocator.getMemoryProperties2 = memoryBudget ? (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)
+        vkGetInstanceProcAddr(vkContext.instance, "vkGetPhysicalDeviceMemoryProperties2KHR") : NULL;
+    gpuAllocatorInit();
+    createPipelineLayout();
+    return true;
+}
+
+// Startup stages. Each returns false when initialization cannot continue.
+static bool startupScene(void) {
+    if (appConfig.sceneFile) {
+        return loadSceneFile(appConfig.sceneFile);
+    }
+    buildScene(appConfig.rooms);
+    return true;
+}
+
+static bool startupSwapchain(void) {
+    return vkContext.headless ? createOffscreenTargets() : createSwapchain(VK_NULL_HANDLE);
+}
+
+static bool startupImageViews(void) {
+    createImageViews();
+    return true;
+}
+
+static bool startupPipelineCache(void) {
+    loadPipelineCache();
+    return vkContext.pipelineCache != VK_NULL_HANDLE;
+}
+
+static bool startupRenderPass(void) {
+    createRenderPass();
+    return vkContext.renderPass != VK_NULL_HANDLE;
+}
+
+static bool startupPipelines(void) {
+    createGraphicsPipeline();
+    return vkContext.graphicsPipeline != VK_NULL_HANDLE &&
+           (!appConfig.depthPrepass || vkContext.depthPipeline != VK_NULL_HANDLE);
+}
+
+static bool startupFramebuffers(void) {
+    if (!createFramebuffers()) {
+        return false;
+    }
+    SDL_Log("Depth: format %d, %s memory%s", vkContext.depthFormat,
+            vkContext.depthLazy ? "lazily allocated" : "device-local",
+            appConfig.depthPrepass ? ", depth pre-pass" : "");
+    return true;
+}
+
+static bool startupCommands(void) {
+    createCommandBuffers();
+    profilerInit();
+    return vkContext.commandPool != VK_NULL_HANDLE;
+}
+
+static bool startupSync(void) {
+    createSyncObjects();
+    return true;
+}
+
+// Buffers, the culler and the per-object uniforms, uploaded in one batch
+static bool startupGeometry(void) {
+    // Every mesh level but the first starts its instance range past zero. A
+    // single mesh can still be drawn at level 0 only.
+    if (appConfig.gpuDriven && !culler.drawIndirectFirstInstance) {
+        if (scene.meshCount > 1) {
+            SDL_Log("drawIndirectFirstInstance unsupported, cannot use the GPU-driven path");
+            return false;
+        }
+        if (appConfig.lod) {
+            SDL_Log("drawIndirectFirstInstance unsupported, LOD selection disabled");
+            appConfig.lod = false;
+        }
+    }
+
+    if (!stagingInit()) {
+        return false;
+    }
+    if (!createVertexBuffer() || !createIndexBuffer()) {
+        return false;
+    }
+    if (appConfig.gpuDriven && !cullerInit()) {
+        return false;
+    }
+    if (!uniformsInit() || !lodInit()) {
+        return false;
+    }
+    stagingFlush(true);
+    return true;
+}
+
+static uint32_t startupAdd(const char* name, StartupFunction function, uint32_t dependencies, bool mainThread) {
+    StartupTask* task = &startup.tasks[startup.taskCount];
+    task->name = name;
+    task->function = function;
+    task->dependencies = dependencies;
+    task->mainThread = mainThread;
+    return 1u << startup.taskCount++;
+}
+
+// A task whose dependencies have all finished goes to the job system, or is
+// flagged for the main thread to pick up
+static void startupRelease(StartupTask* task) {
+    if (task->mainThread) {
+        SDL_AtomicSet(&task->ready, 1);
+    } else {
+        jobSubmit(startupJob, task, &startup.jobs);
+    }
+}
+
+// Runs one stage, then releases every stage that was only waiting for it.
+// Once a stage has failed, the rest are skipped but still released so the
+// graph drains.
+static void startupRunTask(StartupTask* task, uint32_t worker) {
+    task->worker = worker;
+    task->start = SDL_GetPerformanceCounter();
+    task->ran = !SDL_AtomicGet(&startup.failed);
+    if (task->ran && !task->function()) {
+        SDL_Log("Startup stage %s failed", task->name);
+        SDL_AtomicSet(&startup.failed, 1);
+    }
+    task->end = SDL_GetPerformanceCounter();
+
+    uint32_t bit = 1u << (uint32_t)(task - startup.tasks);
+    for (uint32_t i = 0; i < startup.taskCount; i++) {
+        StartupTask* dependent = &startup.tasks[i];
+        if ((dependent->dependencies & bit) && SDL_AtomicAdd(&dependent->waiting, -1) == 1) {
+            startupRelease(dependent);
+        }
+    }
+    SDL_AtomicAdd(&startup.pending, -1);
+}
+
+static void startupJob(void* data, uint32_t worker) {
+    startupRunTask(data, worker);
+}
+
+// The calling thread runs the main-thread stages as they become ready and
+// helps with the job queues in between
+static bool startupRun(void) {
+    startup.start = SDL_GetPerformanceCounter();
+    SDL_AtomicSet(&startup.pending, (int)startup.taskCount);
+    for (uint32_t i = 0; i < startup.taskCount; i++) {
+        uint32_t waiting = 0;
+        for (uint32_t bits = startup.tasks[i].dependencies; bits; bits &= bits - 1) {
+            waiting++;
+        }
+        SDL_AtomicSet(&startup.tasks[i].waiting, (int)waiting);
+    }
+    for (uint32_t i = 0; i < startup.taskCount; i++) {
+        if (startup.tasks[i].dependencies == 0) {
+            startupRelease(&startup.tasks[i]);
+        }
+    }
+
+    while (SDL_AtomicGet(&startup.pending) > 0) {
+        bool ranMain = false;
+        for (uint32_t i = 0; i < startup.taskCount; i++) {
+            if (startup.tasks[i].mainThread && SDL_AtomicCAS(&startup.tasks[i].ready, 1, 0)) {
+                startupRunTask(&startup.tasks[i], 0);
+                ranMain = true;
+            }
+        }
+        if (!ranMain) {
+            jobTryRun(0);
+        }
+    }
+    startup.end = SDL_GetPerformanceCounter();
+    return !SDL_AtomicGet(&startup.failed);
+}
+
+// Logs each stage's start offset, duration and thread, and adds the stages
+// to the trace (stages run on thread N appear as tid 10 + N)
+static void startupReport(void) {
+    double wallMs = ticksToMs(startup.end - startup.start);
+    double stageMs = 0.0;
+    for (uint32_t i = 0; i < startup.taskCount; i++) {
+        stageMs += ticksToMs(startup.tasks[i].end - startup.tasks[i].start);
+    }
+    SDL_Log("Startup: %.2f ms, %.2f ms of stages on %u worker(s)", wallMs, stageMs, jobs.workerCount);
+    for (uint32_t i = 0; i < startup.taskCount; i++) {
+        const StartupTask* task = &startup.tasks[i];
+        double ms = ticksToMs(task->end - task->start);
+        SDL_Log("  %-14s %8.2f ms at +%8.2f ms on %s %u%s", task->name, ms,
+                ticksToMs(task->start - startup.start), task->worker == 0 ? "main" : "worker", task->worker,
+                task->ran ? "" : " (skipped)");
+        profilerTraceEvent(task->name, UINT32_MAX, 10 + (int)task->worker,
+                           ticksToMs(task->start - profiler.originTicks) * 1000.0, ms * 1000.0);
+    }
+}
+
+// Initialization as a task graph. The instance, device and swapchain are
+// created on the main thread, as window systems expect; the scene build,
+// pipeline compilation, framebuffers and uploads run on the job system as
+// soon as their inputs exist.
+static bool initVulkan(void) {
+    uint32_t scene = startupAdd("scene", startupScene, 0, false);
+    uint32_t instance = startupAdd("instance", createInstance, 0, true);
+    // A scene file decides between the per-draw and GPU-driven paths, and with
+    // them the device features
+    uint32_t device = startupAdd("device", createDevice, instance | (appConfig.sceneFile ? scene : 0), true);
+    uint32_t swapchain = startupAdd("swapchain", startupSwapchain, device, true);
+    uint32_t imageViews = startupAdd("image views", startupImageViews, swapchain, false);
+    uint32_t pipelineCache = startupAdd("pipeline cache", startupPipelineCache, device, false);
+    uint32_t renderPass = startupAdd("render pass", startupRenderPass, device, false);
+    startupAdd("pipelines", startupPipelines, renderPass | pipelineCache, false);
+    startupAdd("framebuffers", startupFramebuffers, renderPass | imageViews, false);
+    startupAdd("commands", startupCommands, device, false);
+    startupAdd("sync", startupSync, swapchain, false);
+    // The culler's compute pipeline goes through the pipeline cache
+    uint32_t geometry = startupAdd("geometry", startupGeometry, device | scene | pipelineCache, false);
+    // The atlas upload borrows the staging command buffer after the geometry upload
+    if (appConfig.overlay) {
+        startupAdd("overlay", uiInit, renderPass | pipelineCache | geometry, false);
+    }
+
+    bool ok = startupRun();
+    startupReport();
+    if (!ok) {
+        return false;
+    }
+    gpuLogStats("after geometry upload");
+
+    // A scene file keeps loading while the first frames render
+    if (streamer.sectionCount > 0) {
+        return streamerStart();
+    }
+    sceneResident = true;
+    return true;
+}
+
+// Picks a graphics family, preferring one that can also present, and a present
+// family. Where the hardware has them, it also picks a transfer-only (DMA)
+// family for uploads and a compute family without graphics for async compute.
+// Each of these falls back to the graphics family, which is all lavapipe and
+// many integrated GPUs expose.
+static bool findQueueFamilies(VkPhysicalDevice device, QueueFamilies* selection) {
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, NULL);
+    VkQueueFamilyProperties* families = malloc(sizeof(VkQueueFamilyProperties) * familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, families);
+
+    VkBool32* canPresent = calloc(familyCount, sizeof(VkBool32));
+    for (uint32_t i = 0; i < familyCount && !vkContext.headless; i++) {
+        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, vkContext.surface, &canPresent[i]);
+    }
+
+    uint32_t graphics = UINT32_MAX, present = UINT32_MAX, transfer = UINT32_MAX, compute = UINT32_MAX;
+    for (uint32_t i = 0; i < familyCount; i++) {
+        VkQueueFlags flags = families[i].queueFlags;
+        if ((flags & VK_QUEUE_GRAPHICS_BIT) && (graphics == UINT32_MAX || (canPresent[i] && !canPresent[graphics]))) {
+            graphics = i;
+        }
+        if (!(flags & VK_QUEUE_GRAPHICS_BIT)) {
+            // Compute families can always transfer, but a pure DMA family is the better copy engine
+            if ((flags & VK_QUEUE_COMPUTE_BIT) && compute == UINT32_MAX) {
+                compute = i;
+            }
+            if ((flags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+                (transfer == UINT32_MAX || !(flags & VK_QUEUE_COMPUTE_BIT))) {
+                transfer = i;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < familyCount && graphics != UINT32_MAX; i++) {
+        if (canPresent[i] && (present == UINT32_MAX || i == graphics)) {
+            present = i;
+        }
+    }
+    free(canPresent);
+    free(families);
+
+    selection->graphics = graphics;
+    selection->present = vkContext.headless ? graphics : present;
+    selection->transfer = transfer != UINT32_MAX ? transfer : graphics;
+    selection->compute = compute != UINT32_MAX ? compute : graphics;
+    return graphics != UINT32_MAX && selection->present != UINT32_MAX;
+}
+
+static bool selectQueueFamilies(void) {
+    QueueFamilies selection;
+    if (!findQueueFamilies(vkContext.physicalDevice, &selection)) {
+        SDL_Log("No queue family for %s", selection.graphics == UINT32_MAX ? "graphics" : "presentation");
+        return false;
+    }
+    vkContext.graphicsFamily = selection.graphics;
+    vkContext.presentFamily = selection.present;
+    vkContext.transferFamily = selection.transfer;
+    vkContext.computeFamily = selection.compute;
+    return true;
+}
+
+static bool hasDeviceExtension(VkPhysicalDevice device, const char* name) {
+    uint32_t count = 0;
+    vkEnumerateDeviceExtensionProperties(device, NULL, &count, NULL);
+    VkExtensionProperties* extensions = malloc(sizeof(VkExtensionProperties) * count);
+    vkEnumerateDeviceExtensionProperties(device, NULL, &count, extensions);
+    bool found = false;
+    for (uint32_t i = 0; i < count && !found; i++) {
+        found = strcmp(extensions[i].extensionName, name) == 0;
+    }
+    free(extensions);
+    return found;
+}
+
+// Ranks a device for this run, or returns -1 with the reason when it cannot
+// run it at all. Device type dominates, then device-local memory, then the
+// optional features and queue families the renderer makes use of.
+static int64_t scorePhysicalDevice(VkPhysicalDevice device, const char** reason) {
+    QueueFamilies families;
+    if (!findQueueFamilies(device, &families)) {
+        *reason = vkContext.headless ? "no graphics queue" : "cannot present to the window";
+        return -1;
+    }
+    if (!vkContext.headless && !hasDeviceExtension(device, VK_KHR_SWAPCHAIN_EXTENSION_NAME)) {
+        *reason = "no VK_KHR_swapchain";
+        return -1;
+    }
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(device, &features);
+    // Only known once a scene file is loaded, which the device stage waits for
+    if (appConfig.gpuDriven && appConfig.sceneFile && scene.meshCount > 1 && !features.drawIndirectFirstInstance) {
+        *reason = "no drawIndirectFirstInstance for a multi-mesh scene";
+        return -1;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    int64_t score = 0;
+    switch (properties.deviceType) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score += 4000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score += 3000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score += 2000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: score += 1000; break;
+    default: break;
+    }
+
+    // 50 points per GiB of the largest device-local heap, up to 16 GiB
+    VkPhysicalDeviceMemoryProperties memory;
+    vkGetPhysicalDeviceMemoryProperties(device, &memory);
+    VkDeviceSize localHeap = 0;
+    for (uint32_t i = 0; i < memory.memoryHeapCount; i++) {
+        if ((memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && memory.memoryHeaps[i].size > localHeap) {
+            localHeap = memory.memoryHeaps[i].size;
+        }
+    }
+    score += (int64_t)SDL_min(localHeap >> 30, (VkDeviceSize)16) * 50;
+
+    if (appConfig.gpuDriven) {
+        score += features.multiDrawIndirect ? 100 : 0;
+        score += features.drawIndirectFirstInstance ? 100 : 0;
+        score += hasDeviceExtension(device, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) ? 100 : 0;
+    }
+    score += features.pipelineStatisticsQuery ? 10 : 0;
+    score += families.transfer != families.graphics ? 50 : 0;
+    score += families.compute != families.graphics ? 50 : 0;
+    return score;
+}
 
-    // Pick physical device and create logical device (simplified)
+// VKROOM_DEVICE selects a device by index or by part of its name. Otherwise,
+// or when that device cannot run this configuration, the best score wins.
+static bool selectPhysicalDevice(void) {
     uint32_t deviceCount = 0;
     vkEnumeratePhysicalDevices(vkContext.instance, &deviceCount, NULL);
     VkPhysicalDevice* devices = malloc(sizeof(VkPhysicalDevice) * deviceCount);
     vkEnumeratePhysicalDevices(vkContext.instance, &deviceCount, devices);
-    vkContext.physicalDevice = devices[0];
+
+    const char* override = SDL_getenv("VKROOM_DEVICE");
+    bool overrideIsIndex = override && override[0] && strspn(override, "0123456789") == strlen(override);
+    int64_t bestScore = -1;
+    uint32_t best = UINT32_MAX;
+    uint32_t forced = UINT32_MAX;
+    for (uint32_t i = 0; i < deviceCount; i++) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(devices[i], &properties);
+        const char* reason = NULL;
+        int64_t score = scorePhysicalDevice(devices[i], &reason);
+        if (score < 0) {
+            SDL_Log("GPU %u: %s, unusable (%s)", i, properties.deviceName, reason);
+            continue;
+        }
+        SDL_Log("GPU %u: %s, score %lld", i, properties.deviceName, (long long)score);
+        if (score > bestScore) {
+            bestScore = score;
+            best = i;
+        }
+        if (override && forced == UINT32_MAX &&
+            (overrideIsIndex ? (uint32_t)SDL_atoi(override) == i : SDL_strstr(properties.deviceName, override) != NULL)) {
+            forced = i;
+        }
+    }
+    if (override && forced == UINT32_MAX) {
+        SDL_Log("VKROOM_DEVICE=%s matches no usable GPU, using the best score", override);
+    }
+
+    uint32_t chosen = forced != UINT32_MAX ? forced : best;
+    if (chosen != UINT32_MAX) {
+        vkContext.physicalDevice = devices[chosen];
+        SDL_Log("Using GPU %u%s", chosen, forced != UINT32_MAX ? " (VKROOM_DEVICE)" : "");
+    } else {
+        SDL_Log("No usable GPU among %u device(s)", deviceCount);
+    }
     free(devices);
+    return chosen != UINT32_MAX;
+}
 
-    VkDeviceQueueCreateInfo queueCreateInfo = {VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO};
-    float queuePriority = 1.0f;
-    queueCreateInfo.queueCount = 1;
-    queueCreateInfo.pQueuePriorities = &queuePriority;
+static const char* presentModeName(VkPresentModeKHR mode) {
+    switch (mode) {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+    case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+    case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+    default: return "unknown";
+    }
+}
 
-    VkDeviceCreateInfo deviceCreateInfo = {VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO};
-    deviceCreateInfo.queueCreateInfoCount = 1;
-    deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
-    deviceCreateInfo.enabledExtensionCount = 1;
-    const char* deviceExtensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
-    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions;
+// FIFO is the only mode every implementation must support, so it is the fallback
+static VkPresentModeKHR choosePresentMode(VkPresentModeKHR requested) {
+    uint32_t modeCount = 0;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(vkContext.physicalDevice, vkContext.surface, &modeCount, NULL);
+    VkPresentModeKHR* modes = malloc(sizeof(VkPresentModeKHR) * modeCount);
+    vkGetPhysicalDeviceSurfacePresentModesKHR(vkContext.physicalDevice, vkContext.surface, &modeCount, modes);
+
+    VkPresentModeKHR chosen = VK_PRESENT_MODE_FIFO_KHR;
+    for (uint32_t i = 0; i < modeCount; i++) {
+        if (modes[i] == requested) {
+            chosen = requested;
+        }
+    }
+    free(modes);
+    if (chosen != requested) {
+        SDL_Log("Present mode %s not supported, using fifo", presentModeName(requested));
+    }
+    return chosen;
+}
+
+// MAILBOX needs a spare image to replace while one is displayed and one is
+// being rendered; the other modes get by with one more than the minimum
+static uint32_t chooseImageCount(const VkSurfaceCapabilitiesKHR* caps, VkPresentModeKHR mode) {
+    uint32_t count = appConfig.swapchainImages;
+    if (count == 0) {
+        count = caps->minImageCount + 1;
+        if (mode == VK_PRESENT_MODE_MAILBOX_KHR && count < 3) {
+            count = 3;
+        }
+    }
+    if (count < caps->minImageCount) {
+        count = caps->minImageCount;
+    }
+    // maxImageCount of 0 means no upper limit
+    if (caps->maxImageCount > 0 && count > caps->maxImageCount) {
+        count = caps->maxImageCount;
+    }
+    return count;
+}
+
+// Creates the swapchain at the window's current pixel size. Returns false
+// without touching the current swapchain while the window has no area.
+static bool createSwapchain(VkSwapchainKHR oldSwapchain) {
+    VkSurfaceCapabilitiesKHR caps;
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vkContext.physicalDevice, vkContext.surface, &caps);
+
+    // currentExtent is 0xFFFFFFFF on platforms where the swapchain defines the surface size
+    VkExtent2D extent = caps.currentExtent;
+    if (extent.width == UINT32_MAX) {
+        int width = 0, height = 0;
+        SDL_GetWindowSizeInPixels(window, &width, &height);
+        extent.width = SDL_clamp((uint32_t)width, caps.minImageExtent.width, caps.maxImageExtent.width);
+        extent.height = SDL_clamp((uint32_t)height, caps.minImageExtent.height, caps.maxImageExtent.height);
+    }
+    if (extent.width == 0 || extent.height == 0) {
+        return false;
+    }
 
-    vkCreateDevice(vkContext.physicalDevice, &deviceCreateInfo, NULL, &vkContext.device);
-    vkGetDeviceQueue(vkContext.device, 0, 0, &vkContext.graphicsQueue);
+    VkPresentModeKHR presentMode = choosePresentMode(appConfig.presentMode);
+    uint32_t imageCount = chooseImageCount(&caps, presentMode);
 
-    // Create swapchain (simplified)
     VkSwapchainCreateInfoKHR swapchainCreateInfo = {VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR};
     swapchainCreateInfo.surface = vkContext.surface;
-    swapchainCreateInfo.minImageCount = 2;
+    swapchainCreateInfo.minImageCount = imageCount;
     swapchainCreateInfo.imageFormat = VK_FORMAT_B8G8R8A8_UNORM;
     swapchainCreateInfo.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
-    swapchainCreateInfo.imageExtent = (VkExtent2D){WINDOW_WIDTH, WINDOW_HEIGHT};
+    swapchainCreateInfo.imageExtent = extent;
     swapchainCreateInfo.imageArrayLayers = 1;
     swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-    vkCreateSwapchainKHR(vkContext.device, &swapchainCreateInfo, NULL, &vkContext.swapchain);
+    // Rare split graphics/present families share the images rather than
+    // transferring ownership every frame
+    uint32_t sharedFamilies[2] = {vkContext.graphicsFamily, vkContext.presentFamily};
+    if (vkContext.presentFamily != vkContext.graphicsFamily) {
+        swapchainCreateInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+        swapchainCreateInfo.queueFamilyIndexCount = 2;
+        swapchainCreateInfo.pQueueFamilyIndices = sharedFamilies;
+    }
+    swapchainCreateInfo.preTransform = caps.currentTransform;
+    swapchainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    swapchainCreateInfo.presentMode = presentMode;
+    swapchainCreateInfo.clipped = VK_TRUE;
+    // Lets the driver hand over resources from the old swapchain and keeps
+    // already-queued presents of the old one valid
+    swapchainCreateInfo.oldSwapchain = oldSwapchain;
+    if (vkCreateSwapchainKHR(vkContext.device, &swapchainCreateInfo, NULL, &vkContext.swapchain) != VK_SUCCESS) {
+        return false;
+    }
+    vkContext.extent = extent;
+    vkContext.presentMode = presentMode;
 
     vkGetSwapchainImagesKHR(vkContext.device, vkContext.swapchain, &vkContext.swapchainImageCount, NULL);
     vkContext.swapchainImages = malloc(sizeof(VkImage) * vkContext.swapchainImageCount);
     vkGetSwapchainImagesKHR(vkContext.device, vkContext.swapchain, &vkContext.swapchainImageCount, vkContext.swapchainImages);
+    VkSemaphoreCreateInfo semaphoreInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    vkContext.renderFinishedSemaphores = malloc(sizeof(VkSemaphore) * vkContext.swapchainImageCount);
+    for (uint32_t i = 0; i < vkContext.swapchainImageCount; i++) {
+        vkCreateSemaphore(vkContext.device, &semaphoreInfo, NULL, &vkContext.renderFinishedSemaphores[i]);
+    }
+    SDL_Log("Swapchain %ux%u, %u images, %s", extent.width, extent.height,
+            vkContext.swapchainImageCount, presentModeName(presentMode));
+    return true;
+}
+
+// Rebuilds the swapchain without draining the device. The old swapchain,
+// views and framebuffers are parked until every frame that may still
+// reference them has been waited on; the render pass and pipeline do not
+// depend on the extent (viewport and scissor are dynamic) and are kept.
+static bool recreateSwapchain(void) {
+    if (vkContext.retiredCount == MAX_RETIRED_SWAPCHAINS) {
+        // Resizing faster than frames retire; drain once rather than grow without bound
+        vkDeviceWaitIdle(vkContext.device);
+        destroyRetiredSwapchains(true);
+    }
+
+    RetiredSwapchain retired = {0};
+    retired.swapchain = vkContext.swapchain;
+    retired.images = vkContext.swapchainImages;
+    retired.imageViews = vkContext.swapchainImageViews;
+    retired.framebuffers = vkContext.framebuffers;
+    retired.depthTargets = vkContext.depthTargets;
+    retired.renderFinished = vkContext.renderFinishedSemaphores;
+    retired.imageCount = vkContext.swapchainImageCount;
+    retired.retireFrame = frameCount;
+
+    if (!createSwapchain(retired.swapchain)) {
+        return false;
+    }
+    vkContext.retired[vkContext.retiredCount++] = retired;
+    vkContext.swapchainDirty = false;
+
+    createImageViews();
+    if (!createFramebuffers()) {
+        // The old swapchain is already retired, so there is nothing left to render with
+        vkContext.swapchainLost = true;
+        return false;
+    }
+    // The viewport and scissor in cached commands follow the extent
+    commandCacheInvalidate();
+
+    // The new images have never been acquired; the per-slot fence wait covers reuse
+    free(vkContext.imagesInFlight);
+    vkContext.imagesInFlight = calloc(vkContext.swapchainImageCount, sizeof(VkFence));
+    return true;
+}
+
+// Frame F waits on the fence of frame F - framesInFlight, so by the time
+// frameCount reaches retireFrame + framesInFlight every frame submitted
+// against the retired swapchain has completed
+static void destroyRetiredSwapchains(bool all) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < vkContext.retiredCount; i++) {
+        RetiredSwapchain* retired = &vkContext.retired[i];
+        if (!all && frameCount < retired->retireFrame + vkContext.framesInFlight) {
+            vkContext.retired[kept++] = *retired;
+            continue;
+        }
+        for (uint32_t j = 0; j < retired->imageCount; j++) {
+            vkDestroyFramebuffer(vkContext.device, retired->framebuffers[j], NULL);
+            vkDestroyImageView(vkContext.device, retired->imageViews[j], NULL);
+            vkDestroySemaphore(vkContext.device, retired->renderFinished[j], NULL);
+        }
+        destroyDepthTargets(retired->depthTargets, retired->imageCount);
+        free(retired->renderFinished);
+        free(retired->framebuffers);
+        free(retired->imageViews);
+        free(retired->images);
+        vkDestroySwapchainKHR(vkContext.device, retired->swapchain, NULL);
+    }
+    vkContext.retiredCount = kept;
+}
+
+// Switches to the next present mode the surface supports and rebuilds
+static void cyclePresentMode(void) {
+    uint32_t modeCount = 0;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(vkContext.physicalDevice, vkContext.surface, &modeCount, NULL);
+    VkPresentModeKHR* modes = malloc(sizeof(VkPresentModeKHR) * modeCount);
+    vkGetPhysicalDeviceSurfacePresentModesKHR(vkContext.physicalDevice, vkContext.surface, &modeCount, modes);
+
+    for (uint32_t i = 0; i < modeCount; i++) {
+        if (modes[i] == vkContext.presentMode) {
+            appConfig.presentMode = modes[(i + 1) % modeCount];
+            break;
+        }
+    }
+    free(modes);
+    vkContext.swapchainDirty = true;
+}
+
+// Latency is measured from the SDL event timestamp to the return of
+// vkQueuePresentKHR for the first frame recorded after the event. It does not
+// include scanout, but it does include the time the CPU spent blocked on a
+// full FIFO queue, which is where the present modes differ.
+static void recordLatency(Uint64 inputNs) {
+    if ((uint32_t)vkContext.presentMode >= PRESENT_MODE_COUNT) {
+        return;
+    }
+    histogramAdd(&latencyByMode[vkContext.presentMode], (double)(SDL_GetTicksNS() - inputNs) / 1e6);
+}
+
+static void logLatencyStats(void) {
+    for (uint32_t mode = 0; mode < PRESENT_MODE_COUNT; mode++) {
+        char name[64];
+        SDL_snprintf(name, sizeof(name), "Input-to-present latency (%s)", presentModeName((VkPresentModeKHR)mode));
+        histogramLog(name, &latencyByMode[mode]);
+    }
+    histogramLog("Present interval", &presentIntervals);
+    pacerLog(&pacer);
+}
+
+// Latency measurement mode (--latency-out): the histograms above plus the
+// pacing figures, for comparing targets and present modes offline
+static bool writeLatencyFile(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        SDL_Log("Cannot write %s", path);
+        return false;
+    }
+    fprintf(file, "{\n");
+    fprintf(file, "  \"targetFps\": %.2f,\n", appConfig.targetFps);
+    fprintf(file, "  \"pacedFrames\": %u,\n", pacer.frames);
+    fprintf(file, "  \"missedDeadlines\": %u,\n", pacer.missed);
+    fprintf(file, "  \"presentIntervalMs\": {\n");
+    histogramWriteJson(file, "all", &presentIntervals, true);
+    fprintf(file, "  },\n");
+    fprintf(file, "  \"inputToPresentMs\": {\n");
+    uint32_t remaining = 0;
+    for (uint32_t mode = 0; mode < PRESENT_MODE_COUNT; mode++) {
+        remaining += latencyByMode[mode].count > 0;
+    }
+    for (uint32_t mode = 0; mode < PRESENT_MODE_COUNT; mode++) {
+        if (latencyByMode[mode].count > 0) {
+            histogramWriteJson(file, presentModeName((VkPresentModeKHR)mode), &latencyByMode[mode], --remaining == 0);
+        }
+    }
+    fprintf(file, "  }\n");
+    fprintf(file, "}\n");
+    fclose(file);
+    SDL_Log("Latency histograms written to %s", path);
+    return true;
+}
+
+// Headless stand-in for the swapchain: one color target per frame slot, left
+// in TRANSFER_SRC layout by the render pass so the last frame can be read back
+static bool createOffscreenTargets(void) {
+    vkContext.extent = (VkExtent2D){WINDOW_WIDTH, WINDOW_HEIGHT};
+    vkContext.swapchainImageCount = vkContext.framesInFlight;
+    vkContext.swapchainImages = calloc(vkContext.swapchainImageCount, sizeof(VkImage));
+
+    for (uint32_t i = 0; i < vkContext.swapchainImageCount; i++) {
+        VkImageCreateInfo imageInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = VK_FORMAT_B8G8R8A8_UNORM;
+        imageInfo.extent = (VkExtent3D){vkContext.extent.width, vkContext.extent.height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        if (vkCreateImage(vkContext.device, &imageInfo, NULL, &vkContext.swapchainImages[i]) != VK_SUCCESS) {
+            return false;
+        }
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(vkContext.device, vkContext.swapchainImages[i], &memRequirements);
+        if (!gpuAlloc(&memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, GPU_RESOURCE_IMAGE,
+                      &vkContext.offscreenMemory[i])) {
+            return false;
+        }
+        vkBindImageMemory(vkContext.device, vkContext.swapchainImages[i],
+                          vkContext.offscreenMemory[i].block->memory, vkContext.offscreenMemory[i].offset);
+    }
+    return true;
+}
 
+static void createImageViews(void) {
     vkContext.swapchainImageViews = malloc(sizeof(VkImageView) * vkContext.swapchainImageCount);
     for (uint32_t i = 0; i < vkContext.swapchainImageCount; i++) {
         VkImageViewCreateInfo viewInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
@@ -248,16 +2480,6 @@ static bool initVulkan(SDL_Window* window) {
         viewInfo.subresourceRange.layerCount = 1;
         vkCreateImageView(vkContext.device, &viewInfo, NULL, &vkContext.swapchainImageViews[i]);
     }
-
-    createRenderPass();
-    createGraphicsPipeline();
-    createFramebuffers();
-    createCommandBuffers();
-    createSyncObjects();
-    createVertexBuffer();
-    createIndexBuffer();
-
-    return true;
 }
 
 static void createRenderPass(void) {
@@ -269,155 +2491,4272 @@ static void createRenderPass(void) {
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    colorAttachment.finalLayout = vkContext.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                                     : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    // Depth is cleared on load and never stored, so a tiler keeps it on chip
+    vkContext.depthFormat = chooseDepthFormat();
+    VkAttachmentDescription depthAttachment = {};
+    depthAttachment.format = vkContext.depthFormat;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    VkAttachmentDescription attachments[2] = {colorAttachment, depthAttachment};
 
     VkAttachmentReference colorAttachmentRef = {};
     colorAttachmentRef.attachment = 0;
     colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    VkAttachmentReference depthAttachmentRef = {};
+    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    // With the pre-pass, subpass 0 only writes depth and subpass 1 shades
+    // the fragments whose depth matches it exactly
+    VkSubpassDescription subpasses[2] = {{}, {}};
+    uint32_t subpassCount = 0;
+    if (appConfig.depthPrepass) {
+        VkSubpassDescription* prepass = &subpasses[subpassCount++];
+        prepass->pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        prepass->pDepthStencilAttachment = &depthAttachmentRef;
+    }
+    VkSubpassDescription* shading = &subpasses[subpassCount++];
+    shading->pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    shading->colorAttachmentCount = 1;
+    shading->pColorAttachments = &colorAttachmentRef;
+    shading->pDepthStencilAttachment = &depthAttachmentRef;
 
-    VkSubpassDescription subpass = {};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colorAttachmentRef;
+    VkSubpassDependency dependency = {0};
+    dependency.srcSubpass = 0;
+    dependency.dstSubpass = 1;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
     VkRenderPassCreateInfo renderPassInfo = {VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO};
-    renderPassInfo.attachmentCount = 1;
-    renderPassInfo.pAttachments = &colorAttachment;
-    renderPassInfo.subpassCount = 1;
-    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.attachmentCount = 2;
+    renderPassInfo.pAttachments = attachments;
+    renderPassInfo.subpassCount = subpassCount;
+    renderPassInfo.pSubpasses = subpasses;
+    if (appConfig.depthPrepass) {
+        renderPassInfo.dependencyCount = 1;
+        renderPassInfo.pDependencies = &dependency;
+    }
 
     vkCreateRenderPass(vkContext.device, &renderPassInfo, NULL, &vkContext.renderPass);
 }
 
-static void createGraphicsPipeline(void) {
-    // Simple vertex shader
-    const char* vertShaderCode = 
-        "#version 450\n"
-        "layout(location = 0) in vec3 inPosition;\n"
-        "layout(location = 1) in vec3 inColor;\n"
-        "layout(location = 0) out vec3 fragColor;\n"
-        "void main() {\n"
-        "    gl_Position = vec4(inPosition, 1.0);\n"
-        "    fragColor = inColor;\n"
-        "}\n";
-
-    // Simple fragment shader
-    const char* fragShaderCode = 
-        "#version 450\n"
-        "layout(location = 0) in vec3 fragColor;\n"
-        "layout(location = 0) out vec4 outColor;\n"
-        "void main() {\n"
-        "    outColor = vec4(fragColor, 1.0);\n"
-        "}\n";
-
-    // Note: In a real application, you'd want to compile these shaders to SPIR-V
-    // This is a simplified example assuming you have a way to convert GLSL to SPIR-V
-}
-
-static void createFramebuffers(void) {
-    vkContext.framebuffers = malloc(sizeof(VkFramebuffer) * vkContext.swapchainImageCount);
-    for (uint32_t i = 0; i < vkContext.swapchainImageCount; i++) {
-        VkFramebufferCreateInfo framebufferInfo = {VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
-        framebufferInfo.renderPass = vkContext.renderPass;
-        framebufferInfo.attachmentCount = 1;
-        framebufferInfo.pAttachments = &vkContext.swapchainImageViews[i];
-        framebufferInfo.width = WINDOW_WIDTH;
-        framebufferInfo.height = WINDOW_HEIGHT;
-        framebufferInfo.layers = 1;
-        vkCreateFramebuffer(vkContext.device, &framebufferInfo, NULL, &vkContext.framebuffers[i]);
+static VkFormat chooseDepthFormat(void) {
+    const VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM};
+    for (uint32_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(vkContext.physicalDevice, candidates[i], &props);
+        if (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+            return candidates[i];
+        }
     }
+    // D16_UNORM depth attachments are mandatory
+    return VK_FORMAT_D16_UNORM;
 }
 
-static void createCommandBuffers(void) {
-    VkCommandPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
-    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    vkCreateCommandPool(vkContext.device, &poolInfo, NULL, &vkContext.commandPool);
+static DepthTarget* createDepthTargets(uint32_t count) {
+    DepthTarget* targets = calloc(count, sizeof(DepthTarget));
+    for (uint32_t i = 0; i < count; i++) {
+        VkImageCreateInfo imageInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = vkContext.depthFormat;
+        imageInfo.extent = (VkExtent3D){vkContext.extent.width, vkContext.extent.height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        if (vkCreateImage(vkContext.device, &imageInfo, NULL, &targets[i].image) != VK_SUCCESS) {
+            SDL_Log("Failed to create depth image");
+            destroyDepthTargets(targets, count);
+            return NULL;
+        }
 
-    VkCommandBufferAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
-    allocInfo.commandPool = vkContext.commandPool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = 1;
-    vkAllocateCommandBuffers(vkContext.device, &allocInfo, &vkContext.commandBuffer);
-}
+        // Desktop GPUs have no lazily allocated type and fall back to plain device memory
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(vkContext.device, targets[i].image, &memRequirements);
+        if (!gpuAlloc(&memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+                      GPU_RESOURCE_IMAGE, &targets[i].memory)) {
+            SDL_Log("Out of GPU memory for depth targets");
+            destroyDepthTargets(targets, count);
+            return NULL;
+        }
+        vkBindImageMemory(vkContext.device, targets[i].image, targets[i].memory.block->memory, targets[i].memory.offset);
+        uint32_t typeIndex = targets[i].memory.block->memoryTypeIndex;
+        vkContext.depthLazy = (gpuAllocator.memoryProperties.memoryTypes[typeIndex].propertyFlags &
+                               VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
 
-static void createSyncObjects(void) {
-    VkSemaphoreCreateInfo semaphoreInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
-    vkCreateSemaphore(vkContext.device, &semaphoreInfo, NULL, &vkContext.imageAvailableSemaphore);
-    vkCreateSemaphore(vkContext.device, &semaphoreInfo, NULL, &vkContext.renderFinishedSemaphore);
+        VkImageViewCreateInfo viewInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+        viewInfo.image = targets[i].image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = vkContext.depthFormat;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.layerCount = 1;
+        if (vkCreateImageView(vkContext.device, &viewInfo, NULL, &targets[i].view) != VK_SUCCESS) {
+            SDL_Log("Failed to create depth image view");
+            destroyDepthTargets(targets, count);
+            return NULL;
+        }
+    }
+    return targets;
+}
 
-    VkFenceCreateInfo fenceInfo = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
-    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-    vkCreateFence(vkContext.device, &fenceInfo, NULL, &vkContext.inFlightFence);
+// Also takes a partly created set; the handles that were never created are null
+static void destroyDepthTargets(DepthTarget* targets, uint32_t count) {
+    for (uint32_t i = 0; i < count && targets; i++) {
+        vkDestroyImageView(vkContext.device, targets[i].view, NULL);
+        vkDestroyImage(vkContext.device, targets[i].image, NULL);
+        gpuFree(&targets[i].memory);
+    }
+    free(targets);
 }
 
-static void createVertexBuffer(void) {
-    // Simplified - in real code, you'd need to create staging buffer and copy to device-local memory
-    VkBufferCreateInfo bufferInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
-    bufferInfo.size = sizeof(vertices);
-    bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    vkCreateBuffer(vkContext.device, &bufferInfo, NULL, &vkContext.vertexBuffer);
+static VkShaderModule createShaderModule(const uint32_t* code, size_t size) {
+    VkShaderModuleCreateInfo createInfo = {VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO};
+    createInfo.codeSize = size;
+    createInfo.pCode = code;
 
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(vkContext.device, vkContext.vertexBuffer, &memRequirements);
-    
-    VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = 0; // Should find suitable memory type in real code
-    vkAllocateMemory(vkContext.device, &allocInfo, NULL, &vkContext.vertexBufferMemory);
+    VkShaderModule module = VK_NULL_HANDLE;
+    vkCreateShaderModule(vkContext.device, &createInfo, NULL, &module);
+    return module;
+}
 
-    vkBindBufferMemory(vkContext.device, vkContext.vertexBuffer, vkContext.vertexBufferMemory, 0);
+// Set 0 is the object's slice of the uniform ring, selected per draw by its
+// dynamic offset; the camera is pushed once per command buffer. Created with
+// the device because the uniform ring allocates its sets from this layout.
+static void createPipelineLayout(void) {
+    VkDescriptorSetLayoutBinding objectBinding = {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1,
+                                                  VK_SHADER_STAGE_VERTEX_BIT, NULL};
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    setLayoutInfo.bindingCount = 1;
+    setLayoutInfo.pBindings = &objectBinding;
+    vkCreateDescriptorSetLayout(vkContext.device, &setLayoutInfo, NULL, &frameUniforms.setLayout);
 
-    void* data;
-    vkMapMemory(vkContext.device, vkContext.vertexBufferMemory, 0, sizeof(vertices), 0, &data);
-    memcpy(data, vertices, sizeof(vertices));
-    vkUnmapMemory(vkContext.device, vkContext.vertexBufferMemory);
+    VkPushConstantRange pushRange = {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(CameraConstants)};
+    VkPipelineLayoutCreateInfo layoutInfo = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &frameUniforms.setLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+    vkCreatePipelineLayout(vkContext.device, &layoutInfo, NULL, &vkContext.pipelineLayout);
 }
 
-static void createIndexBuffer(void) {
-    VkBufferCreateInfo bufferInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
-    bufferInfo.size = sizeof(indices);
-    bufferInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    vkCreateBuffer(vkContext.device, &bufferInfo, NULL, &vkContext.indexBuffer);
+static void createGraphicsPipeline(void) {
+    Uint64 start = SDL_GetPerformanceCounter();
 
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(vkContext.device, vkContext.indexBuffer, &memRequirements);
-    
-    VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = 0; // Should find suitable memory type in real code
-    vkAllocateMemory(vkContext.device, &allocInfo, NULL, &vkContext.indexBufferMemory);
+    VkShaderModule vertModule = createShaderModule(roomVertSpv, sizeof(roomVertSpv));
+    VkShaderModule fragModule = createShaderModule(roomFragSpv, sizeof(roomFragSpv));
 
-    vkBindBufferMemory(vkContext.device, vkContext.indexBuffer, vkContext.indexBufferMemory, 0);
+    VkPipelineShaderStageCreateInfo stages[2] = {
+        {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO},
+        {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO},
+    };
+    stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stages[0].module = vertModule;
+    stages[0].pName = "main";
+    stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[1].module = fragModule;
+    stages[1].pName = "main";
 
-    void* data;
-    vkMapMemory(vkContext.device, vkContext.indexBufferMemory, 0, sizeof(indices), 0, &data);
-    memcpy(data, indices, sizeof(indices));
-    vkUnmapMemory(vkContext.device, vkContext.indexBufferMemory);
-}
+    // Binding 1 carries one offset/scale per instance: the culled survivors on
+    // the GPU-driven path, a single identity instance otherwise
+    VkVertexInputBindingDescription bindings[2] = {
+        {0, sizeof(PackedVertex), VK_VERTEX_INPUT_RATE_VERTEX},
+        {1, sizeof(float) * 4, VK_VERTEX_INPUT_RATE_INSTANCE},
+    };
+    VkVertexInputAttributeDescription attributes[3] = {
+        {0, 0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(PackedVertex, pos)},
+        {1, 0, VK_FORMAT_R8G8B8A8_UNORM, offsetof(PackedVertex, color)},
+        {2, 1, VK_FORMAT_R32G32B32A32_SFLOAT, 0},
+    };
+    VkPipelineVertexInputStateCreateInfo vertexInput = {VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
+    vertexInput.vertexBindingDescriptionCount = 2;
+    vertexInput.pVertexBindingDescriptions = bindings;
+    vertexInput.vertexAttributeDescriptionCount = 3;
+    vertexInput.pVertexAttributeDescriptions = attributes;
 
-static void cleanupVulkan(void) {
-    vkDestroyBuffer(vkContext.device, vkContext.indexBuffer, NULL);
-    vkFreeMemory(vkContext.device, vkContext.indexBufferMemory, NULL);
-    vkDestroyBuffer(vkContext.device, vkContext.vertexBuffer, NULL);
-    vkFreeMemory(vkContext.device, vkContext.vertexBufferMemory, NULL);
-    vkDestroyFence(vkContext.device, vkContext.inFlightFence, NULL);
-    vkDestroySemaphore(vkContext.device, vkContext.renderFinishedSemaphore, NULL);
-    vkDestroySemaphore(vkContext.device, vkContext.imageAvailableSemaphore, NULL);
-    vkDestroyCommandPool(vkContext.device, vkContext.commandPool, NULL);
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly = {VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO};
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    // Viewport and scissor are set per frame so a resize never rebuilds the pipeline
+    VkPipelineViewportStateCreateInfo viewportState = {VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO};
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+    VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo dynamicState = {VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO};
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer = {VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO};
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.cullMode = VK_CULL_MODE_NONE;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizer.lineWidth = 1.0f;
+
+    VkPipelineMultisampleStateCreateInfo multisampling = {VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO};
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    // The pre-pass already holds the nearest depth, so the shading pass only
+    // tests for equality and does not write it again
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = appConfig.depthPrepass ? VK_FALSE : VK_TRUE;
+    depthStencil.depthCompareOp = appConfig.depthPrepass ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS;
+
+    VkPipelineColorBlendAttachmentState blendAttachment = {0};
+    blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                     VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    VkPipelineColorBlendStateCreateInfo colorBlending = {VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &blendAttachment;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = {VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO};
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = stages;
+    pipelineInfo.pVertexInputState = &vertexInput;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = vkContext.pipelineLayout;
+    pipelineInfo.renderPass = vkContext.renderPass;
+    pipelineInfo.subpass = appConfig.depthPrepass ? 1 : 0;
+
+    if (vkCreateGraphicsPipelines(vkContext.device, vkContext.pipelineCache, 1, &pipelineInfo, NULL,
+                                  &vkContext.graphicsPipeline) != VK_SUCCESS) {
+        SDL_Log("Failed to create graphics pipeline");
+    }
+
+    // Pre-pass: same vertex stage (gl_Position is invariant), no fragment
+    // shader and no color attachment
+    if (appConfig.depthPrepass) {
+        VkPipelineDepthStencilStateCreateInfo prepassDepth = depthStencil;
+        prepassDepth.depthWriteEnable = VK_TRUE;
+        prepassDepth.depthCompareOp = VK_COMPARE_OP_LESS;
+        VkPipelineColorBlendStateCreateInfo noColor = {VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
+        pipelineInfo.stageCount = 1;
+        pipelineInfo.pDepthStencilState = &prepassDepth;
+        pipelineInfo.pColorBlendState = &noColor;
+        pipelineInfo.subpass = 0;
+        if (vkCreateGraphicsPipelines(vkContext.device, vkContext.pipelineCache, 1, &pipelineInfo, NULL,
+                                      &vkContext.depthPipeline) != VK_SUCCESS) {
+            SDL_Log("Failed to create depth pre-pass pipeline");
+        }
+    }
+
+    // Modules are only needed while the pipeline is being compiled
+    vkDestroyShaderModule(vkContext.device, fragModule, NULL);
+    vkDestroyShaderModule(vkContext.device, vertModule, NULL);
+
+    pipelineCreateMs = ticksToMs(SDL_GetPerformanceCounter() - start);
+    SDL_Log("Graphics pipeline created in %.2f ms", pipelineCreateMs);
+}
+
+static double ticksToMs(Uint64 ticks) {
+    return (double)ticks * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static uint32_t fnv1a(const uint8_t* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static const char* pipelineCachePath(void) {
+    const char* path = SDL_getenv("VKROOM_PIPELINE_CACHE");
+    return path ? path : PIPELINE_CACHE_FILE;
+}
+
+// Seeds vkContext.pipelineCache from disk. Any mismatch (other GPU, driver
+// update, truncated or corrupted file) silently falls back to an empty cache.
+static void loadPipelineCache(void) {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(vkContext.physicalDevice, &props);
+
+    void* data = NULL;
+    size_t dataSize = 0;
+    FILE* file = fopen(pipelineCachePath(), "rb");
+    if (file) {
+        PipelineCacheFileHeader header;
+        if (fread(&header, sizeof(header), 1, file) == 1 &&
+            header.magic == PIPELINE_CACHE_MAGIC &&
+            header.version == PIPELINE_CACHE_VERSION &&
+            header.vendorID == props.vendorID &&
+            header.deviceID == props.deviceID &&
+            header.driverVersion == props.driverVersion &&
+            memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE) == 0 &&
+            header.dataSize >= sizeof(VkPipelineCacheHeaderVersionOne)) {
+            data = malloc(header.dataSize);
+            if (fread(data, header.dataSize, 1, file) == 1 && fnv1a(data, header.dataSize) == header.checksum) {
+                dataSize = header.dataSize;
+            } else {
+                free(data);
+                data = NULL;
+            }
+        }
+        fclose(file);
+
+        if (!data) {
+            SDL_Log("Pipeline cache %s is stale or invalid, starting cold", pipelineCachePath());
+        }
+    }
+
+    VkPipelineCacheCreateInfo cacheInfo = {VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+    cacheInfo.initialDataSize = dataSize;
+    cacheInfo.pInitialData = data;
+    if (vkCreatePipelineCache(vkContext.device, &cacheInfo, NULL, &vkContext.pipelineCache) != VK_SUCCESS) {
+        // The driver may still reject data that passed our checks
+        cacheInfo.initialDataSize = 0;
+        cacheInfo.pInitialData = NULL;
+        dataSize = 0;
+        vkCreatePipelineCache(vkContext.device, &cacheInfo, NULL, &vkContext.pipelineCache);
+    }
+    vkContext.pipelineCacheWarm = dataSize > 0;
+    free(data);
+}
+
+// Writes to a temporary file first so an interrupted write never leaves a
+// truncated cache behind
+static void savePipelineCache(void) {
+    if (!vkContext.pipelineCache) {
+        return;
+    }
+
+    size_t dataSize = 0;
+    if (vkGetPipelineCacheData(vkContext.device, vkContext.pipelineCache, &dataSize, NULL) != VK_SUCCESS || dataSize == 0) {
+        return;
+    }
+    void* data = malloc(dataSize);
+    if (vkGetPipelineCacheData(vkContext.device, vkContext.pipelineCache, &dataSize, data) != VK_SUCCESS) {
+        free(data);
+        return;
+    }
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(vkContext.physicalDevice, &props);
+
+    PipelineCacheFileHeader header = {0};
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.version = PIPELINE_CACHE_VERSION;
+    header.vendorID = props.vendorID;
+    header.deviceID = props.deviceID;
+    header.driverVersion = props.driverVersion;
+    memcpy(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE);
+    header.checksum = fnv1a(data, dataSize);
+    header.dataSize = dataSize;
+
+    char tempPath[1024];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", pipelineCachePath());
+    FILE* file = fopen(tempPath, "wb");
+    if (file) {
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data, dataSize, 1, file) == 1;
+        ok = fclose(file) == 0 && ok;
+        remove(pipelineCachePath());
+        if (ok && rename(tempPath, pipelineCachePath()) == 0) {
+            SDL_Log("Saved %zu byte pipeline cache to %s", dataSize, pipelineCachePath());
+        } else {
+            remove(tempPath);
+        }
+    }
+    free(data);
+}
+
+// Each framebuffer gets its own depth target, since frames rendering to
+// different images may overlap on the GPU
+static bool createFramebuffers(void) {
+    // Zeroed, so cleanup can destroy the array even when the depth targets failed
+    vkContext.framebuffers = calloc(vkContext.swapchainImageCount, sizeof(VkFramebuffer));
+    vkContext.depthTargets = createDepthTargets(vkContext.swapchainImageCount);
+    if (!vkContext.depthTargets) {
+        return false;
+    }
+    for (uint32_t i = 0; i < vkContext.swapchainImageCount; i++) {
+        VkImageView attachments[2] = {vkContext.swapchainImageViews[i], vkContext.depthTargets[i].view};
+        VkFramebufferCreateInfo framebufferInfo = {VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO};
+        framebufferInfo.renderPass = vkContext.renderPass;
+        framebufferInfo.attachmentCount = 2;
+        framebufferInfo.pAttachments = attachments;
+        framebufferInfo.width = vkContext.extent.width;
+        framebufferInfo.height = vkContext.extent.height;
+        framebufferInfo.layers = 1;
+        vkCreateFramebuffer(vkContext.device, &framebufferInfo, NULL, &vkContext.framebuffers[i]);
+    }
+    return true;
+}
+
+static void createCommandBuffers(void) {
+    VkCommandPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = vkContext.graphicsFamily;
+    vkCreateCommandPool(vkContext.device, &poolInfo, NULL, &vkContext.commandPool);
+
+    VkCommandBuffer commandBuffers[MAX_FRAMES_IN_FLIGHT];
+    VkCommandBufferAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    allocInfo.commandPool = vkContext.commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = vkContext.framesInFlight;
+    vkAllocateCommandBuffers(vkContext.device, &allocInfo, commandBuffers);
+
+    for (uint32_t i = 0; i < vkContext.framesInFlight; i++) {
+        vkContext.frames[i].commandBuffer = commandBuffers[i];
+    }
+
+    // One pool per worker per frame slot: pools are externally synchronized,
+    // and a whole slot's worth of secondaries is recycled with one reset
+    VkCommandPoolCreateInfo recordPoolInfo = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    recordPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    recordPoolInfo.queueFamilyIndex = vkContext.graphicsFamily;
+    for (uint32_t i = 0; i < vkContext.framesInFlight; i++) {
+        for (uint32_t worker = 0; worker < jobs.workerCount; worker++) {
+            vkCreateCommandPool(vkContext.device, &recordPoolInfo, NULL,
+                                &vkContext.frames[i].recordPools[worker].pool);
+        }
+    }
+}
+
+static void createSyncObjects(void) {
+    VkSemaphoreCreateInfo semaphoreInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    VkFenceCreateInfo fenceInfo = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    for (uint32_t i = 0; i < vkContext.framesInFlight; i++) {
+        FrameData* frame = &vkContext.frames[i];
+        vkCreateSemaphore(vkContext.device, &semaphoreInfo, NULL, &frame->imageAvailableSemaphore);
+        vkCreateFence(vkContext.device, &fenceInfo, NULL, &frame->inFlightFence);
+    }
+
+    // No swapchain image is owned by a frame slot until it is first acquired
+    vkContext.imagesInFlight = calloc(vkContext.swapchainImageCount, sizeof(VkFence));
+}
+
+// Frames in flight come from --frames-in-flight N or VKROOM_FRAMES_IN_FLIGHT,
+// clamped to [1, MAX_FRAMES_IN_FLIGHT]. One slot reproduces the old fully
+// serialized behaviour, which is useful for A/B throughput measurements.
+//
+// Benchmark options:
+//   --headless             render offscreen without a window (implies --bench)
+//   --bench                collect frame timings and write them as JSON
+//   --frames N             number of measured frames (default 1000)
+//   --rooms N              replicate the room N times on a grid (e.g. 1, 100, 10000)
+//   --bench-out FILE       JSON output path (default bench_results.json)
+//   --checksum             hash the final frame (headless only)
+//   --expect-checksum HEX  fail the run if the final frame hash differs
+//
+// Profiling options:
+//   --trace FILE           stream CPU and GPU scopes as Chrome trace JSON (chrome://tracing, Perfetto)
+//   --profile-draws        add a GPU timestamp pair around each draw
+//
+// Presentation options:
+//   --present-mode MODE    fifo (default), fifo-relaxed, mailbox or immediate; P cycles at runtime
+//   --swapchain-images N   requested image count, clamped to the surface limits
+//   --target-fps N         pace frames to N per second, sampling input as late as possible
+//   --latency-out FILE     write input-to-present and present interval histograms as JSON
+//
+// Recording options:
+//   --record-threads N     threads recording draws into secondary command buffers,
+//                          including the main thread (default: CPU count, 1 records inline)
+//   --gpu-driven           draw the rooms as instances culled on the GPU with indirect draws
+//   --depth-prepass        draw depth only first, then shade with an EQUAL depth test
+//   --cache-commands       record the per-draw commands once per frame slot and replay them
+//                          until the viewport, camera, uniforms or LOD levels change
+//
+// Scene options:
+//   --scene FILE           stream a binary scene file in the background instead of
+//                          generating the grid (--rooms and --gpu-driven come from the file)
+//   --convert-scene FILE   write the generated scene (per --rooms, --gpu-driven) to FILE and exit
+//   --room-detail N        tessellate each room face into N x N quads (default 1, at most 128)
+//   --no-lod               always draw level 0 of every mesh
+//   --static-scene         freeze the camera and the object animation
+//
+// Overlay options:
+//   --overlay              draw a menu and frame stats over the scene; Escape shows and hides it
+//   --font FILE            TrueType font for the overlay (default arial.ttf)
+static void parseCommandLine(int argc, char* argv[]) {
+    int framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    appConfig.benchFrames = DEFAULT_BENCH_FRAMES;
+    appConfig.rooms = 1;
+    appConfig.benchOutput = DEFAULT_BENCH_OUTPUT;
+    appConfig.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    appConfig.roomDetail = 1;
+    appConfig.lod = true;
+    appConfig.fontPath = UI_DEFAULT_FONT;
+    int recordThreads = SDL_GetCPUCount();
+
+    const char* env = SDL_getenv("VKROOM_FRAMES_IN_FLIGHT");
+    if (env) {
+        framesInFlight = atoi(env);
+    }
+    for (int i = 1; i < argc; i++) {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--frames-in-flight") == 0 && value) {
+            framesInFlight = atoi(value);
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            appConfig.headless = true;
+            appConfig.bench = true;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            appConfig.bench = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && value) {
+            appConfig.benchFrames = (uint32_t)atoi(value);
+        } else if (strcmp(argv[i], "--rooms") == 0 && value) {
+            appConfig.rooms = (uint32_t)atoi(value);
+        } else if (strcmp(argv[i], "--bench-out") == 0 && value) {
+            appConfig.benchOutput = value;
+        } else if (strcmp(argv[i], "--checksum") == 0) {
+            appConfig.checksum = true;
+        } else if (strcmp(argv[i], "--expect-checksum") == 0 && value) {
+            appConfig.checksum = true;
+            appConfig.expectChecksum = value;
+        } else if (strcmp(argv[i], "--trace") == 0 && value) {
+            appConfig.traceOutput = value;
+        } else if (strcmp(argv[i], "--profile-draws") == 0) {
+            appConfig.profileDraws = true;
+        } else if (strcmp(argv[i], "--present-mode") == 0 && value) {
+            for (uint32_t mode = 0; mode < PRESENT_MODE_COUNT; mode++) {
+                if (strcmp(value, presentModeName((VkPresentModeKHR)mode)) == 0) {
+                    appConfig.presentMode = (VkPresentModeKHR)mode;
+                }
+            }
+        } else if (strcmp(argv[i], "--swapchain-images") == 0 && value) {
+            appConfig.swapchainImages = (uint32_t)atoi(value);
+        } else if (strcmp(argv[i], "--target-fps") == 0 && value) {
+            appConfig.targetFps = SDL_atof(value);
+        } else if (strcmp(argv[i], "--latency-out") == 0 && value) {
+            appConfig.latencyOutput = value;
+        } else if (strcmp(argv[i], "--record-threads") == 0 && value) {
+            recordThreads = atoi(value);
+        } else if (strcmp(argv[i], "--gpu-driven") == 0) {
+            appConfig.gpuDriven = true;
+        } else if (strcmp(argv[i], "--depth-prepass") == 0) {
+            appConfig.depthPrepass = true;
+        } else if (strcmp(argv[i], "--scene") == 0 && value) {
+            appConfig.sceneFile = value;
+        } else if (strcmp(argv[i], "--convert-scene") == 0 && value) {
+            appConfig.convertScene = value;
+        } else if (strcmp(argv[i], "--room-detail") == 0 && value) {
+            appConfig.roomDetail = (uint32_t)atoi(value);
+        } else if (strcmp(argv[i], "--no-lod") == 0) {
+            appConfig.lod = false;
+        } else if (strcmp(argv[i], "--static-scene") == 0) {
+            appConfig.staticScene = true;
+        } else if (strcmp(argv[i], "--cache-commands") == 0) {
+            appConfig.cacheCommands = true;
+        } else if (strcmp(argv[i], "--overlay") == 0) {
+            appConfig.overlay = true;
+        } else if (strcmp(argv[i], "--font") == 0 && value) {
+            appConfig.fontPath = value;
+        }
+    }
+
+    if (framesInFlight < 1) {
+        framesInFlight = 1;
+    } else if (framesInFlight > MAX_FRAMES_IN_FLIGHT) {
+        framesInFlight = MAX_FRAMES_IN_FLIGHT;
+    }
+    appConfig.framesInFlight = (uint32_t)framesInFlight;
+    appConfig.recordThreads = (uint32_t)SDL_clamp(recordThreads, 1, MAX_JOB_THREADS);
+
+    if (appConfig.rooms < 1) {
+        appConfig.rooms = 1;
+    }
+    appConfig.roomDetail = SDL_clamp(appConfig.roomDetail, 1u, (uint32_t)MAX_ROOM_DETAIL);
+    if (appConfig.benchFrames < 1) {
+        appConfig.benchFrames = 1;
+    }
+    if (appConfig.checksum && !appConfig.headless) {
+        SDL_Log("--checksum needs --headless, ignoring");
+        appConfig.checksum = false;
+    }
+}
+
+static int16_t quantizeSnorm16(float value) {
+    return (int16_t)lrintf(SDL_clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+static uint8_t quantizeUnorm8(float value) {
+    return (uint8_t)lrintf(SDL_clamp(value, 0.0f, 1.0f) * 255.0f);
+}
+
+static PackedVertex packVertex(const float pos[3], const float color[3]) {
+    PackedVertex packed;
+    for (int i = 0; i < 3; i++) {
+        packed.pos[i] = quantizeSnorm16(pos[i]);
+        packed.color[i] = quantizeUnorm8(color[i]);
+    }
+    packed.pos[3] = 0;
+    packed.color[3] = 255;
+    return packed;
+}
+
+static uint32_t indexTypeSize(VkIndexType type) {
+    return type == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+// Score of a vertex in Forsyth's linear-speed vertex cache optimizer: vertices
+// of the last triangle and those near the front of the cache score high, and
+// vertices with few triangles left get a boost so they are finished off early.
+static float vcacheScore(int32_t cachePosition, uint32_t remaining) {
+    if (remaining == 0) {
+        return -1.0f;
+    }
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            score = 0.75f;
+        } else {
+            float scale = 1.0f / (float)(VCACHE_SCORE_SIZE - 3);
+            score = powf(1.0f - (float)(cachePosition - 3) * scale, 1.5f);
+        }
+    }
+    return score + 2.0f / sqrtf((float)remaining);
+}
+
+// Reorders triangles so consecutive ones share vertices still in the
+// post-transform cache
+static void optimizeVertexCache(uint32_t* indices, uint32_t indexCount, uint32_t vertexCount) {
+    uint32_t triangleCount = indexCount / 3;
+    uint32_t* remaining = calloc(vertexCount, sizeof(uint32_t));
+    uint32_t* adjacencyOffset = calloc(vertexCount + 1, sizeof(uint32_t));
+    uint32_t* adjacency = malloc(sizeof(uint32_t) * indexCount);
+    int32_t* cachePosition = malloc(sizeof(int32_t) * vertexCount);
+    float* vertexScore = malloc(sizeof(float) * vertexCount);
+    float* triangleScore = malloc(sizeof(float) * triangleCount);
+    bool* emitted = calloc(triangleCount, sizeof(bool));
+    uint32_t* output = malloc(sizeof(uint32_t) * indexCount);
+
+    // Live triangles of vertex v are adjacency[adjacencyOffset[v] .. + remaining[v]]
+    for (uint32_t i = 0; i < indexCount; i++) {
+        remaining[indices[i]]++;
+    }
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        adjacencyOffset[v + 1] = adjacencyOffset[v] + remaining[v];
+        remaining[v] = 0;
+    }
+    for (uint32_t i = 0; i < indexCount; i++) {
+        uint32_t v = indices[i];
+        adjacency[adjacencyOffset[v] + remaining[v]++] = i / 3;
+    }
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        cachePosition[v] = -1;
+        vertexScore[v] = vcacheScore(-1, remaining[v]);
+    }
+    uint32_t best = 0;
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        const uint32_t* tri = &indices[t * 3];
+        triangleScore[t] = vertexScore[tri[0]] + vertexScore[tri[1]] + vertexScore[tri[2]];
+        if (triangleScore[t] > triangleScore[best]) {
+            best = t;
+        }
+    }
+
+    uint32_t cache[VCACHE_SCORE_SIZE + 3];
+    uint32_t cacheCount = 0;
+    uint32_t scanCursor = 0;
+    for (uint32_t out = 0; out < triangleCount; out++) {
+        if (best == UINT32_MAX) {
+            // Nothing in the cache touches a live triangle; restart from input order
+            while (emitted[scanCursor]) {
+                scanCursor++;
+            }
+            best = scanCursor;
+        }
+        const uint32_t* tri = &indices[best * 3];
+        memcpy(&output[out * 3], tri, sizeof(uint32_t) * 3);
+        emitted[best] = true;
+
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = tri[k];
+            uint32_t* live = &adjacency[adjacencyOffset[v]];
+            for (uint32_t i = 0; i < remaining[v]; i++) {
+                if (live[i] == best) {
+                    live[i] = live[--remaining[v]];
+                    break;
+                }
+            }
+        }
+
+        // The triangle's vertices move to the front, the rest shift back
+        uint32_t newCache[VCACHE_SCORE_SIZE + 3];
+        uint32_t newCount = 0;
+        for (int k = 0; k < 3; k++) {
+            bool duplicate = (newCount > 0 && newCache[0] == tri[k]) || (newCount > 1 && newCache[1] == tri[k]);
+            if (!duplicate) {
+                newCache[newCount++] = tri[k];
+            }
+        }
+        for (uint32_t i = 0; i < cacheCount; i++) {
+            uint32_t v = cache[i];
+            if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                newCache[newCount++] = v;
+            }
+        }
+        for (uint32_t i = 0; i < newCount; i++) {
+            uint32_t v = newCache[i];
+            cachePosition[v] = i < VCACHE_SCORE_SIZE ? (int32_t)i : -1;
+            vertexScore[v] = vcacheScore(cachePosition[v], remaining[v]);
+        }
+
+        best = UINT32_MAX;
+        float bestScore = -1.0f;
+        for (uint32_t i = 0; i < newCount; i++) {
+            uint32_t v = newCache[i];
+            const uint32_t* live = &adjacency[adjacencyOffset[v]];
+            for (uint32_t j = 0; j < remaining[v]; j++) {
+                uint32_t t = live[j];
+                const uint32_t* other = &indices[t * 3];
+                triangleScore[t] = vertexScore[other[0]] + vertexScore[other[1]] + vertexScore[other[2]];
+                if (triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+        cacheCount = SDL_min(newCount, VCACHE_SCORE_SIZE);
+        memcpy(cache, newCache, sizeof(uint32_t) * cacheCount);
+    }
+    memcpy(indices, output, sizeof(uint32_t) * triangleCount * 3);
+
+    free(output);
+    free(emitted);
+    free(triangleScore);
+    free(vertexScore);
+    free(cachePosition);
+    free(adjacency);
+    free(adjacencyOffset);
+    free(remaining);
+}
+
+// Renumbers vertices in first-use order so fetches walk the buffer linearly.
+// Unreferenced vertices are dropped; returns the new vertex count.
+static uint32_t optimizeVertexFetch(Vertex* vertices, uint32_t vertexCount, uint32_t* indices, uint32_t indexCount) {
+    uint32_t* remap = malloc(sizeof(uint32_t) * vertexCount);
+    Vertex* reordered = malloc(sizeof(Vertex) * vertexCount);
+    memset(remap, 0xFF, sizeof(uint32_t) * vertexCount);
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < indexCount; i++) {
+        uint32_t v = indices[i];
+        if (remap[v] == UINT32_MAX) {
+            remap[v] = next;
+            reordered[next++] = vertices[v];
+        }
+        indices[i] = remap[v];
+    }
+    memcpy(vertices, reordered, sizeof(Vertex) * next);
+    free(reordered);
+    free(remap);
+    return next;
+}
+
+// Average cache miss ratio: transformed vertices per triangle with a FIFO
+// cache of VCACHE_REPORT_SIZE entries. 0.5 is ideal for large grids, 3 is worst.
+static float meshAcmr(const uint32_t* indices, uint32_t indexCount, uint32_t vertexCount) {
+    uint32_t* insertedAt = calloc(vertexCount, sizeof(uint32_t));
+    uint32_t clock = VCACHE_REPORT_SIZE + 1;
+    uint32_t misses = 0;
+    for (uint32_t i = 0; i < indexCount; i++) {
+        uint32_t v = indices[i];
+        if (clock - insertedAt[v] > VCACHE_REPORT_SIZE) {
+            insertedAt[v] = clock++;
+            misses++;
+        }
+    }
+    free(insertedAt);
+    return indexCount ? (float)misses / (float)(indexCount / 3) : 0.0f;
+}
+
+// Load-time mesh processing: vertex cache order, then fetch order. Works in
+// place on the source data and returns the new vertex count.
+static uint32_t meshOptimize(Vertex* vertices, uint32_t vertexCount, uint32_t* indices, uint32_t indexCount) {
+    float acmrBefore = meshAcmr(indices, indexCount, vertexCount);
+    optimizeVertexCache(indices, indexCount, vertexCount);
+    uint32_t optimizedCount = optimizeVertexFetch(vertices, vertexCount, indices, indexCount);
+    float acmrAfter = meshAcmr(indices, indexCount, optimizedCount);
+    SDL_Log("Mesh: %u triangles, %u -> %u vertices, ACMR %.3f -> %.3f (FIFO %d)",
+            indexCount / 3, vertexCount, optimizedCount, acmrBefore, acmrAfter, VCACHE_REPORT_SIZE);
+    return optimizedCount;
+}
+
+// Tessellates each quad of the room into a detail x detail grid and pushes
+// the interior gently into the room, so the simplifier has something to
+// remove. Quad borders stay flat and straight, which keeps the seams between
+// the floor, ceiling and wall closed at every level of detail. Detail 1 is
+// the original room, triangle for triangle.
+static void buildRoomMesh(uint32_t detail, Vertex** roomVertices, uint32_t* vertexCount, uint32_t** roomIndices,
+                          uint32_t* indexCount) {
+    const float pi = 3.14159265f;
+    uint32_t side = detail + 1;
+    *vertexCount = ROOM_QUADS * side * side;
+    *indexCount = ROOM_QUADS * detail * detail * 6;
+    Vertex* outVertices = malloc(sizeof(Vertex) * *vertexCount);
+    uint32_t* outIndices = malloc(sizeof(uint32_t) * *indexCount);
+
+    uint32_t index = 0;
+    for (uint32_t q = 0; q < ROOM_QUADS; q++) {
+        const Vertex* corners = &vertices[4 * q];
+        // The quads sit on the faces of the [-1, 1] cube, so the way into the
+        // room is minus the quad's center
+        float inward[3];
+        for (int c = 0; c < 3; c++) {
+            inward[c] = -0.25f * (corners[0].pos[c] + corners[1].pos[c] + corners[2].pos[c] + corners[3].pos[c]);
+        }
+
+        uint32_t base = q * side * side;
+        for (uint32_t y = 0; y <= detail; y++) {
+            for (uint32_t x = 0; x <= detail; x++) {
+                float u = (float)x / (float)detail;
+                float v = (float)y / (float)detail;
+                float bump = 0.0f;
+                if (detail > 1) {
+                    bump = 0.08f * sinf(pi * u) * sinf(pi * v) *
+                           (0.5f + 0.5f * sinf(4.0f * pi * u) * sinf(4.0f * pi * v));
+                }
+                Vertex* out = &outVertices[base + y * side + x];
+                for (int c = 0; c < 3; c++) {
+                    out->pos[c] = (1.0f - u) * (1.0f - v) * corners[0].pos[c] + u * (1.0f - v) * corners[1].pos[c] +
+                                  u * v * corners[2].pos[c] + (1.0f - u) * v * corners[3].pos[c] + bump * inward[c];
+                    out->color[c] = corners[0].color[c];
+                }
+            }
+        }
+        for (uint32_t y = 0; y < detail; y++) {
+            for (uint32_t x = 0; x < detail; x++) {
+                uint32_t v00 = base + y * side + x;
+                uint32_t v10 = v00 + 1;
+                uint32_t v01 = v00 + side;
+                uint32_t v11 = v01 + 1;
+                uint32_t cell[6] = {v00, v10, v11, v11, v01, v00};
+                memcpy(&outIndices[index], cell, sizeof(cell));
+                index += 6;
+            }
+        }
+    }
+    *roomVertices = outVertices;
+    *roomIndices = outIndices;
+}
+
+// Quadric of the plane ax + by + cz + d = 0, scaled by weight
+static void quadricFromPlane(Quadric* q, double a, double b, double c, double d, double weight) {
+    q->a2 = a * a * weight;
+    q->ab = a * b * weight;
+    q->ac = a * c * weight;
+    q->ad = a * d * weight;
+    q->b2 = b * b * weight;
+    q->bc = b * c * weight;
+    q->bd = b * d * weight;
+    q->c2 = c * c * weight;
+    q->cd = c * d * weight;
+    q->d2 = d * d * weight;
+    q->weight = weight;
+}
+
+static void quadricAdd(Quadric* q, const Quadric* other) {
+    q->a2 += other->a2;
+    q->ab += other->ab;
+    q->ac += other->ac;
+    q->ad += other->ad;
+    q->b2 += other->b2;
+    q->bc += other->bc;
+    q->bd += other->bd;
+    q->c2 += other->c2;
+    q->cd += other->cd;
+    q->d2 += other->d2;
+    q->weight += other->weight;
+}
+
+// Weighted mean squared distance of p to the planes summed into q
+static double quadricError(const Quadric* q, const float p[3]) {
+    double x = p[0];
+    double y = p[1];
+    double z = p[2];
+    double error = q->a2 * x * x + 2.0 * q->ab * x * y + 2.0 * q->ac * x * z + 2.0 * q->ad * x +
+                   q->b2 * y * y + 2.0 * q->bc * y * z + 2.0 * q->bd * y +
+                   q->c2 * z * z + 2.0 * q->cd * z + q->d2;
+    return q->weight > 0.0 ? fabs(error) / q->weight : 0.0;
+}
+
+static void triangleNormal(const float* p0, const float* p1, const float* p2, float normal[3]) {
+    float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+    normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static int compareEdges(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static int compareCollapses(const void* a, const void* b) {
+    float x = ((const LodCollapse*)a)->cost;
+    float y = ((const LodCollapse*)b)->cost;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static bool hasEdge(const uint64_t* edges, uint32_t edgeCount, uint32_t from, uint32_t to) {
+    uint64_t key = (uint64_t)from << 32 | to;
+    return bsearch(&key, edges, edgeCount, sizeof(uint64_t), compareEdges) != NULL;
+}
+
+// Garland-Heckbert edge collapse that only moves a vertex onto one of its
+// neighbors, so the result indexes the original vertex buffer. Triangle
+// planes are weighted by area. Open edges (the quad borders) add a heavy plane
+// through the edge, perpendicular to the triangle: border vertices may only
+// slide along a straight border, and vertices on more than one border (or on
+// a non-manifold edge) never move. Each pass sorts every allowed collapse by
+// cost and applies the cheapest ones whose neighborhoods do not overlap and
+// that flip no triangle. Stops at targetIndexCount or once the next collapse
+// would cost more than maxError. Returns the index count written to
+// destination and the largest error taken, in mesh units.
+static uint32_t simplifyMesh(const Vertex* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount,
+                             uint32_t targetIndexCount, float maxError, uint32_t* destination, float* resultError) {
+    memcpy(destination, indices, sizeof(uint32_t) * indexCount);
+    uint32_t count = indexCount;
+
+    Quadric* quadrics = calloc(vertexCount, sizeof(Quadric));
+    uint64_t* edges = malloc(sizeof(uint64_t) * indexCount);
+    uint8_t* borderEdges = malloc(vertexCount);
+    uint8_t* touched = malloc(vertexCount);
+    uint32_t* remap = malloc(sizeof(uint32_t) * vertexCount);
+    uint32_t* adjacencyOffset = malloc(sizeof(uint32_t) * (vertexCount + 1));
+    uint32_t* adjacency = malloc(sizeof(uint32_t) * indexCount);
+    LodCollapse* collapses = malloc(sizeof(LodCollapse) * indexCount * 2);
+
+    for (uint32_t t = 0; t < count; t += 3) {
+        const float* p0 = vertices[destination[t]].pos;
+        float normal[3];
+        triangleNormal(p0, vertices[destination[t + 1]].pos, vertices[destination[t + 2]].pos, normal);
+        double length = sqrt((double)normal[0] * normal[0] + (double)normal[1] * normal[1] +
+                             (double)normal[2] * normal[2]);
+        if (length == 0.0) {
+            continue;
+        }
+        double a = normal[0] / length;
+        double b = normal[1] / length;
+        double c = normal[2] / length;
+        Quadric q;
+        quadricFromPlane(&q, a, b, c, -(a * p0[0] + b * p0[1] + c * p0[2]), length * 0.5);
+        for (int k = 0; k < 3; k++) {
+            quadricAdd(&quadrics[destination[t + k]], &q);
+        }
+    }
+
+    // Directed edges without a twin are borders. They only change where a
+    // collapse slides along them, so their planes are added once up front.
+    uint32_t edgeCount = 0;
+    for (uint32_t t = 0; t < count; t += 3) {
+        for (int k = 0; k < 3; k++) {
+            edges[edgeCount++] = (uint64_t)destination[t + k] << 32 | destination[t + (k + 1) % 3];
+        }
+    }
+    qsort(edges, edgeCount, sizeof(uint64_t), compareEdges);
+    for (uint32_t t = 0; t < count; t += 3) {
+        float normal[3];
+        triangleNormal(vertices[destination[t]].pos, vertices[destination[t + 1]].pos,
+                       vertices[destination[t + 2]].pos, normal);
+        for (int k = 0; k < 3; k++) {
+            uint32_t from = destination[t + k];
+            uint32_t to = destination[t + (k + 1) % 3];
+            if (hasEdge(edges, edgeCount, to, from)) {
+                continue;
+            }
+            const float* p0 = vertices[from].pos;
+            const float* p1 = vertices[to].pos;
+            float edge[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            double a = edge[1] * normal[2] - edge[2] * normal[1];
+            double b = edge[2] * normal[0] - edge[0] * normal[2];
+            double c = edge[0] * normal[1] - edge[1] * normal[0];
+            double length = sqrt(a * a + b * b + c * c);
+            if (length == 0.0) {
+                continue;
+            }
+            a /= length;
+            b /= length;
+            c /= length;
+            double edgeLengthSquared = (double)edge[0] * edge[0] + (double)edge[1] * edge[1] + (double)edge[2] * edge[2];
+            Quadric q;
+            quadricFromPlane(&q, a, b, c, -(a * p0[0] + b * p0[1] + c * p0[2]),
+                             edgeLengthSquared * LOD_BORDER_WEIGHT);
+            quadricAdd(&quadrics[from], &q);
+            quadricAdd(&quadrics[to], &q);
+        }
+    }
+
+    double maxCost = 0.0;
+    double costLimit = (double)maxError * maxError;
+    while (count > targetIndexCount) {
+        // Topology of the current mesh
+        edgeCount = 0;
+        for (uint32_t t = 0; t < count; t += 3) {
+            for (int k = 0; k < 3; k++) {
+                edges[edgeCount++] = (uint64_t)destination[t + k] << 32 | destination[t + (k + 1) % 3];
+            }
+        }
+        qsort(edges, edgeCount, sizeof(uint64_t), compareEdges);
+        memset(borderEdges, 0, vertexCount);
+        memset(adjacencyOffset, 0, sizeof(uint32_t) * (vertexCount + 1));
+        for (uint32_t e = 0; e < edgeCount; e++) {
+            uint32_t from = (uint32_t)(edges[e] >> 32);
+            uint32_t to = (uint32_t)edges[e];
+            bool duplicate = e > 0 && edges[e - 1] == edges[e];
+            if (duplicate || !hasEdge(edges, edgeCount, to, from)) {
+                // A duplicate directed edge is non-manifold: lock both ends
+                borderEdges[from] = (uint8_t)SDL_min(borderEdges[from] + (duplicate ? 3 : 1), 255);
+                borderEdges[to] = (uint8_t)SDL_min(borderEdges[to] + (duplicate ? 3 : 1), 255);
+            }
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            adjacencyOffset[destination[i] + 1]++;
+        }
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            adjacencyOffset[v + 1] += adjacencyOffset[v];
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            adjacency[adjacencyOffset[destination[i]]++] = i / 3;
+        }
+        for (uint32_t v = vertexCount; v > 0; v--) {
+            adjacencyOffset[v] = adjacencyOffset[v - 1];
+        }
+        adjacencyOffset[0] = 0;
+
+        // Every collapse an edge allows, cheapest first
+        uint32_t collapseCount = 0;
+        for (uint32_t e = 0; e < edgeCount; e++) {
+            uint32_t ends[2] = {(uint32_t)(edges[e] >> 32), (uint32_t)edges[e]};
+            bool border = !hasEdge(edges, edgeCount, ends[1], ends[0]);
+            for (int d = 0; d < (border ? 2 : 1); d++) {
+                uint32_t from = ends[d];
+                uint32_t to = ends[1 - d];
+                bool allowed = borderEdges[from] == 0 || (borderEdges[from] == 2 && border);
+                if (!allowed) {
+                    continue;
+                }
+                Quadric q = quadrics[from];
+                quadricAdd(&q, &quadrics[to]);
+                collapses[collapseCount++] = (LodCollapse){from, to, (float)quadricError(&q, vertices[to].pos)};
+            }
+        }
+        qsort(collapses, collapseCount, sizeof(LodCollapse), compareCollapses);
+
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            remap[v] = v;
+        }
+        memset(touched, 0, vertexCount);
+        uint32_t triangles = count / 3;
+        uint32_t applied = 0;
+        for (uint32_t c = 0; c < collapseCount && triangles * 3 > targetIndexCount; c++) {
+            const LodCollapse* collapse = &collapses[c];
+            if (collapse->cost > costLimit) {
+                break;
+            }
+            uint32_t from = collapse->from;
+            uint32_t to = collapse->to;
+            if (touched[from] || touched[to]) {
+                continue;
+            }
+
+            // Reject collapses that fold a triangle over, and count the
+            // triangles that disappear with the edge
+            const float* target = vertices[to].pos;
+            bool flips = false;
+            uint32_t removed = 0;
+            for (uint32_t a = adjacencyOffset[from]; a < adjacencyOffset[from + 1] && !flips; a++) {
+                const uint32_t* tri = &destination[adjacency[a] * 3];
+                if (tri[0] == to || tri[1] == to || tri[2] == to) {
+                    removed++;
+                    continue;
+                }
+                float before[3];
+                float after[3];
+                const float* p[3];
+                const float* q[3];
+                for (int k = 0; k < 3; k++) {
+                    p[k] = vertices[tri[k]].pos;
+                    q[k] = tri[k] == from ? target : p[k];
+                }
+                triangleNormal(p[0], p[1], p[2], before);
+                triangleNormal(q[0], q[1], q[2], after);
+                flips = before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0f;
+            }
+            if (flips) {
+                continue;
+            }
+
+            remap[from] = to;
+            quadricAdd(&quadrics[to], &quadrics[from]);
+            for (uint32_t a = adjacencyOffset[from]; a < adjacencyOffset[from + 1]; a++) {
+                const uint32_t* tri = &destination[adjacency[a] * 3];
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+            }
+            triangles -= SDL_min(removed, triangles);
+            maxCost = SDL_max(maxCost, (double)collapse->cost);
+            applied++;
+        }
+        if (applied == 0) {
+            break;
+        }
+
+        // Apply the pass and drop the triangles that collapsed to a line
+        uint32_t kept = 0;
+        for (uint32_t t = 0; t < count; t += 3) {
+            uint32_t a = remap[destination[t]];
+            uint32_t b = remap[destination[t + 1]];
+            uint32_t c = remap[destination[t + 2]];
+            if (a != b && b != c && c != a) {
+                destination[kept++] = a;
+                destination[kept++] = b;
+                destination[kept++] = c;
+            }
+        }
+        count = kept;
+    }
+
+    free(collapses);
+    free(adjacency);
+    free(adjacencyOffset);
+    free(remap);
+    free(touched);
+    free(borderEdges);
+    free(edges);
+    free(quadrics);
+    *resultError = (float)sqrt(maxCost);
+    return count;
+}
+
+// Builds the mesh's LOD chain and returns its index count. Level 0 is the
+// input; each further level is simplified from level 0 to half the triangles
+// of the level before, then ordered for the vertex cache. The chain ends at
+// LOD_MAX_LEVELS, at LOD_MAX_ERROR, or once simplification stops paying off.
+// All levels share the vertices and follow each other in *lodIndices.
+static uint32_t buildLods(const Vertex* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount,
+                          float radius, SceneMesh* mesh, uint32_t** lodIndices) {
+    uint32_t* chain = malloc(sizeof(uint32_t) * indexCount * LOD_MAX_LEVELS);
+    uint32_t* level = malloc(sizeof(uint32_t) * indexCount);
+    memcpy(chain, indices, sizeof(uint32_t) * indexCount);
+    mesh->lods[0] = (SceneLod){mesh->firstIndex, indexCount, 0.0f};
+    mesh->lodCount = 1;
+    uint32_t total = indexCount;
+
+    while (mesh->lodCount < LOD_MAX_LEVELS) {
+        const SceneLod* previous = &mesh->lods[mesh->lodCount - 1];
+        uint32_t target = previous->indexCount / 6 * 3;
+        float error;
+        uint32_t count = simplifyMesh(vertices, vertexCount, indices, indexCount, target, LOD_MAX_ERROR * radius,
+                                      level, &error);
+        if (count == 0 || (float)count > (float)previous->indexCount * LOD_MIN_REDUCTION) {
+            break;
+        }
+        optimizeVertexCache(level, count, vertexCount);
+        memcpy(&chain[total], level, sizeof(uint32_t) * count);
+        // Errors only grow along the chain, which selection relies on
+        mesh->lods[mesh->lodCount] = (SceneLod){mesh->firstIndex + total, count,
+                                                SDL_max(error / radius, previous->error)};
+        mesh->lodCount++;
+        total += count;
+    }
+    free(level);
+
+    for (uint32_t l = 0; l < mesh->lodCount; l++) {
+        SDL_Log("LOD %u: %u triangles, error %.4f of radius", l, mesh->lods[l].indexCount / 3,
+                (double)mesh->lods[l].error);
+    }
+    *lodIndices = chain;
+    return total;
+}
+
+// Lays roomCount copies of the room out on a square grid in clip space. A
+// single room keeps its original size and position. The per-draw path bakes
+// each copy into the vertex buffer; the GPU-driven path keeps one room mesh
+// and describes the copies as instances.
+static void buildScene(uint32_t roomCount) {
+    uint32_t side = (uint32_t)ceil(sqrt((double)roomCount));
+    float cell = 2.0f / (float)side;
+    float scale = cell * 0.5f;
+
+    Vertex* roomVertices;
+    uint32_t* roomIndices;
+    uint32_t roomVertexCount;
+    uint32_t roomIndexCount;
+    buildRoomMesh(appConfig.roomDetail, &roomVertices, &roomVertexCount, &roomIndices, &roomIndexCount);
+    roomVertexCount = meshOptimize(roomVertices, roomVertexCount, roomIndices, roomIndexCount);
+
+    // The room spans [-1, 1] on every axis
+    scene.meshCount = 1;
+    scene.meshes = calloc(1, sizeof(SceneMesh));
+    SceneMesh* mesh = &scene.meshes[0];
+    mesh->indexCount = roomIndexCount;
+    mesh->sphere[3] = sqrtf(3.0f);
+    uint32_t* lodIndices;
+    scene.indexCount = buildLods(roomVertices, roomVertexCount, roomIndices, roomIndexCount, mesh->sphere[3],
+                                 mesh, &lodIndices);
+
+    // Rooms are addressed through vertexOffset, so only the room's own vertex
+    // count limits the index width. 0xFFFF stays free as the restart value.
+    scene.indexType = roomVertexCount < 0xFFFF ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    scene.indices = malloc((size_t)indexTypeSize(scene.indexType) * scene.indexCount);
+    for (uint32_t i = 0; i < scene.indexCount; i++) {
+        if (scene.indexType == VK_INDEX_TYPE_UINT16) {
+            ((uint16_t*)scene.indices)[i] = (uint16_t)lodIndices[i];
+        } else {
+            ((uint32_t*)scene.indices)[i] = lodIndices[i];
+        }
+    }
+    free(lodIndices);
+
+    if (appConfig.gpuDriven) {
+        scene.vertexCount = roomVertexCount;
+        scene.vertices = malloc(sizeof(PackedVertex) * roomVertexCount);
+        for (uint32_t v = 0; v < roomVertexCount; v++) {
+            scene.vertices[v] = packVertex(roomVertices[v].pos, roomVertices[v].color);
+        }
+        mesh->instanceCount = roomCount;
+
+        scene.instanceCount = roomCount;
+        scene.instances = calloc(roomCount, sizeof(SceneInstance));
+        for (uint32_t room = 0; room < roomCount; room++) {
+            SceneInstance* instance = &scene.instances[room];
+            instance->positionScale[0] = -1.0f + cell * ((float)(room % side) + 0.5f);
+            instance->positionScale[1] = -1.0f + cell * ((float)(room / side) + 0.5f);
+            instance->positionScale[3] = scale;
+        }
+    } else {
+        scene.vertexCount = roomCount * roomVertexCount;
+        scene.vertices = malloc(sizeof(PackedVertex) * scene.vertexCount);
+        scene.drawCount = roomCount;
+        scene.draws = malloc(sizeof(SceneDraw) * roomCount);
+
+        for (uint32_t room = 0; room < roomCount; room++) {
+            float centerX = -1.0f + cell * ((float)(room % side) + 0.5f);
+            float centerY = -1.0f + cell * ((float)(room / side) + 0.5f);
+            PackedVertex* out = &scene.vertices[room * roomVertexCount];
+            for (uint32_t v = 0; v < roomVertexCount; v++) {
+                const Vertex* in = &roomVertices[v];
+                float pos[3] = {
+                    in->pos[0] * scale + centerX,
+                    in->pos[1] * scale + centerY,
+                    in->pos[2] * scale,
+                };
+                out[v] = packVertex(pos, in->color);
+            }
+
+            SceneDraw* draw = &scene.draws[room];
+            draw->indexCount = roomIndexCount;
+            draw->firstIndex = 0;
+            draw->vertexOffset = (int32_t)(room * roomVertexCount);
+            draw->sphere[0] = centerX;
+            draw->sphere[1] = centerY;
+            draw->sphere[2] = 0.0f;
+            draw->sphere[3] = sqrtf(3.0f) * scale;
+            draw->mesh = 0;
+        }
+    }
+    free(roomIndices);
+    free(roomVertices);
+
+    uint64_t sourceBytes = (uint64_t)scene.vertexCount * sizeof(Vertex) + (uint64_t)scene.indexCount * sizeof(uint32_t);
+    uint64_t packedBytes = (uint64_t)scene.vertexCount * sizeof(PackedVertex) +
+                           (uint64_t)scene.indexCount * indexTypeSize(scene.indexType);
+    SDL_Log("Geometry: %u -> %u bytes/vertex, %u -> %u bytes/index, %.1f -> %.1f KiB",
+            (uint32_t)sizeof(Vertex), (uint32_t)sizeof(PackedVertex), (uint32_t)sizeof(uint32_t),
+            indexTypeSize(scene.indexType), (double)sourceBytes / 1024.0, (double)packedBytes / 1024.0);
+}
+
+static void destroyScene(void) {
+    free(scene.vertices);
+    free(scene.indices);
+    free(scene.draws);
+    free(scene.meshes);
+    free(scene.instances);
+    memset(&scene, 0, sizeof(scene));
+}
+
+static bool writeSceneFile(const char* path) {
+    const void* data[SCENE_SECTION_COUNT] = {scene.vertices, scene.indices, scene.draws, scene.meshes, scene.instances};
+    SceneFileHeader header = {0};
+    header.magic = SCENE_FILE_MAGIC;
+    header.version = SCENE_FILE_VERSION;
+    header.vertexStride = sizeof(PackedVertex);
+    header.indexType = (uint32_t)scene.indexType;
+    header.vertexCount = scene.vertexCount;
+    header.indexCount = scene.indexCount;
+    header.drawCount = scene.drawCount;
+    header.meshCount = scene.meshCount;
+    header.instanceCount = scene.instanceCount;
+    header.sections[SCENE_SECTION_VERTICES].size = (uint64_t)sizeof(PackedVertex) * scene.vertexCount;
+    header.sections[SCENE_SECTION_INDICES].size = (uint64_t)indexTypeSize(scene.indexType) * scene.indexCount;
+    header.sections[SCENE_SECTION_DRAWS].size = (uint64_t)sizeof(SceneDraw) * scene.drawCount;
+    header.sections[SCENE_SECTION_MESHES].size = (uint64_t)sizeof(SceneMesh) * scene.meshCount;
+    header.sections[SCENE_SECTION_INSTANCES].size = (uint64_t)sizeof(SceneInstance) * scene.instanceCount;
+    uint64_t offset = alignUp(sizeof(header), SCENE_FILE_ALIGNMENT);
+    for (int i = 0; i < SCENE_SECTION_COUNT; i++) {
+        header.sections[i].offset = offset;
+        offset = alignUp(offset + header.sections[i].size, SCENE_FILE_ALIGNMENT);
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        SDL_Log("Cannot write scene file %s", path);
+        return false;
+    }
+    static const uint8_t padding[SCENE_FILE_ALIGNMENT] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    uint64_t written = sizeof(header);
+    for (int i = 0; i < SCENE_SECTION_COUNT && ok; i++) {
+        const SceneFileSection* section = &header.sections[i];
+        ok = fwrite(padding, 1, section->offset - written, file) == section->offset - written &&
+             (section->size == 0 || fwrite(data[i], section->size, 1, file) == 1);
+        written = section->offset + section->size;
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        SDL_Log("Failed writing scene file %s", path);
+        remove(path);
+        return false;
+    }
+    SDL_Log("Wrote %s: %u vertices, %u indices, %u draws, %u meshes, %u instances (%.2f MiB)",
+            path, scene.vertexCount, scene.indexCount, scene.drawCount, scene.meshCount, scene.instanceCount,
+            written / (1024.0 * 1024.0));
+    return true;
+}
+
+// Scene files are read through SDL_IOStream, whose offsets are 64-bit on every
+// platform (long, and so fseek, is 32-bit on Windows)
+static bool readSceneSection(SDL_IOStream* file, const SceneFileSection* section, void** out) {
+    *out = NULL;
+    if (section->size == 0) {
+        return true;
+    }
+    *out = malloc(section->size);
+    return SDL_SeekIO(file, (Sint64)section->offset, SDL_IO_SEEK_SET) == (Sint64)section->offset &&
+           SDL_ReadIO(file, *out, section->size) == section->size;
+}
+
+// Checks that every count and range in the file stays inside its section, so
+// a corrupt file fails here instead of reading or copying out of bounds later.
+// The indices are read once to find how far each mesh reaches into the
+// vertices; they are small next to the vertices and instances.
+static bool validateSceneFile(const SceneFileHeader* header, const void* indices) {
+    const SceneFileSection* sections = header->sections;
+    uint32_t indexSize = indexTypeSize((VkIndexType)header->indexType);
+    if (sections[SCENE_SECTION_VERTICES].size != (uint64_t)header->vertexStride * header->vertexCount ||
+        sections[SCENE_SECTION_INDICES].size != (uint64_t)indexSize * header->indexCount ||
+        sections[SCENE_SECTION_DRAWS].size != (uint64_t)sizeof(SceneDraw) * header->drawCount ||
+        sections[SCENE_SECTION_MESHES].size != (uint64_t)sizeof(SceneMesh) * header->meshCount ||
+        sections[SCENE_SECTION_INSTANCES].size != (uint64_t)sizeof(SceneInstance) * header->instanceCount) {
+        return false;
+    }
+
+    // Highest index of each mesh's chain, relative to its vertexOffset
+    uint32_t* maxIndex = calloc(header->meshCount ? header->meshCount : 1, sizeof(uint32_t));
+    bool ok = true;
+    for (uint32_t m = 0; m < header->meshCount && ok; m++) {
+        const SceneMesh* mesh = &scene.meshes[m];
+        ok = mesh->lodCount >= 1 && mesh->lodCount <= LOD_MAX_LEVELS &&
+             (uint64_t)mesh->firstIndex + mesh->indexCount <= header->indexCount &&
+             (uint64_t)mesh->firstInstance + mesh->instanceCount <= header->instanceCount;
+        for (uint32_t l = 0; l < mesh->lodCount && ok; l++) {
+            const SceneLod* lod = &mesh->lods[l];
+            ok = (uint64_t)lod->firstIndex + lod->indexCount <= header->indexCount;
+            for (uint32_t i = lod->firstIndex; i < lod->firstIndex + lod->indexCount && ok; i++) {
+                uint32_t index = indexSize == sizeof(uint16_t) ? ((const uint16_t*)indices)[i]
+                                                               : ((const uint32_t*)indices)[i];
+                maxIndex[m] = SDL_max(maxIndex[m], index);
+            }
+        }
+        ok = ok && mesh->vertexOffset >= 0 &&
+             (uint64_t)mesh->vertexOffset + maxIndex[m] < header->vertexCount;
+    }
+    for (uint32_t d = 0; d < header->drawCount && ok; d++) {
+        const SceneDraw* draw = &scene.draws[d];
+        ok = draw->mesh < header->meshCount &&
+             (uint64_t)draw->firstIndex + draw->indexCount <= header->indexCount &&
+             draw->vertexOffset >= 0 &&
+             (uint64_t)draw->vertexOffset + maxIndex[draw->mesh] < header->vertexCount;
+    }
+    free(maxIndex);
+    return ok;
+}
+
+// Reads the header and the sections the CPU needs (draws, meshes). Vertices,
+// indices and instances only go to the GPU and are left to the streamer.
+static bool loadSceneFile(const char* path) {
+    SDL_IOStream* file = SDL_IOFromFile(path, "rb");
+    if (!file) {
+        SDL_Log("Cannot open scene file %s", path);
+        return false;
+    }
+
+    SceneFileHeader* header = &streamer.header;
+    bool ok = SDL_ReadIO(file, header, sizeof(*header)) == sizeof(*header);
+    if (!ok || header->magic != SCENE_FILE_MAGIC || header->version != SCENE_FILE_VERSION ||
+        header->vertexStride != sizeof(PackedVertex) ||
+        (header->indexType != VK_INDEX_TYPE_UINT16 && header->indexType != VK_INDEX_TYPE_UINT32)) {
+        SDL_Log("%s is not a version %d scene file for this vertex format", path, SCENE_FILE_VERSION);
+        SDL_CloseIO(file);
+        return false;
+    }
+    Sint64 fileSize = SDL_GetIOSize(file);
+    for (int i = 0; i < SCENE_SECTION_COUNT; i++) {
+        const SceneFileSection* section = &header->sections[i];
+        if (fileSize < 0 || section->offset % SCENE_FILE_ALIGNMENT != 0 ||
+            section->offset + section->size > (uint64_t)fileSize) {
+            SDL_Log("%s is truncated or corrupt", path);
+            SDL_CloseIO(file);
+            return false;
+        }
+    }
+
+    scene.vertexCount = header->vertexCount;
+    scene.indexCount = header->indexCount;
+    scene.indexType = (VkIndexType)header->indexType;
+    scene.drawCount = header->drawCount;
+    scene.meshCount = header->meshCount;
+    scene.instanceCount = header->instanceCount;
+    void* indices = NULL;
+    ok = readSceneSection(file, &header->sections[SCENE_SECTION_DRAWS], (void**)&scene.draws) &&
+         readSceneSection(file, &header->sections[SCENE_SECTION_MESHES], (void**)&scene.meshes) &&
+         readSceneSection(file, &header->sections[SCENE_SECTION_INDICES], &indices);
+    SDL_CloseIO(file);
+    if (!ok) {
+        free(indices);
+        SDL_Log("Failed reading scene file %s", path);
+        return false;
+    }
+    ok = validateSceneFile(header, indices);
+    free(indices);
+    if (!ok) {
+        SDL_Log("%s has counts or ranges that do not match its sections", path);
+        return false;
+    }
+
+    // The file decides the rendering path
+    appConfig.gpuDriven = scene.instanceCount > 0;
+    streamer.path = path;
+    SDL_Log("Scene %s: %u vertices, %u indices, %s", path, scene.vertexCount, scene.indexCount,
+            appConfig.gpuDriven ? "GPU-driven instances" : "per-room draws");
+    return true;
+}
+
+static void benchInit(void) {
+    // Every sample array is sized for the warm-up frames as well, which are dropped later
+    uint32_t capacity = appConfig.benchFrames + BENCH_WARMUP_FRAMES;
+    bench.cpuFrameMs = calloc(capacity, sizeof(double));
+    bench.gpuFrameMs = calloc(capacity, sizeof(double));
+    bench.frameIntervalMs = calloc(capacity, sizeof(double));
+    bench.recordMs = calloc(capacity, sizeof(double));
+    SDL_Log("Benchmark: %u frames, %u room(s), %u frame(s) in flight, %u recording thread(s)%s",
+            appConfig.benchFrames, appConfig.rooms, vkContext.framesInFlight, jobs.workerCount,
+            vkContext.headless ? ", headless" : "");
+}
+
+static void benchAddGpuTime(double ms) {
+    if (frameCount > BENCH_WARMUP_FRAMES + vkContext.framesInFlight) {
+        bench.gpuFrameMs[bench.gpuCount++] = ms;
+    }
+}
+
+static int benchEndFrame(Uint64 frameStart, Uint64 waitTicks, Uint64 recordTicks) {
+    if (frameCount <= BENCH_WARMUP_FRAMES) {
+        bench.lastFrameStart = frameStart;
+        bench.startTicks = frameStart;
+        return 0;
+    }
+
+    bench.cpuFrameMs[bench.cpuCount++] = ticksToMs(SDL_GetPerformanceCounter() - frameStart - waitTicks);
+    bench.frameIntervalMs[bench.intervalCount++] = ticksToMs(frameStart - bench.lastFrameStart);
+    bench.recordMs[bench.cpuCount - 1] = ticksToMs(recordTicks);
+    bench.lastFrameStart = frameStart;
+
+    if (bench.cpuCount < appConfig.benchFrames) {
+        return 0;
+    }
+    return benchFinish();
+}
+
+static int compareDoubles(const void* a, const void* b) {
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+// Nearest-rank percentile of an already sorted array
+static double percentile(const double* sorted, uint32_t count, double p) {
+    if (count == 0) {
+        return 0.0;
+    }
+    uint32_t rank = (uint32_t)ceil(p / 100.0 * count);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void writeDistribution(FILE* file, const char* name, double* samples, uint32_t count, bool last) {
+    qsort(samples, count, sizeof(double), compareDoubles);
+    double sum = 0.0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    fprintf(file, "  \"%s\": {\"samples\": %u, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}%s\n",
+            name, count, count ? sum / count : 0.0,
+            percentile(samples, count, 50.0), percentile(samples, count, 95.0), percentile(samples, count, 99.0),
+            count ? samples[count - 1] : 0.0, last ? "" : ",");
+}
+
+static int benchFinish(void) {
+    double seconds = ticksToMs(SDL_GetPerformanceCounter() - bench.startTicks) / 1000.0;
+    vkDeviceWaitIdle(vkContext.device);
+
+    // The GPU times of the frames still in flight only become available now
+    for (uint32_t i = 0; i < vkContext.framesInFlight; i++) {
+        double gpuFrameMs = profilerResolveGpu(i);
+        if (gpuFrameMs >= 0.0) {
+            benchAddGpuTime(gpuFrameMs);
+        }
+        shadingStatsCollect(i);
+    }
+
+    int result = 1;
+    uint32_t checksum = 0;
+    bool haveChecksum = false;
+    if (appConfig.checksum) {
+        // The slot before currentFrame rendered the final frame
+        uint32_t lastImage = (uint32_t)((frameCount - 1) % vkContext.framesInFlight);
+        haveChecksum = readbackChecksum(lastImage, &checksum);
+        if (haveChecksum) {
+            SDL_Log("Final frame checksum: 0x%08x", checksum);
+        }
+        if (appConfig.expectChecksum &&
+            (!haveChecksum || checksum != (uint32_t)strtoul(appConfig.expectChecksum, NULL, 16))) {
+            SDL_Log("Checksum mismatch, expected %s", appConfig.expectChecksum);
+            result = -1;
+        }
+    }
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(vkContext.physicalDevice, &props);
+
+    FILE* file = fopen(appConfig.benchOutput, "w");
+    if (!file) {
+        SDL_Log("Cannot write %s", appConfig.benchOutput);
+        return -1;
+    }
+    fprintf(file, "{\n");
+    fprintf(file, "  \"device\": \"%s\",\n", props.deviceName);
+    fprintf(file, "  \"headless\": %s,\n", vkContext.headless ? "true" : "false");
+    fprintf(file, "  \"rooms\": %u,\n", appConfig.rooms);
+    fprintf(file, "  \"drawsPerFrame\": %u,\n", culler.enabled ? culler.commandCount : scene.drawCount);
+    if (culler.enabled) {
+        fprintf(file, "  \"instances\": %u,\n", scene.instanceCount);
+        fprintf(file, "  \"visibleInstances\": %.1f,\n",
+                culler.visibleSamples ? (double)culler.visibleTotal / culler.visibleSamples : 0.0);
+    }
+    fprintf(file, "  \"depthPrepass\": %s,\n", appConfig.depthPrepass ? "true" : "false");
+    fprintf(file, "  \"lod\": %s,\n", appConfig.lod ? "true" : "false");
+    if (lodState.samples) {
+        fprintf(file, "  \"trianglesPerFrame\": %.0f,\n", (double)lodState.triangleTotal / lodState.samples);
+    }
+    if (shadingStats.samples) {
+        double fragments = (double)shadingStats.fragmentTotal / shadingStats.samples;
+        fprintf(file, "  \"fragmentInvocations\": %.0f,\n", fragments);
+        fprintf(file, "  \"overdraw\": %.3f,\n",
+                fragments / ((double)vkContext.extent.width * vkContext.extent.height));
+    }
+    if (ui.samples) {
+        fprintf(file, "  \"overlayQuadsPerFrame\": %.1f,\n", (double)ui.quadTotal / ui.samples);
+    }
+    fprintf(file, "  \"staticScene\": %s,\n", appConfig.staticScene ? "true" : "false");
+    if (appConfig.cacheCommands) {
+        fprintf(file, "  \"commandCache\": {\"replays\": %u, \"records\": %u},\n",
+                commandCache.replays, commandCache.records);
+    }
+    fprintf(file, "  \"framesInFlight\": %u,\n", vkContext.framesInFlight);
+    fprintf(file, "  \"recordThreads\": %u,\n", jobs.workerCount);
+    fprintf(file, "  \"startupMs\": {\"total\": %.3f", ticksToMs(startup.end - startup.start));
+    for (uint32_t i = 0; i < startup.taskCount; i++) {
+        fprintf(file, ", \"%s\": %.3f", startup.tasks[i].name, ticksToMs(startup.tasks[i].end - startup.tasks[i].start));
+    }
+    fprintf(file, "},\n");
+    GpuHeapBudget budgets[VK_MAX_MEMORY_HEAPS];
+    gpuGetBudget(budgets);
+    fprintf(file, "  \"heapsMiB\": [");
+    for (uint32_t i = 0; i < gpuAllocator.memoryProperties.memoryHeapCount; i++) {
+        fprintf(file, "%s{\"usage\": %.2f, \"budget\": %.2f}", i ? ", " : "",
+                budgets[i].usage / (1024.0 * 1024.0), budgets[i].budget / (1024.0 * 1024.0));
+    }
+    fprintf(file, "],\n");
+    if (!vkContext.headless) {
+        fprintf(file, "  \"presentMode\": \"%s\",\n", presentModeName(vkContext.presentMode));
+        fprintf(file, "  \"swapchainImages\": %u,\n", vkContext.swapchainImageCount);
+    }
+    fprintf(file, "  \"frames\": %u,\n", bench.cpuCount);
+    fprintf(file, "  \"throughputFps\": %.2f,\n", seconds > 0.0 ? bench.cpuCount / seconds : 0.0);
+    if (haveChecksum) {
+        fprintf(file, "  \"checksum\": \"0x%08x\",\n", checksum);
+    }
+    writeDistribution(file, "cpuFrameMs", bench.cpuFrameMs, bench.cpuCount, false);
+    writeDistribution(file, "gpuFrameMs", bench.gpuFrameMs, bench.gpuCount, false);
+    writeDistribution(file, "recordMs", bench.recordMs, bench.cpuCount, false);
+    writeDistribution(file, "frameIntervalMs", bench.frameIntervalMs, bench.intervalCount, true);
+    fprintf(file, "}\n");
+    fclose(file);
+
+    SDL_Log("Benchmark: %u frames in %.2f s (%.1f fps), CPU p50 %.3f ms, record p50 %.3f ms, GPU p50 %.3f ms -> %s",
+            bench.cpuCount, seconds, seconds > 0.0 ? bench.cpuCount / seconds : 0.0,
+            percentile(bench.cpuFrameMs, bench.cpuCount, 50.0),
+            percentile(bench.recordMs, bench.cpuCount, 50.0),
+            percentile(bench.gpuFrameMs, bench.gpuCount, 50.0), appConfig.benchOutput);
+    return result;
+}
+
+// Copies a headless target into host memory and hashes it. Lavapipe renders
+// deterministically, so CI can compare the hash against a known-good value.
+static bool readbackChecksum(uint32_t imageIndex, uint32_t* checksum) {
+    VkDeviceSize size = (VkDeviceSize)vkContext.extent.width * vkContext.extent.height * 4;
+    GpuBuffer readback = {0};
+    if (!gpuCreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                         VK_MEMORY_PROPERTY_HOST_CACHED_BIT, &readback)) {
+        return false;
+    }
+
+    VkCommandBuffer cmd = stagingUploader.commandBuffer;
+    VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(cmd, &beginInfo);
+
+    VkBufferImageCopy region = {0};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = (VkExtent3D){vkContext.extent.width, vkContext.extent.height, 1};
+    vkCmdCopyImageToBuffer(cmd, vkContext.swapchainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           readback.buffer, 1, &region);
+
+    VkMemoryBarrier barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &barrier, 0, NULL, 0, NULL);
+    vkEndCommandBuffer(cmd);
+
+    VkSubmitInfo submitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+    vkQueueSubmit(vkContext.graphicsQueue, 1, &submitInfo, stagingUploader.fence);
+    vkWaitForFences(vkContext.device, 1, &stagingUploader.fence, VK_TRUE, UINT64_MAX);
+    vkResetFences(vkContext.device, 1, &stagingUploader.fence);
+    vkResetCommandBuffer(cmd, 0);
+
+    gpuInvalidate(&readback.allocation, 0, size);
+    *checksum = fnv1a(readback.allocation.mapped, (size_t)size);
+    gpuDestroyBuffer(&readback);
+    return true;
+}
+
+// Job system. Each worker owns a queue; jobs are spread round-robin and a
+// worker that runs dry steals from the others, so uneven chunks balance out.
+static int jobWorkerMain(void* data) {
+    uint32_t worker = (uint32_t)(uintptr_t)data;
+    jobs.threadIds[worker] = SDL_GetCurrentThreadID();
+    for (;;) {
+        SDL_WaitSemaphore(jobs.wake);
+        if (SDL_AtomicGet(&jobs.quit)) {
+            return 0;
+        }
+        while (jobTryRun(worker)) {
+        }
+    }
+}
+
+static void jobSystemInit(uint32_t workerCount) {
+    jobs.workerCount = workerCount;
+    jobs.wake = SDL_CreateSemaphore(0);
+    for (uint32_t i = 1; i < workerCount; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "job worker %u", i);
+        jobs.threads[i] = SDL_CreateThread(jobWorkerMain, name, (void*)(uintptr_t)i);
+        if (!jobs.threads[i]) {
+            // Run with however many workers we managed to start
+            SDL_Log("Cannot start %s: %s", name, SDL_GetError());
+            jobs.workerCount = i;
+            break;
+        }
+    }
+    SDL_Log("Job system: %u worker(s)", jobs.workerCount);
+}
+
+static void jobSystemShutdown(void) {
+    SDL_AtomicSet(&jobs.quit, 1);
+    for (uint32_t i = 1; i < jobs.workerCount; i++) {
+        SDL_PostSemaphore(jobs.wake);
+    }
+    for (uint32_t i = 1; i < jobs.workerCount; i++) {
+        SDL_WaitThread(jobs.threads[i], NULL);
+    }
+    SDL_DestroySemaphore(jobs.wake);
+}
+
+// Worker index of the calling thread. Only a worker writes its own entry, so
+// the one entry that can match has always been written by this thread.
+static uint32_t jobCurrentWorker(void) {
+    SDL_ThreadID self = SDL_GetCurrentThreadID();
+    for (uint32_t i = 1; i < jobs.workerCount; i++) {
+        if (jobs.threadIds[i] == self) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+static void jobSubmit(JobFunction function, void* data, SDL_AtomicInt* counter) {
+    SDL_AtomicAdd(counter, 1);
+    uint32_t target = (uint32_t)SDL_AtomicAdd(&jobs.nextQueue, 1) % jobs.workerCount;
+    JobQueue* queue = &jobs.queues[target];
+
+    SDL_LockSpinlock(&queue->lock);
+    bool queued = queue->tail - queue->head < JOB_QUEUE_SIZE;
+    if (queued) {
+        queue->jobs[queue->tail++ & (JOB_QUEUE_SIZE - 1)] = (Job){function, data, counter};
+    }
+    SDL_UnlockSpinlock(&queue->lock);
+
+    if (!queued) {
+        // Queue full: run it here rather than block. Jobs pick per-worker
+        // resources (record pools) by index, so it runs as the calling worker.
+        function(data, jobCurrentWorker());
+        SDL_AtomicAdd(counter, -1);
+    } else if (target != 0) {
+        SDL_PostSemaphore(jobs.wake);
+    }
+}
+
+// Pops the newest job of the worker's own queue, or steals the oldest job of
+// another queue. Returns false when there was nothing to run.
+static bool jobTryRun(uint32_t worker) {
+    Job job;
+    bool found = false;
+    for (uint32_t i = 0; i < jobs.workerCount && !found; i++) {
+        JobQueue* queue = &jobs.queues[(worker + i) % jobs.workerCount];
+        SDL_LockSpinlock(&queue->lock);
+        if (queue->tail != queue->head) {
+            job = i == 0 ? queue->jobs[--queue->tail & (JOB_QUEUE_SIZE - 1)]
+                         : queue->jobs[queue->head++ & (JOB_QUEUE_SIZE - 1)];
+            found = true;
+        }
+        SDL_UnlockSpinlock(&queue->lock);
+    }
+    if (found) {
+        job.function(job.data, worker);
+        SDL_AtomicAdd(job.counter, -1);
+    }
+    return found;
+}
+
+// The calling thread runs jobs too instead of sleeping until the counter drains
+static void jobWait(SDL_AtomicInt* counter) {
+    while (SDL_AtomicGet(counter) > 0) {
+        jobTryRun(0);
+    }
+}
+
+// Profiler. CPU scopes are timed with the performance counter, GPU scopes
+// with timestamp queries. Both feed rolling per-scope statistics and, with
+// --trace, a Chrome trace JSON stream (CPU on tid 1, GPU on tid 2).
+static void profilerInit(void) {
+    profiler.originTicks = appStartTicks;
+
+    if (appConfig.traceOutput) {
+        profiler.trace = fopen(appConfig.traceOutput, "w");
+        if (profiler.trace) {
+            fprintf(profiler.trace, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+            fprintf(profiler.trace, "{\"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"name\": \"thread_name\", \"args\": {\"name\": \"CPU\"}},\n");
+            fprintf(profiler.trace, "{\"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"name\": \"thread_name\", \"args\": {\"name\": \"GPU\"}}");
+            profiler.traceHasEvents = true;
+        } else {
+            SDL_Log("Cannot open trace file %s", appConfig.traceOutput);
+        }
+    }
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(vkContext.physicalDevice, &props);
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(vkContext.physicalDevice, &familyCount, NULL);
+    VkQueueFamilyProperties* families = malloc(sizeof(VkQueueFamilyProperties) * familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(vkContext.physicalDevice, &familyCount, families);
+    // Timestamps are written on the graphics queue, which need not be family 0
+    uint32_t validBits = vkContext.graphicsFamily < familyCount
+                             ? families[vkContext.graphicsFamily].timestampValidBits : 0;
+    free(families);
+    if (validBits == 0 || props.limits.timestampPeriod <= 0.0f) {
+        SDL_Log("Timestamps unsupported on this queue, GPU scopes will be missing");
+        return;
+    }
+
+    VkQueryPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = MAX_FRAMES_IN_FLIGHT * PROFILER_MAX_GPU_SCOPES * 2;
+    vkCreateQueryPool(vkContext.device, &poolInfo, NULL, &profiler.queryPool);
+    profiler.timestampPeriod = props.limits.timestampPeriod;
+    profiler.timestampMask = validBits >= 64 ? UINT64_MAX : (1ull << validBits) - 1;
+}
+
+static void profilerShutdown(void) {
+    if (profiler.trace) {
+        fprintf(profiler.trace, "\n]}\n");
+        fclose(profiler.trace);
+        profiler.trace = NULL;
+        SDL_Log("Wrote trace to %s", appConfig.traceOutput);
+    }
+}
+
+static ProfilerSeries* profilerSeries(const char* name) {
+    // Scope names are string literals, so pointer equality is the common case
+    for (uint32_t i = 0; i < profiler.seriesCount; i++) {
+        if (profiler.series[i].name == name || strcmp(profiler.series[i].name, name) == 0) {
+            return &profiler.series[i];
+        }
+    }
+    if (profiler.seriesCount == PROFILER_MAX_SERIES) {
+        return NULL;
+    }
+    ProfilerSeries* series = &profiler.series[profiler.seriesCount++];
+    series->name = name;
+    return series;
+}
+
+static void profilerRecord(const char* name, double ms) {
+    ProfilerSeries* series = profilerSeries(name);
+    if (series) {
+        series->samples[series->next] = ms;
+        series->next = (series->next + 1) % PROFILER_HISTORY;
+        if (series->count < PROFILER_HISTORY) {
+            series->count++;
+        }
+    }
+}
+
+static void profilerTraceEvent(const char* name, uint32_t drawIndex, int tid, double startUs, double durationUs) {
+    if (!profiler.trace) {
+        return;
+    }
+    if (drawIndex != UINT32_MAX) {
+        fprintf(profiler.trace, ",\n{\"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"name\": \"%s %u\", \"ts\": %.3f, \"dur\": %.3f}",
+                tid, name, drawIndex, startUs, durationUs);
+    } else {
+        fprintf(profiler.trace, ",\n{\"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"name\": \"%s\", \"ts\": %.3f, \"dur\": %.3f}",
+                tid, name, startUs, durationUs);
+    }
+}
+
+static Uint64 profilerBegin(void) {
+    return SDL_GetPerformanceCounter();
+}
+
+static void profilerEnd(const char* name, Uint64 start) {
+    Uint64 end = SDL_GetPerformanceCounter();
+    double ms = ticksToMs(end - start);
+    profilerRecord(name, ms);
+    profilerTraceEvent(name, UINT32_MAX, 1, ticksToMs(start - profiler.originTicks) * 1000.0, ms * 1000.0);
+}
+
+// Must be recorded outside a render pass, before any other scope of the frame
+static void profilerGpuBeginFrame(VkCommandBuffer cmd, uint32_t slot) {
+    GpuFrameQueries* queries = &profiler.gpuFrames[slot];
+    queries->scopeCount = 0;
+    queries->pending = false;
+    if (!profiler.queryPool) {
+        return;
+    }
+    vkCmdResetQueryPool(cmd, profiler.queryPool, slot * PROFILER_MAX_GPU_SCOPES * 2, PROFILER_MAX_GPU_SCOPES * 2);
+    queries->recordTicks = SDL_GetPerformanceCounter();
+    queries->frameIndex = frameCount;
+    queries->pending = true;
+}
+
+static uint32_t profilerGpuBegin(VkCommandBuffer cmd, uint32_t slot, const char* name, uint32_t drawIndex) {
+    GpuFrameQueries* queries = &profiler.gpuFrames[slot];
+    if (!profiler.queryPool || queries->scopeCount == PROFILER_MAX_GPU_SCOPES) {
+        return UINT32_MAX;
+    }
+    uint32_t scope = queries->scopeCount++;
+    queries->scopes[scope].name = name;
+    queries->scopes[scope].drawIndex = drawIndex;
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler.queryPool,
+                        (slot * PROFILER_MAX_GPU_SCOPES + scope) * 2);
+    return scope;
+}
+
+static void profilerGpuEnd(VkCommandBuffer cmd, uint32_t slot, uint32_t scope) {
+    if (scope == UINT32_MAX) {
+        return;
+    }
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler.queryPool,
+                        (slot * PROFILER_MAX_GPU_SCOPES + scope) * 2 + 1);
+}
+
+// Reads back the scopes of the frame that last used this slot. Call only once
+// the slot's fence has signaled; the query is not allowed to wait. Returns the
+// duration of the first scope (the whole frame) in ms, or -1 if unavailable.
+static double profilerResolveGpu(uint32_t slot) {
+    GpuFrameQueries* queries = &profiler.gpuFrames[slot];
+    if (!queries->pending || queries->scopeCount == 0) {
+        return -1.0;
+    }
+    queries->pending = false;
+
+    uint64_t timestamps[PROFILER_MAX_GPU_SCOPES * 2];
+    if (vkGetQueryPoolResults(vkContext.device, profiler.queryPool, slot * PROFILER_MAX_GPU_SCOPES * 2,
+                              queries->scopeCount * 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+        return -1.0;
+    }
+
+    // GPU and CPU clocks are not calibrated against each other, so GPU events
+    // are placed on the trace relative to the moment the frame was recorded
+    double baseUs = ticksToMs(queries->recordTicks - profiler.originTicks) * 1000.0;
+    uint64_t frameStart = timestamps[0];
+    double frameMs = -1.0;
+    for (uint32_t i = 0; i < queries->scopeCount; i++) {
+        const GpuScope* gpuScope = &queries->scopes[i];
+        uint64_t begin = timestamps[i * 2] & profiler.timestampMask;
+        uint64_t end = timestamps[i * 2 + 1] & profiler.timestampMask;
+        double ms = (double)((end - begin) & profiler.timestampMask) * profiler.timestampPeriod / 1e6;
+        if (i == 0) {
+            frameMs = ms;
+        }
+        if (gpuScope->drawIndex == UINT32_MAX) {
+            profilerRecord(gpuScope->name, ms);
+        }
+        double offsetUs = (double)((begin - frameStart) & profiler.timestampMask) * profiler.timestampPeriod / 1e3;
+        profilerTraceEvent(gpuScope->name, gpuScope->drawIndex, 2, baseUs + offsetUs, ms * 1000.0);
+    }
+    return frameMs;
+}
+
+// Rolling statistics over the last PROFILER_HISTORY samples of a scope
+static bool profilerGetStats(const char* name, ProfilerStats* stats) {
+    const ProfilerSeries* series = NULL;
+    for (uint32_t i = 0; i < profiler.seriesCount && !series; i++) {
+        if (strcmp(profiler.series[i].name, name) == 0) {
+            series = &profiler.series[i];
+        }
+    }
+    if (!series || series->count == 0) {
+        return false;
+    }
+
+    stats->samples = series->count;
+    stats->last = series->samples[(series->next + PROFILER_HISTORY - 1) % PROFILER_HISTORY];
+    stats->min = series->samples[0];
+    stats->max = series->samples[0];
+    double sum = 0.0;
+    for (uint32_t i = 0; i < series->count; i++) {
+        double sample = series->samples[i];
+        sum += sample;
+        stats->min = sample < stats->min ? sample : stats->min;
+        stats->max = sample > stats->max ? sample : stats->max;
+    }
+    stats->average = sum / series->count;
+    return true;
+}
+
+static void profilerLogStats(void) {
+    for (uint32_t i = 0; i < profiler.seriesCount; i++) {
+        ProfilerStats stats;
+        if (profilerGetStats(profiler.series[i].name, &stats)) {
+            SDL_Log("  %-16s avg %8.3f ms  min %8.3f  max %8.3f  (last %u)",
+                    profiler.series[i].name, stats.average, stats.min, stats.max, stats.samples);
+        }
+    }
+}
+
+static void shadingStatsInit(void) {
+    VkQueryPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    poolInfo.queryCount = MAX_FRAMES_IN_FLIGHT;
+    poolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+    if (vkCreateQueryPool(vkContext.device, &poolInfo, NULL, &shadingStats.pool) != VK_SUCCESS) {
+        shadingStats.pool = VK_NULL_HANDLE;
+    }
+}
+
+// Called after the slot's fence wait, so the result is available
+static void shadingStatsCollect(uint32_t slot) {
+    if (!shadingStats.pending[slot]) {
+        return;
+    }
+    shadingStats.pending[slot] = false;
+    uint64_t fragments = 0;
+    if (vkGetQueryPoolResults(vkContext.device, shadingStats.pool, slot, 1, sizeof(fragments), &fragments,
+                              sizeof(fragments), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+        shadingStats.fragmentTotal += fragments;
+        shadingStats.samples++;
+    }
+}
+
+static bool createVertexBuffer(void) {
+    VkDeviceSize size = sizeof(PackedVertex) * scene.vertexCount;
+    // Preferred rather than required: a scene too big for the device's budget
+    // can move to system memory. Allocation still fails when no heap has room.
+    if (!gpuCreateBuffer(size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                         0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vkContext.vertexBuffer)) {
+        SDL_Log("Out of GPU memory for %u vertices", scene.vertexCount);
+        return false;
+    }
+    if (!scene.vertices) {
+        streamerAddSection(&vkContext.vertexBuffer, SCENE_SECTION_VERTICES);
+    } else if (!stagingUpload(&vkContext.vertexBuffer, 0, scene.vertices, size)) {
+        SDL_Log("Failed to stage %u vertices", scene.vertexCount);
+        return false;
+    }
+    return true;
+}
+
+static bool createIndexBuffer(void) {
+    VkDeviceSize size = (VkDeviceSize)indexTypeSize(scene.indexType) * scene.indexCount;
+    if (!gpuCreateBuffer(size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                         0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vkContext.indexBuffer)) {
+        SDL_Log("Out of GPU memory for %u indices", scene.indexCount);
+        return false;
+    }
+    if (!scene.indices) {
+        streamerAddSection(&vkContext.indexBuffer, SCENE_SECTION_INDICES);
+    } else if (!stagingUpload(&vkContext.indexBuffer, 0, scene.indices, size)) {
+        SDL_Log("Failed to stage %u indices", scene.indexCount);
+        return false;
+    }
+
+    const float identity[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    if (!gpuCreateBuffer(sizeof(identity), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &vkContext.identityInstanceBuffer) ||
+        !stagingUpload(&vkContext.identityInstanceBuffer, 0, identity, sizeof(identity))) {
+        SDL_Log("Out of GPU memory for the identity instance");
+        return false;
+    }
+    return true;
+}
+
+static void mat4Identity(Mat4* out) {
+    memset(out, 0, sizeof(*out));
+    out->m[0] = out->m[5] = out->m[10] = out->m[15] = 1.0f;
+}
+
+static void mat4Translation(Mat4* out, float x, float y, float z) {
+    mat4Identity(out);
+    out->m[12] = x;
+    out->m[13] = y;
+    out->m[14] = z;
+}
+
+static void mat4RotationY(Mat4* out, float angle) {
+    float c = cosf(angle);
+    float s = sinf(angle);
+    mat4Identity(out);
+    out->m[0] = c;
+    out->m[2] = -s;
+    out->m[8] = s;
+    out->m[10] = c;
+}
+
+// Right-handed view space to Vulkan clip space: y points down and depth runs
+// from 0 at zNear to 1 at zFar
+static void mat4Perspective(Mat4* out, float fovY, float aspect, float zNear, float zFar) {
+    float f = 1.0f / tanf(fovY * 0.5f);
+    memset(out, 0, sizeof(*out));
+    out->m[0] = f / aspect;
+    out->m[5] = -f;
+    out->m[10] = zFar / (zNear - zFar);
+    out->m[11] = -1.0f;
+    out->m[14] = zNear * zFar / (zNear - zFar);
+}
+
+static void mat4LookAt(Mat4* out, const float eye[3], const float target[3], const float up[3]) {
+    float f[3] = {target[0] - eye[0], target[1] - eye[1], target[2] - eye[2]};
+    float length = sqrtf(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+    f[0] /= length;
+    f[1] /= length;
+    f[2] /= length;
+    float s[3] = {f[1] * up[2] - f[2] * up[1], f[2] * up[0] - f[0] * up[2], f[0] * up[1] - f[1] * up[0]};
+    length = sqrtf(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]);
+    s[0] /= length;
+    s[1] /= length;
+    s[2] /= length;
+    float u[3] = {s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2], s[0] * f[1] - s[1] * f[0]};
+
+    mat4Identity(out);
+    for (int i = 0; i < 3; i++) {
+        out->m[i * 4 + 0] = s[i];
+        out->m[i * 4 + 1] = u[i];
+        out->m[i * 4 + 2] = -f[i];
+    }
+    out->m[12] = -(s[0] * eye[0] + s[1] * eye[1] + s[2] * eye[2]);
+    out->m[13] = -(u[0] * eye[0] + u[1] * eye[1] + u[2] * eye[2]);
+    out->m[14] = f[0] * eye[0] + f[1] * eye[1] + f[2] * eye[2];
+}
+
+// out = a * b. out may alias either input. Column j of the result is a's
+// columns weighted by column j of b, which maps onto four broadcasts and
+// multiply-adds per column with SSE.
+static void mat4Multiply(Mat4* out, const Mat4* a, const Mat4* b) {
+#ifdef MATH_SSE
+    __m128 a0 = _mm_loadu_ps(&a->m[0]);
+    __m128 a1 = _mm_loadu_ps(&a->m[4]);
+    __m128 a2 = _mm_loadu_ps(&a->m[8]);
+    __m128 a3 = _mm_loadu_ps(&a->m[12]);
+    for (int j = 0; j < 4; j++) {
+        __m128 column = _mm_loadu_ps(&b->m[j * 4]);
+        __m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(column, column, _MM_SHUFFLE(0, 0, 0, 0)));
+        r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(column, column, _MM_SHUFFLE(1, 1, 1, 1))));
+        r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(column, column, _MM_SHUFFLE(2, 2, 2, 2))));
+        r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(column, column, _MM_SHUFFLE(3, 3, 3, 3))));
+        _mm_storeu_ps(&out->m[j * 4], r);
+    }
+#else
+    Mat4 result;
+    for (int j = 0; j < 4; j++) {
+        for (int i = 0; i < 4; i++) {
+            result.m[j * 4 + i] = a->m[i] * b->m[j * 4] + a->m[4 + i] * b->m[j * 4 + 1] +
+                                  a->m[8 + i] * b->m[j * 4 + 2] + a->m[12 + i] * b->m[j * 4 + 3];
+        }
+    }
+    *out = result;
+#endif
+}
+
+// out[i] = a[i] * b[i]. Results are written outStride bytes apart, so they can
+// go straight into aligned uniform slices of mapped memory.
+static void mat4MultiplyBatch(void* out, size_t outStride, const Mat4* a, const Mat4* b, uint32_t count) {
+    uint8_t* dst = out;
+    for (uint32_t i = 0; i < count; i++) {
+        mat4Multiply((Mat4*)(dst + i * outStride), &a[i], &b[i]);
+    }
+}
+
+// Gribb/Hartmann plane extraction for Vulkan's clip volume: -w <= x, y <= w
+// and 0 <= z <= w. Planes are in whatever space m maps from.
+static void mat4FrustumPlanes(const Mat4* m, float planes[6][4]) {
+    for (int i = 0; i < 4; i++) {
+        float r0 = m->m[i * 4 + 0];
+        float r1 = m->m[i * 4 + 1];
+        float r2 = m->m[i * 4 + 2];
+        float r3 = m->m[i * 4 + 3];
+        planes[0][i] = r3 + r0;
+        planes[1][i] = r3 - r0;
+        planes[2][i] = r3 + r1;
+        planes[3][i] = r3 - r1;
+        planes[4][i] = r2;
+        planes[5][i] = r3 - r2;
+    }
+    for (int p = 0; p < 6; p++) {
+        float length = sqrtf(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+        for (int i = 0; i < 4; i++) {
+            planes[p][i] /= length;
+        }
+    }
+}
+
+// out[i] = m * in[i] for points (w = 1) or directions (w = 0)
+static void vec4TransformBatch(float (*out)[4], const Mat4* m, const float (*in)[4], uint32_t count) {
+#ifdef MATH_SSE
+    __m128 c0 = _mm_loadu_ps(&m->m[0]);
+    __m128 c1 = _mm_loadu_ps(&m->m[4]);
+    __m128 c2 = _mm_loadu_ps(&m->m[8]);
+    __m128 c3 = _mm_loadu_ps(&m->m[12]);
+    for (uint32_t i = 0; i < count; i++) {
+        __m128 v = _mm_loadu_ps(in[i]);
+        __m128 r = _mm_mul_ps(c0, _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)));
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2))));
+        r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))));
+        _mm_storeu_ps(out[i], r);
+    }
+#else
+    for (uint32_t i = 0; i < count; i++) {
+        for (int r = 0; r < 4; r++) {
+            out[i][r] = m->m[r] * in[i][0] + m->m[4 + r] * in[i][1] + m->m[8 + r] * in[i][2] + m->m[12 + r] * in[i][3];
+        }
+    }
+#endif
+}
+
+// The grid of rooms fills [-1, 1] on x and y with the open sides facing +z.
+// The camera looks at it from a slow side-to-side orbit.
+static void cameraUpdate(double seconds) {
+    float yaw = 0.35f * sinf((float)seconds * 0.25f);
+    const float distance = 1.9f;
+    const float target[3] = {0.0f, 0.0f, 0.0f};
+    const float up[3] = {0.0f, 1.0f, 0.0f};
+    float eye[3] = {distance * sinf(yaw), 0.3f, distance * cosf(yaw)};
+    float aspect = (float)vkContext.extent.width / (float)SDL_max(vkContext.extent.height, 1u);
+
+    Mat4 proj;
+    Mat4 previous = camera.viewProj;
+    mat4LookAt(&camera.view, eye, target, up);
+    mat4Perspective(&proj, 1.0471976f /* 60 degrees */, aspect, 0.1f, 10.0f);
+    mat4Multiply(&camera.viewProj, &proj, &camera.view);
+    // The matrix is a push constant in the cached draws
+    camera.moved = memcmp(&previous, &camera.viewProj, sizeof(Mat4)) != 0;
+    if (camera.moved) {
+        commandCacheInvalidate();
+    }
+    mat4FrustumPlanes(&camera.viewProj, camera.planes);
+    memcpy(camera.eye, eye, sizeof(eye));
+    // proj.m[5] is 1 / tan(fovY / 2); half the viewport height spans that much
+    camera.projScale = proj.m[5] * 0.5f * (float)vkContext.extent.height;
+}
+
+// Coarsest level whose error, projected at screenRadius pixels, stays under
+// LOD_PIXEL_ERROR. Going coarser than the current level needs the hysteresis
+// margin on top. Matches selectLod in shaders/cull.comp.
+static uint32_t selectLod(const SceneMesh* mesh, float screenRadius, uint32_t current) {
+    uint32_t level = 0;
+    for (uint32_t l = 1; l < mesh->lodCount; l++) {
+        float limit = l > current ? LOD_PIXEL_ERROR * (1.0f - LOD_HYSTERESIS) : LOD_PIXEL_ERROR;
+        if (mesh->lods[l].error * screenRadius > limit) {
+            break;
+        }
+        level = l;
+    }
+    return level;
+}
+
+static bool lodInit(void) {
+    if (scene.drawCount == 0) {
+        return true;
+    }
+    lodState.drawLevels = calloc(scene.drawCount, sizeof(uint8_t));
+    lodState.centers = malloc(sizeof(float) * 4 * scene.drawCount);
+    lodState.viewCenters = malloc(sizeof(float) * 4 * scene.drawCount);
+    if (!lodState.drawLevels || !lodState.centers || !lodState.viewCenters) {
+        SDL_Log("Out of memory for %u draws' LOD state", scene.drawCount);
+        return false;
+    }
+    for (uint32_t i = 0; i < scene.drawCount; i++) {
+        memcpy(lodState.centers[i], scene.draws[i].sphere, sizeof(float) * 3);
+        lodState.centers[i][3] = 1.0f;
+    }
+    return true;
+}
+
+static void lodDestroy(void) {
+    free(lodState.drawLevels);
+    free(lodState.centers);
+    free(lodState.viewCenters);
+}
+
+// Per-draw path: moves every draw's center into view space in one batch, then
+// picks each draw's level from its projected radius. Runs after cameraUpdate.
+static void lodUpdate(void) {
+    if (scene.drawCount == 0 || !sceneResident) {
+        return;
+    }
+    if (lodState.settled && !camera.moved) {
+        lodState.triangleTotal += lodState.triangles;
+        lodState.samples++;
+        return;
+    }
+    if (appConfig.lod) {
+        vec4TransformBatch(lodState.viewCenters, &camera.view, (const float (*)[4])lodState.centers, scene.drawCount);
+    }
+    uint64_t triangles = 0;
+    bool changed = false;
+    for (uint32_t i = 0; i < scene.drawCount; i++) {
+        const SceneDraw* draw = &scene.draws[i];
+        const SceneMesh* mesh = &scene.meshes[draw->mesh];
+        if (appConfig.lod) {
+            const float* v = lodState.viewCenters[i];
+            float distance = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+            // Inside the bounding sphere the object can cover the whole screen
+            float screenRadius = distance > draw->sphere[3] ? draw->sphere[3] / distance * camera.projScale : FLT_MAX;
+            uint8_t level = (uint8_t)selectLod(mesh, screenRadius, lodState.drawLevels[i]);
+            changed |= level != lodState.drawLevels[i];
+            lodState.drawLevels[i] = level;
+        }
+        triangles += mesh->lods[lodState.drawLevels[i]].indexCount / 3;
+    }
+    // Index ranges are baked into the cached draws
+    if (changed) {
+        commandCacheInvalidate();
+    }
+    lodState.settled = !changed;
+    lodState.triangles = triangles;
+    lodState.triangleTotal += triangles;
+    lodState.samples++;
+}
+
+// Sizes the ring for one frame more than can be in flight. Every frame takes
+// the same number of slices, so wrapping never strands a partial frame.
+static bool uniformsInit(void) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(vkContext.physicalDevice, &properties);
+    VkDeviceSize alignment = SDL_max(properties.limits.minUniformBufferOffsetAlignment, 16);
+    frameUniforms.objectStride = alignUp(sizeof(ObjectUniforms), alignment);
+    frameUniforms.objectCount = SDL_max(scene.drawCount, 1u);
+
+    VkDeviceSize frameSize = frameUniforms.objectStride * frameUniforms.objectCount;
+    if (!gpuRingCreate(&frameUniforms.ring, frameSize * (vkContext.framesInFlight + 1),
+                       VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)) {
+        SDL_Log("Out of host-visible memory for %u objects' uniforms", frameUniforms.objectCount);
+        return false;
+    }
+
+    VkDescriptorPoolSize poolSize = {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1};
+    VkDescriptorPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    poolInfo.maxSets = 1;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    vkCreateDescriptorPool(vkContext.device, &poolInfo, NULL, &frameUniforms.descriptorPool);
+
+    VkDescriptorSetAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+    allocInfo.descriptorPool = frameUniforms.descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &frameUniforms.setLayout;
+    vkAllocateDescriptorSets(vkContext.device, &allocInfo, &frameUniforms.set);
+
+    // The descriptor covers one object; the dynamic offset picks which
+    VkDescriptorBufferInfo bufferInfo = {frameUniforms.ring.buffer.buffer, 0, sizeof(ObjectUniforms)};
+    VkWriteDescriptorSet write = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+    write.dstSet = frameUniforms.set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    write.pBufferInfo = &bufferInfo;
+    vkUpdateDescriptorSets(vkContext.device, 1, &write, 0, NULL);
+
+    ObjectAnimation* animation = &frameUniforms.animation;
+    animation->count = scene.drawCount;
+    if (animation->count > 0) {
+        animation->toPivot = malloc(sizeof(Mat4) * animation->count);
+        animation->fromPivot = malloc(sizeof(Mat4) * animation->count);
+        animation->rotation = malloc(sizeof(Mat4) * animation->count);
+        animation->swayed = malloc(sizeof(Mat4) * animation->count);
+        animation->phase = malloc(sizeof(float) * animation->count);
+        for (uint32_t i = 0; i < animation->count; i++) {
+            const float* center = scene.draws[i].sphere;
+            mat4Translation(&animation->toPivot[i], center[0], center[1], center[2]);
+            mat4Translation(&animation->fromPivot[i], -center[0], -center[1], -center[2]);
+            animation->phase[i] = (float)i * 0.37f;
+        }
+    }
+
+    SDL_Log("Object uniforms: %u object(s), %u-byte slices, %.2f MiB ring", frameUniforms.objectCount,
+            (uint32_t)frameUniforms.objectStride, (double)frameUniforms.ring.buffer.size / (1024.0 * 1024.0));
+    return true;
+}
+
+static void uniformsDestroy(void) {
+    ObjectAnimation* animation = &frameUniforms.animation;
+    free(animation->toPivot);
+    free(animation->fromPivot);
+    free(animation->rotation);
+    free(animation->swayed);
+    free(animation->phase);
+    vkDestroyDescriptorPool(vkContext.device, frameUniforms.descriptorPool, NULL);
+    vkDestroyDescriptorSetLayout(vkContext.device, frameUniforms.setLayout, NULL);
+    gpuDestroyBuffer(&frameUniforms.ring.buffer);
+}
+
+// Writes this frame's object matrices into a fresh ring slice. Called while
+// recording, after the slot's fence wait has released its previous slices.
+static void uniformsUpdate(uint32_t slot, double seconds) {
+    if (frameUniforms.frozen) {
+        return;
+    }
+    VkDeviceSize frameSize = frameUniforms.objectStride * frameUniforms.objectCount;
+    VkDeviceSize offset;
+    if (!gpuRingAlloc(&frameUniforms.ring, frameSize, frameUniforms.objectStride, &offset)) {
+        // Cannot happen with the ring sized in uniformsInit; keep drawing last frame's data
+        SDL_Log("Uniform ring full");
+        return;
+    }
+    frameUniforms.frameBase = offset;
+    uint8_t* dst = (uint8_t*)frameUniforms.ring.buffer.allocation.mapped + offset;
+
+    ObjectAnimation* animation = &frameUniforms.animation;
+    if (animation->count > 0) {
+        for (uint32_t i = 0; i < animation->count; i++) {
+            mat4RotationY(&animation->rotation[i], 0.6f * sinf((float)seconds + animation->phase[i]));
+        }
+        // model = T(center) * R * T(-center)
+        mat4MultiplyBatch(animation->swayed, sizeof(Mat4), animation->toPivot, animation->rotation, animation->count);
+        mat4MultiplyBatch(dst, (size_t)frameUniforms.objectStride, animation->swayed, animation->fromPivot,
+                          animation->count);
+    } else {
+        mat4Identity((Mat4*)dst);
+    }
+    gpuFlush(&frameUniforms.ring.buffer.allocation, offset, frameSize);
+    // The offsets are baked into the cached draws
+    commandCacheInvalidate();
+
+    // A static scene's matrices never change, so its first slice serves every frame
+    if (appConfig.staticScene) {
+        frameUniforms.frozen = true;
+        return;
+    }
+    frameUniforms.releaseMarkers[slot] = frameUniforms.ring.head;
+    frameUniforms.releasePending[slot] = true;
+}
+
+// Called after the slot's fence wait
+static void uniformsRelease(uint32_t slot) {
+    if (frameUniforms.releasePending[slot]) {
+        gpuRingRelease(&frameUniforms.ring, frameUniforms.releaseMarkers[slot]);
+        frameUniforms.releasePending[slot] = false;
+    }
+}
+
+static void bindFrameUniforms(VkCommandBuffer cmd, uint32_t object) {
+    uint32_t offset = (uint32_t)(frameUniforms.frameBase + frameUniforms.objectStride * object);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, vkContext.pipelineLayout, 0, 1,
+                            &frameUniforms.set, 1, &offset);
+}
+
+// Overlay menu items, in MenuList order
+enum { UI_ITEM_RESUME, UI_ITEM_PRESENT_MODE, UI_ITEM_QUIT, UI_ITEM_COUNT };
+static const char* uiItemTexts[UI_ITEM_COUNT] = {"Resume", "Present mode", "Quit"};
+
+// Only printable ASCII is rasterized; every other byte, including each byte
+// of a UTF-8 sequence, draws as '?'
+static const UiGlyph* uiGlyph(unsigned char c) {
+    if (c < UI_FIRST_GLYPH || c >= UI_FIRST_GLYPH + UI_GLYPH_COUNT) {
+        c = '?';
+    }
+    return &ui.glyphs[c - UI_FIRST_GLYPH];
+}
+
+static int uiMeasure(void* context, const char* text) {
+    int width = 0;
+    for (; *text; text++) {
+        width += uiGlyph((unsigned char)*text)->advance;
+    }
+    return width;
+}
+
+// Rasterizes the glyphs into a one-byte coverage atlas. Glyphs are packed on
+// shelves after the solid block at the origin. Returns the atlas pixels.
+static uint8_t* uiRasterizeGlyphs(void) {
+    uint8_t* pixels = calloc(UI_ATLAS_SIZE * UI_ATLAS_SIZE, 1);
+    for (int y = 0; y < UI_WHITE_SIZE; y++) {
+        memset(&pixels[y * UI_ATLAS_SIZE], 0xFF, UI_WHITE_SIZE);
+    }
+
+    int shelfX = UI_WHITE_SIZE + 1;
+    int shelfY = 0;
+    int shelfHeight = UI_WHITE_SIZE;
+    for (int i = 0; i < UI_GLYPH_COUNT; i++) {
+        Uint32 codepoint = UI_FIRST_GLYPH + i;
+        UiGlyph* glyph = &ui.glyphs[i];
+        int minx, maxx, miny, maxy;
+        if (TTF_GlyphMetrics32(ui.font, codepoint, &minx, &maxx, &miny, &maxy, &glyph->advance) < 0) {
+            continue;
+        }
+
+        // As in SDL3_menu.cpp, the bitmap starts at the pen position and spans
+        // the line height, so bearing and baseline are already baked in
+        SDL_Surface* surface = TTF_RenderGlyph32_Blended(ui.font, codepoint, (SDL_Color){255, 255, 255, 255});
+        SDL_Surface* converted = surface ? SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888) : NULL;
+        if (converted && converted->w > 0 && converted->h > 0) {
+            if (shelfX + converted->w > UI_ATLAS_SIZE) {
+                shelfX = 0;
+                shelfY += shelfHeight + 1;
+                shelfHeight = 0;
+            }
+            if (converted->w <= UI_ATLAS_SIZE && shelfY + converted->h <= UI_ATLAS_SIZE) {
+                glyph->src = (SDL_Rect){shelfX, shelfY, converted->w, converted->h};
+                for (int y = 0; y < converted->h; y++) {
+                    const Uint32* row = (const Uint32*)((const uint8_t*)converted->pixels + y * converted->pitch);
+                    for (int x = 0; x < converted->w; x++) {
+                        pixels[(shelfY + y) * UI_ATLAS_SIZE + shelfX + x] = (uint8_t)(row[x] >> 24);
+                    }
+                }
+                shelfX += converted->w + 1;
+                shelfHeight = SDL_max(shelfHeight, converted->h);
+            } else {
+                SDL_Log("Overlay atlas full, '%c' will not be drawn", (char)codepoint);
+            }
+        }
+        SDL_FreeSurface(converted);
+        SDL_FreeSurface(surface);
+    }
+    return pixels;
+}
+
+// Creates the atlas image and uploads it with a one-off submit on the staging
+// command buffer, which is idle once the geometry upload has finished
+static bool uiUploadAtlas(const uint8_t* pixels) {
+    VkImageCreateInfo imageInfo = {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = VK_FORMAT_R8_UNORM;
+    imageInfo.extent = (VkExtent3D){UI_ATLAS_SIZE, UI_ATLAS_SIZE, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    vkCreateImage(vkContext.device, &imageInfo, NULL, &ui.atlasImage);
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(vkContext.device, ui.atlasImage, &memRequirements);
+    if (!gpuAlloc(&memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, GPU_RESOURCE_IMAGE, &ui.atlasMemory)) {
+        SDL_Log("Out of GPU memory for the overlay atlas");
+        return false;
+    }
+    vkBindImageMemory(vkContext.device, ui.atlasImage, ui.atlasMemory.block->memory, ui.atlasMemory.offset);
+
+    VkImageViewCreateInfo viewInfo = {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
+    viewInfo.image = ui.atlasImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_R8_UNORM;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.layerCount = 1;
+    vkCreateImageView(vkContext.device, &viewInfo, NULL, &ui.atlasView);
+
+    VkDeviceSize size = UI_ATLAS_SIZE * UI_ATLAS_SIZE;
+    GpuBuffer upload = {0};
+    if (!gpuCreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, 0, &upload)) {
+        return false;
+    }
+    memcpy(upload.allocation.mapped, pixels, (size_t)size);
+    gpuFlush(&upload.allocation, 0, size);
+
+    VkCommandBuffer cmd = stagingUploader.commandBuffer;
+    VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(cmd, &beginInfo);
+
+    VkImageMemoryBarrier barrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = ui.atlasImage;
+    barrier.subresourceRange = viewInfo.subresourceRange;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, NULL, 0, NULL, 1, &barrier);
+
+    VkBufferImageCopy region = {0};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = imageInfo.extent;
+    vkCmdCopyBufferToImage(cmd, upload.buffer, ui.atlasImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         0, 0, NULL, 0, NULL, 1, &barrier);
+    vkEndCommandBuffer(cmd);
+
+    VkSubmitInfo submitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+    vkQueueSubmit(vkContext.graphicsQueue, 1, &submitInfo, stagingUploader.fence);
+    vkWaitForFences(vkContext.device, 1, &stagingUploader.fence, VK_TRUE, UINT64_MAX);
+    vkResetFences(vkContext.device, 1, &stagingUploader.fence);
+    vkResetCommandBuffer(cmd, 0);
+    gpuDestroyBuffer(&upload);
+    return true;
+}
+
+// Set 0 samples the atlas; the push constant maps pixels to clip space
+static bool uiCreatePipeline(void) {
+    VkSamplerCreateInfo samplerInfo = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    vkCreateSampler(vkContext.device, &samplerInfo, NULL, &ui.sampler);
+
+    VkDescriptorSetLayoutBinding atlasBinding = {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1,
+                                                 VK_SHADER_STAGE_FRAGMENT_BIT, NULL};
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    setLayoutInfo.bindingCount = 1;
+    setLayoutInfo.pBindings = &atlasBinding;
+    vkCreateDescriptorSetLayout(vkContext.device, &setLayoutInfo, NULL, &ui.setLayout);
+
+    VkDescriptorPoolSize poolSize = {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1};
+    VkDescriptorPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    poolInfo.maxSets = 1;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    vkCreateDescriptorPool(vkContext.device, &poolInfo, NULL, &ui.descriptorPool);
+
+    VkDescriptorSetAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+    allocInfo.descriptorPool = ui.descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &ui.setLayout;
+    vkAllocateDescriptorSets(vkContext.device, &allocInfo, &ui.set);
+
+    VkDescriptorImageInfo imageInfo = {ui.sampler, ui.atlasView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    VkWriteDescriptorSet write = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+    write.dstSet = ui.set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(vkContext.device, 1, &write, 0, NULL);
+
+    VkPushConstantRange pushRange = {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(float) * 2};
+    VkPipelineLayoutCreateInfo layoutInfo = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &ui.setLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+    vkCreatePipelineLayout(vkContext.device, &layoutInfo, NULL, &ui.pipelineLayout);
+
+    VkShaderModule vertModule = createShaderModule(uiVertSpv, sizeof(uiVertSpv));
+    VkShaderModule fragModule = createShaderModule(uiFragSpv, sizeof(uiFragSpv));
+    VkPipelineShaderStageCreateInfo stages[2] = {
+        {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO},
+        {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO},
+    };
+    stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stages[0].module = vertModule;
+    stages[0].pName = "main";
+    stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[1].module = fragModule;
+    stages[1].pName = "main";
+
+    VkVertexInputBindingDescription binding = {0, sizeof(UiVertex), VK_VERTEX_INPUT_RATE_VERTEX};
+    VkVertexInputAttributeDescription attributes[3] = {
+        {0, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(UiVertex, pos)},
+        {1, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(UiVertex, uv)},
+        {2, 0, VK_FORMAT_R8G8B8A8_UNORM, offsetof(UiVertex, color)},
+    };
+    VkPipelineVertexInputStateCreateInfo vertexInput = {VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
+    vertexInput.vertexBindingDescriptionCount = 1;
+    vertexInput.pVertexBindingDescriptions = &binding;
+    vertexInput.vertexAttributeDescriptionCount = 3;
+    vertexInput.pVertexAttributeDescriptions = attributes;
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly = {VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO};
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkPipelineViewportStateCreateInfo viewportState = {VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO};
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+    VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo dynamicState = {VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO};
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer = {VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO};
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.cullMode = VK_CULL_MODE_NONE;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizer.lineWidth = 1.0f;
+
+    VkPipelineMultisampleStateCreateInfo multisampling = {VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO};
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    // Drawn over the finished scene, so depth is neither tested nor written
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO};
+
+    VkPipelineColorBlendAttachmentState blendAttachment = {0};
+    blendAttachment.blendEnable = VK_TRUE;
+    blendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    blendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    blendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    blendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    blendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    blendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+    blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                                     VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    VkPipelineColorBlendStateCreateInfo colorBlending = {VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO};
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &blendAttachment;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = {VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO};
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = stages;
+    pipelineInfo.pVertexInputState = &vertexInput;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = ui.pipelineLayout;
+    pipelineInfo.renderPass = vkContext.renderPass;
+    pipelineInfo.subpass = appConfig.depthPrepass ? 1 : 0;
+    VkResult result = vkCreateGraphicsPipelines(vkContext.device, vkContext.pipelineCache, 1, &pipelineInfo, NULL,
+                                                &ui.pipeline);
+    vkDestroyShaderModule(vkContext.device, fragModule, NULL);
+    vkDestroyShaderModule(vkContext.device, vertModule, NULL);
+    if (result != VK_SUCCESS) {
+        SDL_Log("Failed to create overlay pipeline");
+        return false;
+    }
+    return true;
+}
+
+// A missing font only disables the overlay; GPU failures stop startup
+static bool uiInit(void) {
+    if (TTF_Init() < 0) {
+        SDL_Log("TTF initialization failed: %s", TTF_GetError());
+        return true;
+    }
+    ui.font = TTF_OpenFont(appConfig.fontPath, UI_FONT_SIZE);
+    if (!ui.font) {
+        SDL_Log("Overlay font %s: %s, overlay disabled", appConfig.fontPath, TTF_GetError());
+        TTF_Quit();
+        return true;
+    }
+
+    uint8_t* pixels = uiRasterizeGlyphs();
+    bool ok = uiUploadAtlas(pixels);
+    free(pixels);
+    if (!ok || !uiCreatePipeline()) {
+        return false;
+    }
+
+    // Written by the CPU every frame and read once by the GPU, so the
+    // vertices go straight into mapped memory with no staging copy
+    VkDeviceSize slotSize = sizeof(UiVertex) * 4 * UI_MAX_QUADS;
+    VkDeviceSize indexSize = sizeof(uint16_t) * 6 * UI_MAX_QUADS;
+    if (!gpuCreateBuffer(slotSize * vkContext.framesInFlight, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &ui.vertexBuffer) ||
+        !gpuCreateBuffer(indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &ui.indexBuffer)) {
+        SDL_Log("Out of host-visible memory for the overlay");
+        return false;
+    }
+    uint16_t* indices = ui.indexBuffer.allocation.mapped;
+    for (uint32_t i = 0; i < UI_MAX_QUADS; i++) {
+        uint16_t base = (uint16_t)(i * 4);
+        uint16_t quad[6] = {base, (uint16_t)(base + 1), (uint16_t)(base + 2),
+                            (uint16_t)(base + 2), (uint16_t)(base + 3), base};
+        memcpy(&indices[i * 6], quad, sizeof(quad));
+    }
+    gpuFlush(&ui.indexBuffer.allocation, 0, indexSize);
+
+    if (!listInit(&ui.list, uiItemTexts, UI_ITEM_COUNT, 0, TTF_FontHeight(ui.font), UI_ROW_SPACING,
+                  uiMeasure, NULL)) {
+        return false;
+    }
+    ui.mouseX = -1.0f;
+    ui.mouseY = -1.0f;
+    ui.enabled = true;
+    ui.visible = true;
+    SDL_Log("Overlay: %s at %d px in a %dx%d atlas, up to %d quads per frame in one draw",
+            appConfig.fontPath, UI_FONT_SIZE, UI_ATLAS_SIZE, UI_ATLAS_SIZE, UI_MAX_QUADS);
+    return true;
+}
+
+static void uiDestroy(void) {
+    listDestroy(&ui.list);
+    gpuDestroyBuffer(&ui.indexBuffer);
+    gpuDestroyBuffer(&ui.vertexBuffer);
+    vkDestroyPipeline(vkContext.device, ui.pipeline, NULL);
+    vkDestroyPipelineLayout(vkContext.device, ui.pipelineLayout, NULL);
+    vkDestroyDescriptorPool(vkContext.device, ui.descriptorPool, NULL);
+    vkDestroyDescriptorSetLayout(vkContext.device, ui.setLayout, NULL);
+    vkDestroySampler(vkContext.device, ui.sampler, NULL);
+    vkDestroyImageView(vkContext.device, ui.atlasView, NULL);
+    vkDestroyImage(vkContext.device, ui.atlasImage, NULL);
+    gpuFree(&ui.atlasMemory);
+    if (ui.font) {
+        TTF_CloseFont(ui.font);
+        TTF_Quit();
+    }
+}
+
+// Appends one quad, cut to clip when given. The texture window shrinks with
+// it so clipped text is cropped rather than squashed.
+static void uiQuad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1,
+                   const uint8_t color[4], const SDL_Rect* clip) {
+    if (clip) {
+        float cx0 = (float)clip->x;
+        float cy0 = (float)clip->y;
+        float cx1 = (float)(clip->x + clip->w);
+        float cy1 = (float)(clip->y + clip->h);
+        if (x0 >= cx1 || x1 <= cx0 || y0 >= cy1 || y1 <= cy0) {
+            return;
+        }
+        float du = (u1 - u0) / (x1 - x0);
+        float dv = (v1 - v0) / (y1 - y0);
+        if (x0 < cx0) {
+            u0 += (cx0 - x0) * du;
+            x0 = cx0;
+        }
+        if (x1 > cx1) {
+            u1 -= (x1 - cx1) * du;
+            x1 = cx1;
+        }
+        if (y0 < cy0) {
+            v0 += (cy0 - y0) * dv;
+            y0 = cy0;
+        }
+        if (y1 > cy1) {
+            v1 -= (y1 - cy1) * dv;
+            y1 = cy1;
+        }
+    }
+    if (ui.quadCount == UI_MAX_QUADS) {
+        ui.droppedQuads++;
+        return;
+    }
+    UiVertex* quad = &ui.vertices[ui.quadCount++ * 4];
+    quad[0] = (UiVertex){{x0, y0}, {u0, v0}, {color[0], color[1], color[2], color[3]}};
+    quad[1] = (UiVertex){{x1, y0}, {u1, v0}, {color[0], color[1], color[2], color[3]}};
+    quad[2] = (UiVertex){{x1, y1}, {u1, v1}, {color[0], color[1], color[2], color[3]}};
+    quad[3] = (UiVertex){{x0, y1}, {u0, v1}, {color[0], color[1], color[2], color[3]}};
+}
+
+// Solid rects sample the middle of the white block
+static void uiRect(const SDL_Rect* rect, const uint8_t color[4]) {
+    float uv = UI_WHITE_SIZE * 0.5f / UI_ATLAS_SIZE;
+    uiQuad((float)rect->x, (float)rect->y, (float)(rect->x + rect->w), (float)(rect->y + rect->h),
+           uv, uv, uv, uv, color, NULL);
+}
+
+// (x, y) is the top-left of the line
+static void uiText(float x, float y, const char* text, const uint8_t color[4], const SDL_Rect* clip) {
+    for (; *text; text++) {
+        const UiGlyph* glyph = uiGlyph((unsigned char)*text);
+        if (glyph->src.w > 0) {
+            uiQuad(x, y, x + glyph->src.w, y + glyph->src.h,
+                   (float)glyph->src.x / UI_ATLAS_SIZE, (float)glyph->src.y / UI_ATLAS_SIZE,
+                   (float)(glyph->src.x + glyph->src.w) / UI_ATLAS_SIZE,
+                   (float)(glyph->src.y + glyph->src.h) / UI_ATLAS_SIZE, color, clip);
+        }
+        x += glyph->advance;
+    }
+}
+
+// Rebuilds the overlay's quads into the slot's part of the vertex buffer. The
+// slot's fence has been waited on, so the GPU is done with that part.
+static void uiBuild(uint32_t slot) {
+    ui.quadCount = 0;
+    if (!ui.enabled) {
+        return;
+    }
+    VkDeviceSize slotOffset = sizeof(UiVertex) * 4 * UI_MAX_QUADS * slot;
+    ui.vertices = (UiVertex*)((uint8_t*)ui.vertexBuffer.allocation.mapped + slotOffset);
+
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (ui.lastFrameTicks) {
+        double ms = ticksToMs(now - ui.lastFrameTicks);
+        ui.frameMs = ui.frameMs > 0.0 ? ui.frameMs * 0.95 + ms * 0.05 : ms;
+    }
+    ui.lastFrameTicks = now;
+    if (!ui.visible) {
+        return;
+    }
+
+    static const uint8_t panel[4] = {0, 0, 0, 160};
+    static const uint8_t white[4] = {255, 255, 255, 255};
+    static const uint8_t yellow[4] = {255, 255, 0, 255};
+
+    // The list follows the framebuffer size; the row under the mouse may move with it
+    int width = (int)vkContext.extent.width;
+    int height = (int)vkContext.extent.height;
+    SDL_Rect viewport = {0, height / 4, width, height - height / 4 - UI_LIST_MARGIN};
+    if (memcmp(&viewport, &ui.list.viewport, sizeof(viewport)) != 0) {
+        ui.list.viewport = viewport;
+        listScrollTo(&ui.list, ui.list.scrollY);
+        ui.list.hovered = listHitTest(&ui.list, ui.mouseX, ui.mouseY);
+    }
+
+    uiRect(&ui.list.viewport, panel);
+    SDL_Rect visible;
+    int first, last;
+    if (listVisibleRows(&ui.list, &ui.list.viewport, &visible, &first, &last)) {
+        for (int i = first; i <= last; i++) {
+            SDL_Rect rect = listItemRect(&ui.list, i);
+            uiText((float)rect.x, (float)rect.y, ui.list.texts[i], i == ui.list.hovered ? yellow : white, &visible);
+        }
+    }
+
+    // Wall-clock figures would make headless checksums differ from run to run
+    if (!vkContext.headless && ui.frameMs > 0.0) {
+        char line[64];
+        SDL_snprintf(line, sizeof(line), "%.1f fps  %.2f ms", 1000.0 / ui.frameMs, ui.frameMs);
+        uiText((float)UI_LIST_MARGIN, (float)UI_LIST_MARGIN, line, white, NULL);
+    }
+
+    if (ui.quadCount > 0) {
+        gpuFlush(&ui.vertexBuffer.allocation, slotOffset, sizeof(UiVertex) * 4 * ui.quadCount);
+    }
+    ui.quadTotal += ui.quadCount;
+    ui.samples++;
+}
+
+// The whole overlay is one indexed draw
+static void uiDraw(VkCommandBuffer cmd, uint32_t slot) {
+    if (ui.quadCount == 0) {
+        return;
+    }
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, ui.pipeline);
+    VkViewport viewport = {0.0f, 0.0f, (float)vkContext.extent.width, (float)vkContext.extent.height, 0.0f, 1.0f};
+    VkRect2D scissor = {{0, 0}, vkContext.extent};
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, ui.pipelineLayout, 0, 1, &ui.set, 0, NULL);
+    float scale[2] = {2.0f / vkContext.extent.width, 2.0f / vkContext.extent.height};
+    vkCmdPushConstants(cmd, ui.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(scale), scale);
+    VkDeviceSize offset = sizeof(UiVertex) * 4 * UI_MAX_QUADS * slot;
+    vkCmdBindVertexBuffers(cmd, 0, 1, &ui.vertexBuffer.buffer, &offset);
+    vkCmdBindIndexBuffer(cmd, ui.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
+    vkCmdDrawIndexed(cmd, ui.quadCount * 6, 1, 0, 0, 0);
+}
+
+// Escape shows and hides the overlay; a click on an item runs it. Choosing
+// Quit sets *quit.
+static void uiHandleEvent(const SDL_Event* event, bool* quit) {
+    if (!ui.enabled) {
+        return;
+    }
+    switch (event->type) {
+    case SDL_EVENT_KEY_DOWN:
+        if (event->key.keysym.sym == SDLK_ESCAPE) {
+            ui.visible = !ui.visible;
+            ui.list.hovered = ui.visible ? listHitTest(&ui.list, ui.mouseX, ui.mouseY) : -1;
+        }
+        break;
+    case SDL_EVENT_MOUSE_MOTION:
+        ui.mouseX = event->motion.x;
+        ui.mouseY = event->motion.y;
+        if (ui.visible) {
+            ui.list.hovered = listHitTest(&ui.list, ui.mouseX, ui.mouseY);
+        }
+        break;
+    case SDL_EVENT_MOUSE_WHEEL:
+        if (ui.visible &&
+            listScrollTo(&ui.list, ui.list.scrollY - (int)(event->wheel.y * ui.list.rowHeight * UI_WHEEL_ROWS))) {
+            ui.list.hovered = listHitTest(&ui.list, ui.mouseX, ui.mouseY);
+        }
+        break;
+    case SDL_EVENT_MOUSE_BUTTON_DOWN:
+        if (!ui.visible || event->button.button != SDL_BUTTON_LEFT) {
+            break;
+        }
+        switch (listHitTest(&ui.list, event->button.x, event->button.y)) {
+        case UI_ITEM_RESUME:
+            ui.visible = false;
+            ui.list.hovered = -1;
+            break;
+        case UI_ITEM_PRESENT_MODE:
+            if (!vkContext.headless) {
+                cyclePresentMode();
+            }
+            break;
+        case UI_ITEM_QUIT:
+            *quit = true;
+            break;
+        }
+        break;
+    }
+}
+
+static bool cullerInit(void) {
+    culler.commandCount = scene.meshCount * LOD_MAX_LEVELS;
+    VkDeviceSize instanceSize = sizeof(SceneInstance) * scene.instanceCount;
+    VkDeviceSize meshSize = sizeof(CullMesh) * scene.meshCount;
+    VkDeviceSize lodSize = sizeof(uint32_t) * scene.instanceCount;
+    VkDeviceSize drawSize = sizeof(VkDrawIndexedIndirectCommand) * culler.commandCount;
+    VkDeviceSize visibleSize = sizeof(float) * 4 * scene.instanceCount * LOD_MAX_LEVELS;
+
+    // Static inputs. Every level of a mesh gets its own command and its own
+    // range of the mesh's capacity in the visible buffer; unused levels keep
+    // an empty command that is drawn with zero instances.
+    CullMesh* meshes = calloc(scene.meshCount, sizeof(CullMesh));
+    VkDrawIndexedIndirectCommand* commands = calloc(culler.commandCount, sizeof(VkDrawIndexedIndirectCommand));
+    for (uint32_t i = 0; i < scene.meshCount; i++) {
+        const SceneMesh* mesh = &scene.meshes[i];
+        memcpy(meshes[i].sphere, mesh->sphere, sizeof(mesh->sphere));
+        meshes[i].lodCount = mesh->lodCount;
+        for (uint32_t l = 0; l < mesh->lodCount; l++) {
+            meshes[i].lodError[l] = mesh->lods[l].error;
+        }
+        for (uint32_t l = 0; l < LOD_MAX_LEVELS; l++) {
+            const SceneLod* lod = &mesh->lods[SDL_min(l, mesh->lodCount - 1)];
+            commands[i * LOD_MAX_LEVELS + l] = (VkDrawIndexedIndirectCommand){
+                lod->indexCount, 0, lod->firstIndex, mesh->vertexOffset,
+                mesh->firstInstance * LOD_MAX_LEVELS + (appConfig.lod ? l * mesh->instanceCount : 0)};
+        }
+    }
+    uint32_t* levels = calloc(SDL_max(scene.instanceCount, 1u), sizeof(uint32_t));
+    // Like the vertices, instances may end up in system memory on a full device
+    bool ok = gpuCreateBuffer(instanceSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &culler.instanceBuffer) &&
+              gpuCreateBuffer(meshSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &culler.meshBuffer) &&
+              gpuCreateBuffer(lodSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &culler.lodBuffer) &&
+              gpuCreateBuffer(drawSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &culler.drawTemplate);
+    if (ok) {
+        if (scene.instances) {
+            stagingUpload(&culler.instanceBuffer, 0, scene.instances, instanceSize);
+        } else {
+            streamerAddSection(&culler.instanceBuffer, SCENE_SECTION_INSTANCES);
+        }
+        stagingUpload(&culler.meshBuffer, 0, meshes, meshSize);
+        stagingUpload(&culler.lodBuffer, 0, levels, lodSize);
+        stagingUpload(&culler.drawTemplate, 0, commands, drawSize);
+    }
+    free(levels);
+    free(commands);
+    free(meshes);
+
+    // Per-slot outputs
+    for (uint32_t i = 0; i < vkContext.framesInFlight && ok; i++) {
+        ok = gpuCreateBuffer(drawSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                             VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &culler.drawBuffers[i]) &&
+             gpuCreateBuffer(visibleSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &culler.visibleBuffers[i]) &&
+             gpuCreateBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                             VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, &culler.countBuffers[i]) &&
+             gpuCreateBuffer(drawSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                             VK_MEMORY_PROPERTY_HOST_CACHED_BIT, &culler.statsBuffers[i]);
+    }
+    if (!ok) {
+        SDL_Log("Out of GPU memory for %u culled instances", scene.instanceCount);
+        return false;
+    }
+
+    VkDescriptorSetLayoutBinding bindings[6];
+    for (uint32_t i = 0; i < 6; i++) {
+        bindings[i] = (VkDescriptorSetLayoutBinding){i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                                                     VK_SHADER_STAGE_COMPUTE_BIT, NULL};
+    }
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    setLayoutInfo.bindingCount = 6;
+    setLayoutInfo.pBindings = bindings;
+    vkCreateDescriptorSetLayout(vkContext.device, &setLayoutInfo, NULL, &culler.setLayout);
+
+    VkDescriptorPoolSize poolSize = {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6 * vkContext.framesInFlight};
+    VkDescriptorPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    poolInfo.maxSets = vkContext.framesInFlight;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    vkCreateDescriptorPool(vkContext.device, &poolInfo, NULL, &culler.descriptorPool);
+
+    VkDescriptorSetLayout setLayouts[MAX_FRAMES_IN_FLIGHT];
+    for (uint32_t i = 0; i < vkContext.framesInFlight; i++) {
+        setLayouts[i] = culler.setLayout;
+    }
+    VkDescriptorSetAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+    allocInfo.descriptorPool = culler.descriptorPool;
+    allocInfo.descriptorSetCount = vkContext.framesInFlight;
+    allocInfo.pSetLayouts = setLayouts;
+    vkAllocateDescriptorSets(vkContext.device, &allocInfo, culler.sets);
+
+    for (uint32_t i = 0; i < vkContext.framesInFlight; i++) {
+        VkDescriptorBufferInfo bufferInfos[6] = {
+            {culler.instanceBuffer.buffer, 0, VK_WHOLE_SIZE},
+            {culler.meshBuffer.buffer, 0, VK_WHOLE_SIZE},
+            {culler.drawBuffers[i].buffer, 0, VK_WHOLE_SIZE},
+            {culler.visibleBuffers[i].buffer, 0, VK_WHOLE_SIZE},
+            {culler.countBuffers[i].buffer, 0, VK_WHOLE_SIZE},
+            {culler.lodBuffer.buffer, 0, VK_WHOLE_SIZE},
+        };
+        VkWriteDescriptorSet writes[6];
+        for (uint32_t b = 0; b < 6; b++) {
+            writes[b] = (VkWriteDescriptorSet){VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+            writes[b].dstSet = culler.sets[i];
+            writes[b].dstBinding = b;
+            writes[b].descriptorCount = 1;
+            writes[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[b].pBufferInfo = &bufferInfos[b];
+        }
+        vkUpdateDescriptorSets(vkContext.device, 6, writes, 0, NULL);
+    }
+
+    VkPushConstantRange pushRange = {VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullConstants)};
+    VkPipelineLayoutCreateInfo layoutInfo = {VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &culler.setLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushRange;
+    vkCreatePipelineLayout(vkContext.device, &layoutInfo, NULL, &culler.pipelineLayout);
+
+    VkShaderModule module = createShaderModule(cullCompSpv, sizeof(cullCompSpv));
+    VkComputePipelineCreateInfo pipelineInfo = {VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    pipelineInfo.stage = (VkPipelineShaderStageCreateInfo){VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = module;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = culler.pipelineLayout;
+    VkResult result = vkCreateComputePipelines(vkContext.device, vkContext.pipelineCache, 1, &pipelineInfo,
+                                               NULL, &culler.pipeline);
+    vkDestroyShaderModule(vkContext.device, module, NULL);
+    if (result != VK_SUCCESS) {
+        SDL_Log("Failed to create cull pipeline");
+        return false;
+    }
+
+    culler.enabled = true;
+    SDL_Log("GPU-driven path: %u instances of %u mesh(es), %s", scene.instanceCount, scene.meshCount,
+            culler.cmdDrawIndexedIndirectCount ? "indirect count" :
+            culler.multiDrawIndirect ? "multi-draw indirect" : "one indirect draw per mesh");
+    return true;
+}
+
+static void cullerDestroy(void) {
+    vkDestroyPipeline(vkContext.device, culler.pipeline, NULL);
+    vkDestroyPipelineLayout(vkContext.device, culler.pipelineLayout, NULL);
+    vkDestroyDescriptorPool(vkContext.device, culler.descriptorPool, NULL);
+    vkDestroyDescriptorSetLayout(vkContext.device, culler.setLayout, NULL);
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        gpuDestroyBuffer(&culler.statsBuffers[i]);
+        gpuDestroyBuffer(&culler.countBuffers[i]);
+        gpuDestroyBuffer(&culler.visibleBuffers[i]);
+        gpuDestroyBuffer(&culler.drawBuffers[i]);
+    }
+    gpuDestroyBuffer(&culler.drawTemplate);
+    gpuDestroyBuffer(&culler.lodBuffer);
+    gpuDestroyBuffer(&culler.meshBuffer);
+    gpuDestroyBuffer(&culler.instanceBuffer);
+}
+
+// Resets the slot's draw commands from the template and runs the cull pass.
+// Recorded outside the render pass, ahead of cullerDraw.
+static void cullerRecord(VkCommandBuffer cmd, uint32_t slot) {
+    VkBufferCopy region = {0, 0, sizeof(VkDrawIndexedIndirectCommand) * culler.commandCount};
+    vkCmdCopyBuffer(cmd, culler.drawTemplate.buffer, culler.drawBuffers[slot].buffer, 1, &region);
+    vkCmdFillBuffer(cmd, culler.countBuffers[slot].buffer, 0, sizeof(uint32_t), 0);
+
+    // Also orders this pass's LOD reads after the previous frame's writes
+    VkMemoryBarrier resetBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &resetBarrier, 0, NULL, 0, NULL);
+
+    CullConstants constants;
+    memcpy(constants.planes, camera.planes, sizeof(constants.planes));
+    memcpy(constants.eye, camera.eye, sizeof(camera.eye));
+    constants.eye[3] = camera.projScale;
+    constants.instanceCount = scene.instanceCount;
+    constants.lodEnabled = appConfig.lod;
+    constants.pixelError = LOD_PIXEL_ERROR;
+    constants.hysteresis = LOD_HYSTERESIS;
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, culler.pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, culler.pipelineLayout, 0, 1,
+                            &culler.sets[slot], 0, NULL);
+    vkCmdPushConstants(cmd, culler.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    vkCmdDispatch(cmd, (scene.instanceCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+    // The commands feed the indirect draw and the stats copy, the survivors the vertex fetch
+    VkMemoryBarrier cullBarrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                                VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 1, &cullBarrier, 0, NULL, 0, NULL);
+}
+
+// The CPU cost of this is the same for 1 or 100k instances
+static void cullerDraw(VkCommandBuffer cmd, uint32_t slot, uint32_t subpass) {
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, subpassPipeline(subpass));
+    VkViewport viewport = {0.0f, 0.0f, (float)vkContext.extent.width, (float)vkContext.extent.height, 0.0f, 1.0f};
+    VkRect2D scissor = {{0, 0}, vkContext.extent};
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+    VkBuffer vertexBuffers[] = {vkContext.vertexBuffer.buffer, culler.visibleBuffers[slot].buffer};
+    VkDeviceSize offsets[] = {0, 0};
+    vkCmdBindVertexBuffers(cmd, 0, 2, vertexBuffers, offsets);
+    vkCmdBindIndexBuffer(cmd, vkContext.indexBuffer.buffer, 0, scene.indexType);
+    CameraConstants constants = {camera.viewProj};
+    vkCmdPushConstants(cmd, vkContext.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
+    // Instances are already placed by the culler; their object is the identity
+    bindFrameUniforms(cmd, 0);
+
+    VkBuffer drawBuffer = culler.drawBuffers[slot].buffer;
+    uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    if (culler.cmdDrawIndexedIndirectCount) {
+        culler.cmdDrawIndexedIndirectCount(cmd, drawBuffer, 0, culler.countBuffers[slot].buffer, 0,
+                                           culler.commandCount, stride);
+    } else if (culler.multiDrawIndirect) {
+        vkCmdDrawIndexedIndirect(cmd, drawBuffer, 0, culler.commandCount, stride);
+    } else {
+        for (uint32_t i = 0; i < culler.commandCount; i++) {
+            vkCmdDrawIndexedIndirect(cmd, drawBuffer, (VkDeviceSize)i * stride, 1, stride);
+        }
+    }
+}
+
+// Called after the slot's fence wait; averages how many instances survived
+// and how many triangles their levels of detail added up to
+static void cullerCollectStats(uint32_t slot) {
+    if (!culler.enabled || !culler.statsPending[slot]) {
+        return;
+    }
+    culler.statsPending[slot] = false;
+    gpuInvalidate(&culler.statsBuffers[slot].allocation, 0, culler.statsBuffers[slot].size);
+    const VkDrawIndexedIndirectCommand* commands = culler.statsBuffers[slot].allocation.mapped;
+    for (uint32_t i = 0; i < culler.commandCount; i++) {
+        culler.visibleTotal += commands[i].instanceCount;
+        lodState.triangleTotal += (uint64_t)commands[i].instanceCount * (commands[i].indexCount / 3);
+    }
+    culler.visibleSamples++;
+    lodState.samples++;
+}
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void gpuAllocatorInit(void) {
+    vkGetPhysicalDeviceMemoryProperties(vkContext.physicalDevice, &gpuAllocator.memoryProperties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(vkContext.physicalDevice, &properties);
+    gpuAllocator.bufferImageGranularity = properties.limits.bufferImageGranularity;
+    gpuAllocator.nonCoherentAtomSize = properties.limits.nonCoherentAtomSize;
+    gpuAllocator.lock = SDL_CreateMutex();
+}
+
+// Prefer a type with both required and preferred flags, e.g. DEVICE_LOCAL |
+// HOST_VISIBLE on UMA/ReBAR hardware, and fall back to just the required ones.
+static uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) {
+    const VkPhysicalDeviceMemoryProperties* props = &gpuAllocator.memoryProperties;
+    VkMemoryPropertyFlags wanted = required | preferred;
+
+    for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
+        if ((typeBits & (1u << i)) && (props->memoryTypes[i].propertyFlags & wanted) == wanted) {
+            return i;
+        }
+    }
+    for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
+        if ((typeBits & (1u << i)) && (props->memoryTypes[i].propertyFlags & required) == required) {
+            return i;
+        }
+    }
+    return UINT32_MAX;
+}
+
+static void blockInsertFreeRange(GpuBlock* block, uint32_t index, VkDeviceSize offset, VkDeviceSize size) {
+    if (block->freeRangeCount == block->freeRangeCapacity) {
+        block->freeRangeCapacity = block->freeRangeCapacity ? block->freeRangeCapacity * 2 : 16;
+        block->freeRanges = realloc(block->freeRanges, sizeof(GpuRange) * block->freeRangeCapacity);
+    }
+    memmove(&block->freeRanges[index + 1], &block->freeRanges[index],
+            sizeof(GpuRange) * (block->freeRangeCount - index));
+    block->freeRanges[index].offset = offset;
+    block->freeRanges[index].size = size;
+    block->freeRangeCount++;
+}
+
+static void blockRemoveFreeRange(GpuBlock* block, uint32_t index) {
+    memmove(&block->freeRanges[index], &block->freeRanges[index + 1],
+            sizeof(GpuRange) * (block->freeRangeCount - index - 1));
+    block->freeRangeCount--;
+}
+
+static bool blockAlloc(GpuBlock* block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset) {
+    // Best fit keeps large ranges intact for large requests
+    uint32_t best = UINT32_MAX;
+    for (uint32_t i = 0; i < block->freeRangeCount; i++) {
+        const GpuRange* range = &block->freeRanges[i];
+        VkDeviceSize aligned = alignUp(range->offset, alignment);
+        if (aligned + size <= range->offset + range->size &&
+            (best == UINT32_MAX || range->size < block->freeRanges[best].size)) {
+            best = i;
+        }
+    }
+    if (best == UINT32_MAX) {
+        return false;
+    }
+
+    GpuRange range = block->freeRanges[best];
+    VkDeviceSize aligned = alignUp(range.offset, alignment);
+    VkDeviceSize end = aligned + size;
+    blockRemoveFreeRange(block, best);
+    if (end < range.offset + range.size) {
+        blockInsertFreeRange(block, best, end, range.offset + range.size - end);
+    }
+    if (aligned > range.offset) {
+        blockInsertFreeRange(block, best, range.offset, aligned - range.offset);
+    }
+
+    block->used += size;
+    block->allocationCount++;
+    *offset = aligned;
+    return true;
+}
+
+static void blockFree(GpuBlock* block, VkDeviceSize offset, VkDeviceSize size) {
+    uint32_t index = 0;
+    while (index < block->freeRangeCount && block->freeRanges[index].offset < offset) {
+        index++;
+    }
+    blockInsertFreeRange(block, index, offset, size);
+
+    // Coalesce with the following and preceding neighbours
+    if (index + 1 < block->freeRangeCount &&
+        block->freeRanges[index].offset + block->freeRanges[index].size == block->freeRanges[index + 1].offset) {
+        block->freeRanges[index].size += block->freeRanges[index + 1].size;
+        blockRemoveFreeRange(block, index + 1);
+    }
+    if (index > 0 &&
+        block->freeRanges[index - 1].offset + block->freeRanges[index - 1].size == block->freeRanges[index].offset) {
+        block->freeRanges[index - 1].size += block->freeRanges[index].size;
+        blockRemoveFreeRange(block, index);
+    }
+
+    block->used -= size;
+    block->allocationCount--;
+}
+
+static GpuBlock* createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, GpuResourceKind kind, bool dedicated) {
+    if (gpuAllocator.blockCount == GPU_MAX_BLOCKS) {
+        SDL_Log("GPU allocator: block limit reached");
+        return NULL;
+    }
+
+    VkMemoryAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(vkContext.device, &allocInfo, NULL, &memory) != VK_SUCCESS) {
+        return NULL;
+    }
+
+    GpuBlock* block = calloc(1, sizeof(GpuBlock));
+    block->memory = memory;
+    block->size = size;
+    block->memoryTypeIndex = memoryTypeIndex;
+    block->kind = kind;
+    block->dedicated = dedicated;
+    blockInsertFreeRange(block, 0, 0, size);
+
+    if (gpuAllocator.memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        vkMapMemory(vkContext.device, memory, 0, VK_WHOLE_SIZE, 0, &block->mapped);
+    }
+
+    gpuAllocator.blocks[gpuAllocator.blockCount++] = block;
+    gpuAllocator.heapUsage[gpuAllocator.memoryProperties.memoryTypes[memoryTypeIndex].heapIndex] += size;
+    return block;
+}
+
+static void destroyBlock(GpuBlock* block) {
+    for (uint32_t i = 0; i < gpuAllocator.blockCount; i++) {
+        if (gpuAllocator.blocks[i] == block) {
+            gpuAllocator.blocks[i] = gpuAllocator.blocks[--gpuAllocator.blockCount];
+            break;
+        }
+    }
+    if (block->mapped) {
+        vkUnmapMemory(vkContext.device, block->memory);
+    }
+    gpuAllocator.heapUsage[gpuAllocator.memoryProperties.memoryTypes[block->memoryTypeIndex].heapIndex] -= block->size;
+    vkFreeMemory(vkContext.device, block->memory, NULL);
+    free(block->freeRanges);
+    free(block);
+}
+
+// True when the heap can take size more bytes without going over its budget
+static bool heapHasRoom(uint32_t heapIndex, VkDeviceSize size) {
+    GpuHeapBudget budgets[VK_MAX_MEMORY_HEAPS];
+    gpuGetBudget(budgets);
+    return budgets[heapIndex].usage + size <= budgets[heapIndex].budget;
+}
+
+// Sub-allocates from the blocks of one memory type, creating a block when
+// none has room. With withinBudget set, no block is created that would take
+// its heap over budget; a shared block is then shrunk to just fit the request
+// if that is enough.
+static bool allocateInType(uint32_t memoryTypeIndex, const VkMemoryRequirements* requirements, GpuResourceKind kind,
+                           bool withinBudget, GpuAllocation* allocation) {
+    // Keep blocks small relative to the heap so small devices are not exhausted by one block
+    uint32_t heapIndex = gpuAllocator.memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+    VkDeviceSize blockSize = GPU_BLOCK_SIZE;
+    VkDeviceSize heapSize = gpuAllocator.memoryProperties.memoryHeaps[heapIndex].size;
+    if (blockSize > heapSize / 8) {
+        blockSize = alignUp(heapSize / 8, 1024 * 1024);
+    }
+
+    VkDeviceSize offset = 0;
+    GpuBlock* block = NULL;
+    if (requirements->size > blockSize / 2) {
+        // Large resources get their own memory object instead of fragmenting a shared block
+        if (withinBudget && !heapHasRoom(heapIndex, requirements->size)) {
+            return false;
+        }
+        block = createBlock(memoryTypeIndex, requirements->size, kind, true);
+        if (!block || !blockAlloc(block, requirements->size, requirements->alignment, &offset)) {
+            return false;
+        }
+    } else {
+        for (uint32_t i = 0; i < gpuAllocator.blockCount && !block; i++) {
+            GpuBlock* candidate = gpuAllocator.blocks[i];
+            if (!candidate->dedicated && candidate->memoryTypeIndex == memoryTypeIndex && candidate->kind == kind &&
+                blockAlloc(candidate, requirements->size, requirements->alignment, &offset)) {
+                block = candidate;
+            }
+        }
+        if (!block) {
+            if (withinBudget && !heapHasRoom(heapIndex, blockSize)) {
+                blockSize = alignUp(requirements->size, 1024 * 1024);
+                if (!heapHasRoom(heapIndex, blockSize)) {
+                    return false;
+                }
+            }
+            block = createBlock(memoryTypeIndex, blockSize, kind, false);
+            if (!block || !blockAlloc(block, requirements->size, requirements->alignment, &offset)) {
+                return false;
+            }
+        }
+    }
+
+    allocation->block = block;
+    allocation->offset = offset;
+    allocation->size = requirements->size;
+    allocation->mapped = block->mapped ? (char*)block->mapped + offset : NULL;
+    return true;
+}
+
+// Tries, in order: the best matching type within its heap's budget, the same
+// type after evicting the heap's empty blocks, any other type on another heap
+// that still has the required flags and room (e.g. system memory for a
+// buffer that only prefers DEVICE_LOCAL), and finally the best type over
+// budget, leaving it to the driver to page.
+static bool allocateFromBlocks(const VkMemoryRequirements* requirements, VkMemoryPropertyFlags required,
+                               VkMemoryPropertyFlags preferred, GpuResourceKind kind, GpuAllocation* allocation) {
+    uint32_t memoryTypeIndex = findMemoryType(requirements->memoryTypeBits, required, preferred);
+    if (memoryTypeIndex == UINT32_MAX) {
+        SDL_Log("GPU allocator: no memory type matches 0x%x", required);
+        return false;
+    }
+    if (allocateInType(memoryTypeIndex, requirements, kind, true, allocation)) {
+        return true;
+    }
+
+    const VkPhysicalDeviceMemoryProperties* props = &gpuAllocator.memoryProperties;
+    uint32_t heapIndex = props->memoryTypes[memoryTypeIndex].heapIndex;
+    if (gpuTrim(heapIndex) > 0 && allocateInType(memoryTypeIndex, requirements, kind, true, allocation)) {
+        return true;
+    }
+
+    for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
+        if ((requirements->memoryTypeBits & (1u << i)) && props->memoryTypes[i].heapIndex != heapIndex &&
+            (props->memoryTypes[i].propertyFlags & required) == required &&
+            allocateInType(i, requirements, kind, true, allocation)) {
+            gpuAllocator.downgradeCount++;
+            SDL_Log("GPU allocator: heap %u over budget, %llu bytes placed in memory type %u (heap %u) instead",
+                    heapIndex, (unsigned long long)requirements->size, i, props->memoryTypes[i].heapIndex);
+            return true;
+        }
+    }
+
+    if (allocateInType(memoryTypeIndex, requirements, kind, false, allocation)) {
+        SDL_Log("GPU allocator: heap %u over budget by %llu bytes", heapIndex, (unsigned long long)requirements->size);
+        return true;
+    }
+    SDL_Log("GPU allocator: out of memory for %llu bytes", (unsigned long long)requirements->size);
+    return false;
+}
+
+static bool gpuAlloc(const VkMemoryRequirements* requirements, VkMemoryPropertyFlags required,
+                     VkMemoryPropertyFlags preferred, GpuResourceKind kind, GpuAllocation* allocation) {
+    SDL_LockMutex(gpuAllocator.lock);
+    bool ok = allocateFromBlocks(requirements, required, preferred, kind, allocation);
+    SDL_UnlockMutex(gpuAllocator.lock);
+    return ok;
+}
+
+static void gpuFree(GpuAllocation* allocation) {
+    GpuBlock* block = allocation->block;
+    if (!block) {
+        return;
+    }
+    SDL_LockMutex(gpuAllocator.lock);
+    blockFree(block, allocation->offset, allocation->size);
+    if (block->dedicated) {
+        destroyBlock(block);
+    }
+    SDL_UnlockMutex(gpuAllocator.lock);
+    allocation->block = NULL;
+    allocation->mapped = NULL;
+}
+
+// Returns false for HOST_COHERENT memory, which never needs flushing or invalidation
+static bool gpuMappedRange(const GpuAllocation* allocation, VkDeviceSize offset, VkDeviceSize size,
+                           VkMappedMemoryRange* range) {
+    const GpuBlock* block = allocation->block;
+    VkMemoryPropertyFlags flags = gpuAllocator.memoryProperties.memoryTypes[block->memoryTypeIndex].propertyFlags;
+    if (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+        return false;
+    }
+
+    VkDeviceSize atom = gpuAllocator.nonCoherentAtomSize;
+    VkDeviceSize start = (allocation->offset + offset) & ~(atom - 1);
+    VkDeviceSize end = alignUp(allocation->offset + offset + size, atom);
+    if (end > block->size) {
+        end = block->size;
+    }
+
+    range->sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range->pNext = NULL;
+    range->memory = block->memory;
+    range->offset = start;
+    range->size = end - start;
+    return true;
+}
+
+// Makes CPU writes visible to the device
+static void gpuFlush(const GpuAllocation* allocation, VkDeviceSize offset, VkDeviceSize size) {
+    VkMappedMemoryRange range;
+    if (gpuMappedRange(allocation, offset, size, &range)) {
+        vkFlushMappedMemoryRanges(vkContext.device, 1, &range);
+    }
+}
+
+// Makes device writes visible to the CPU
+static void gpuInvalidate(const GpuAllocation* allocation, VkDeviceSize offset, VkDeviceSize size) {
+    VkMappedMemoryRange range;
+    if (gpuMappedRange(allocation, offset, size, &range)) {
+        vkInvalidateMappedMemoryRanges(vkContext.device, 1, &range);
+    }
+}
+
+static bool gpuCreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags required,
+                            VkMemoryPropertyFlags preferred, GpuBuffer* buffer) {
+    VkBufferCreateInfo bufferInfo = {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (vkCreateBuffer(vkContext.device, &bufferInfo, NULL, &buffer->buffer) != VK_SUCCESS) {
+        return false;
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(vkContext.device, buffer->buffer, &memRequirements);
+    if (!gpuAlloc(&memRequirements, required, preferred, GPU_RESOURCE_BUFFER, &buffer->allocation)) {
+        vkDestroyBuffer(vkContext.device, buffer->buffer, NULL);
+        buffer->buffer = VK_NULL_HANDLE;
+        return false;
+    }
+
+    vkBindBufferMemory(vkContext.device, buffer->buffer, buffer->allocation.block->memory, buffer->allocation.offset);
+    buffer->size = size;
+    return true;
+}
+
+static void gpuDestroyBuffer(GpuBuffer* buffer) {
+    if (buffer->buffer) {
+        vkDestroyBuffer(vkContext.device, buffer->buffer, NULL);
+        buffer->buffer = VK_NULL_HANDLE;
+    }
+    gpuFree(&buffer->allocation);
+}
+
+static bool gpuRingCreate(GpuRing* ring, VkDeviceSize size, VkBufferUsageFlags usage) {
+    ring->head = 0;
+    ring->tail = 0;
+    return gpuCreateBuffer(size, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &ring->buffer);
+}
+
+static bool gpuRingAlloc(GpuRing* ring, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset) {
+    VkDeviceSize aligned = alignUp(ring->head, alignment);
+    if (ring->head >= ring->tail) {
+        // Free space is [head, end) followed by [0, tail)
+        if (aligned + size > ring->buffer.size) {
+            aligned = 0;
+            if (size >= ring->tail) {
+                return false;
+            }
+        }
+    } else if (aligned + size >= ring->tail) {
+        return false;
+    }
+
+    ring->head = aligned + size;
+    *offset = aligned;
+    return true;
+}
+
+// marker is the ring head captured when the work using the space was submitted
+static void gpuRingRelease(GpuRing* ring, VkDeviceSize marker) {
+    ring->tail = marker;
+    if (ring->tail == ring->head) {
+        ring->head = 0;
+        ring->tail = 0;
+    }
+}
+
+static void gpuGetStats(GpuAllocatorStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    VkDeviceSize totalFree = 0;
+
+    SDL_LockMutex(gpuAllocator.lock);
+    for (uint32_t i = 0; i < gpuAllocator.blockCount; i++) {
+        const GpuBlock* block = gpuAllocator.blocks[i];
+        stats->blockCount++;
+        stats->allocationCount += block->allocationCount;
+        stats->bytesAllocated += block->size;
+        stats->bytesUsed += block->used;
+        for (uint32_t r = 0; r < block->freeRangeCount; r++) {
+            totalFree += block->freeRanges[r].size;
+            if (block->freeRanges[r].size > stats->largestFreeRange) {
+                stats->largestFreeRange = block->freeRanges[r].size;
+            }
+        }
+    }
+    SDL_UnlockMutex(gpuAllocator.lock);
+
+    stats->fragmentation = totalFree ? 1.0f - (float)stats->largestFreeRange / (float)totalFree : 0.0f;
+}
+
+// Per-heap usage and budget. VK_EXT_memory_budget reports the whole
+// process's usage and what the OS currently lets it have. Without it, usage
+// is what this allocator holds and the budget 80% of the heap, leaving room
+// for the driver and other processes.
+static void gpuGetBudget(GpuHeapBudget budgets[VK_MAX_MEMORY_HEAPS]) {
+    const VkPhysicalDeviceMemoryProperties* props = &gpuAllocator.memoryProperties;
+    memset(budgets, 0, sizeof(GpuHeapBudget) * VK_MAX_MEMORY_HEAPS);
+    if (gpuAllocator.getMemoryProperties2) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT};
+        VkPhysicalDeviceMemoryProperties2 props2 = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2};
+        props2.pNext = &budget;
+        gpuAllocator.getMemoryProperties2(vkContext.physicalDevice, &props2);
+        for (uint32_t i = 0; i < props->memoryHeapCount; i++) {
+            budgets[i].usage = budget.heapUsage[i];
+            budgets[i].budget = budget.heapBudget[i];
+        }
+        return;
+    }
+    SDL_LockMutex(gpuAllocator.lock);
+    for (uint32_t i = 0; i < props->memoryHeapCount; i++) {
+        budgets[i].usage = gpuAllocator.heapUsage[i];
+        budgets[i].budget = props->memoryHeaps[i].size / 10 * 8;
+    }
+    SDL_UnlockMutex(gpuAllocator.lock);
+}
+
+// Frees the empty shared blocks of a heap, UINT32_MAX for every heap. Blocks
+// are kept when they empty out so the next allocation does not pay for
+// vkAllocateMemory again; this gives the memory back under pressure.
+static VkDeviceSize gpuTrim(uint32_t heapIndex) {
+    VkDeviceSize freed = 0;
+    SDL_LockMutex(gpuAllocator.lock);
+    for (uint32_t i = gpuAllocator.blockCount; i-- > 0;) {
+        GpuBlock* block = gpuAllocator.blocks[i];
+        uint32_t blockHeap = gpuAllocator.memoryProperties.memoryTypes[block->memoryTypeIndex].heapIndex;
+        if (block->allocationCount == 0 && !block->dedicated && (heapIndex == UINT32_MAX || blockHeap == heapIndex)) {
+            freed += block->size;
+            destroyBlock(block);
+        }
+    }
+    gpuAllocator.evictedBytes += freed;
+    SDL_UnlockMutex(gpuAllocator.lock);
+    return freed;
+}
+
+static void gpuLogStats(const char* label) {
+    GpuAllocatorStats stats;
+    gpuGetStats(&stats);
+    SDL_Log("GPU memory %s: %u blocks, %u allocations, %.2f MiB allocated, %.2f MiB used, fragmentation %.1f%%",
+            label, stats.blockCount, stats.allocationCount,
+            stats.bytesAllocated / (1024.0 * 1024.0), stats.bytesUsed / (1024.0 * 1024.0),
+            stats.fragmentation * 100.0f);
+
+    GpuHeapBudget budgets[VK_MAX_MEMORY_HEAPS];
+    gpuGetBudget(budgets);
+    for (uint32_t i = 0; i < gpuAllocator.memoryProperties.memoryHeapCount; i++) {
+        SDL_Log("  heap %u%s: %.2f of %.2f MiB budget", i,
+                gpuAllocator.memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT ? " (device)" : "",
+                budgets[i].usage / (1024.0 * 1024.0), budgets[i].budget / (1024.0 * 1024.0));
+    }
+    if (gpuAllocator.downgradeCount > 0 || gpuAllocator.evictedBytes > 0) {
+        SDL_Log("  %u allocation(s) moved to another heap, %.2f MiB of empty blocks evicted",
+                gpuAllocator.downgradeCount, gpuAllocator.evictedBytes / (1024.0 * 1024.0));
+    }
+}
+
+static void gpuAllocatorDestroy(void) {
+    while (gpuAllocator.blockCount > 0) {
+        GpuBlock* block = gpuAllocator.blocks[gpuAllocator.blockCount - 1];
+        if (block->allocationCount > 0) {
+            SDL_Log("GPU allocator: %u allocation(s) leaked in block of %llu bytes",
+                    block->allocationCount, (unsigned long long)block->size);
+        }
+        destroyBlock(block);
+    }
+    SDL_DestroyMutex(gpuAllocator.lock);
+    gpuAllocator.lock = NULL;
+}
+
+static bool stagingInit(void) {
+    if (!gpuRingCreate(&stagingUploader.ring, STAGING_BUFFER_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT)) {
+        SDL_Log("Failed to create staging buffer");
+        return false;
+    }
+
+    VkCommandPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = vkContext.graphicsFamily;
+    vkCreateCommandPool(vkContext.device, &poolInfo, NULL, &stagingUploader.commandPool);
+
+    VkCommandBufferAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    allocInfo.commandPool = stagingUploader.commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    vkAllocateCommandBuffers(vkContext.device, &allocInfo, &stagingUploader.commandBuffer);
+
+    if (vkContext.dedicatedTransfer) {
+        poolInfo.queueFamilyIndex = vkContext.transferFamily;
+        vkCreateCommandPool(vkContext.device, &poolInfo, NULL, &stagingUploader.transferPool);
+        allocInfo.commandPool = stagingUploader.transferPool;
+        vkAllocateCommandBuffers(vkContext.device, &allocInfo, &stagingUploader.transferCommandBuffer);
+    }
+
+    VkFenceCreateInfo fenceInfo = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    vkCreateFence(vkContext.device, &fenceInfo, NULL, &stagingUploader.fence);
+    return true;
+}
+
+static void stagingDestroy(void) {
+    vkDestroyFence(vkContext.device, stagingUploader.fence, NULL);
+    vkDestroyCommandPool(vkContext.device, stagingUploader.transferPool, NULL);
+    vkDestroyCommandPool(vkContext.device, stagingUploader.commandPool, NULL);
+    gpuDestroyBuffer(&stagingUploader.ring.buffer);
+}
+
+// Queues a copy into dst; the data is copied into the staging ring immediately,
+// so the caller's memory may be reused as soon as this returns. Uploads larger
+// than the ring are split, flushing whenever the ring or copy list fills up.
+static bool stagingUpload(GpuBuffer* dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+    const char* src = data;
+    while (size > 0) {
+        VkDeviceSize chunk = size;
+        if (chunk > STAGING_BUFFER_SIZE / 2) {
+            chunk = STAGING_BUFFER_SIZE / 2;
+        }
+
+        VkDeviceSize stagingOffset;
+        if (stagingUploader.copyCount == MAX_STAGING_COPIES ||
+            !gpuRingAlloc(&stagingUploader.ring, chunk, 16, &stagingOffset)) {
+            // Partway through a buffer, so it stays with the transfer family
+            stagingFlush(false);
+            if (!gpuRingAlloc(&stagingUploader.ring, chunk, 16, &stagingOffset)) {
+                return false;
+            }
+        }
+
+        memcpy((char*)stagingUploader.ring.buffer.allocation.mapped + stagingOffset, src, chunk);
+        gpuFlush(&stagingUploader.ring.buffer.allocation, stagingOffset, chunk);
+
+        StagingCopy* copy = &stagingUploader.copies[stagingUploader.copyCount++];
+        copy->dst = dst->buffer;
+        copy->region.srcOffset = stagingOffset;
+        copy->region.dstOffset = dstOffset;
+        copy->region.size = chunk;
+        stagingUploader.pendingBytes += chunk;
+
+        src += chunk;
+        dstOffset += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+// Queue family ownership of whole buffers moving from the transfer family to
+// the graphics family: the release half goes at the end of the transfer
+// queue's commands, the acquire half at the start of the graphics queue's.
+static void recordOwnershipTransfer(VkCommandBuffer cmd, const VkBuffer* buffers, uint32_t bufferCount, bool release) {
+    VkBufferMemoryBarrier barriers[MAX_STAGING_COPIES];
+    for (uint32_t i = 0; i < bufferCount; i++) {
+        VkBufferMemoryBarrier* barrier = &barriers[i];
+        *barrier = (VkBufferMemoryBarrier){VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+        barrier->srcAccessMask = release ? VK_ACCESS_TRANSFER_WRITE_BIT : 0;
+        barrier->dstAccessMask = release ? 0 : VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                                               VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT |
+                                               VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+        barrier->srcQueueFamilyIndex = vkContext.transferFamily;
+        barrier->dstQueueFamilyIndex = vkContext.graphicsFamily;
+        barrier->buffer = buffers[i];
+        barrier->offset = 0;
+        barrier->size = VK_WHOLE_SIZE;
+    }
+    VkPipelineStageFlags consumers = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                                     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                                     VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+    vkCmdPipelineBarrier(cmd, release ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         release ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : consumers,
+                         0, 0, NULL, bufferCount, barriers, 0, NULL);
+}
+
+// Submits cmd to the transfer queue and returns the uploadTimeline value it signals
+static uint64_t submitTransfer(VkCommandBuffer cmd) {
+    uint64_t value = ++vkContext.uploadValue;
+    VkTimelineSemaphoreSubmitInfo timelineInfo = {VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &value;
+    VkSubmitInfo submitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &vkContext.uploadTimeline;
+    vkQueueSubmit(vkContext.transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
+    return value;
+}
+
+// Records every queued copy into one command buffer and submits it once. With
+// a dedicated transfer queue the copies run there. On the handover flush a
+// second, graphics-side submit acquires every buffer written since the last
+// one, after waiting on the timeline. Flushes that only make room in the ring
+// keep the buffers with the transfer family, since a buffer may be written
+// again after it and must not belong to the graphics family by then.
+static void stagingFlush(bool handover) {
+    if (stagingUploader.copyCount == 0 && (!handover || stagingUploader.writtenCount == 0)) {
+        return;
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    VkCommandBuffer cmd = vkContext.dedicatedTransfer ? stagingUploader.transferCommandBuffer
+                                                      : stagingUploader.commandBuffer;
+    VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(cmd, &beginInfo);
+
+    // Consecutive copies into the same buffer go out as one multi-region copy
+    uint32_t first = 0;
+    VkBufferCopy regions[MAX_STAGING_COPIES];
+    VkBuffer* written = stagingUploader.written;
+    for (uint32_t i = 0; i < stagingUploader.copyCount; i++) {
+        regions[i] = stagingUploader.copies[i].region;
+        if (i + 1 == stagingUploader.copyCount || stagingUploader.copies[i + 1].dst != stagingUploader.copies[first].dst) {
+            vkCmdCopyBuffer(cmd, stagingUploader.ring.buffer.buffer, stagingUploader.copies[first].dst,
+                            i - first + 1, &regions[first]);
+            bool seen = false;
+            for (uint32_t j = 0; j < stagingUploader.writtenCount; j++) {
+                seen = seen || written[j] == stagingUploader.copies[first].dst;
+            }
+            if (!seen) {
+                written[stagingUploader.writtenCount++] = stagingUploader.copies[first].dst;
+            }
+            first = i + 1;
+        }
+    }
+
+    VkSubmitInfo submitInfo = {VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.commandBufferCount = 1;
+    if (vkContext.dedicatedTransfer && !handover) {
+        // Only the ring space is needed back; later submits on the transfer
+        // queue are ordered after these copies anyway
+        vkEndCommandBuffer(cmd);
+        uint64_t value = submitTransfer(cmd);
+        VkSemaphoreWaitInfo waitInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &vkContext.uploadTimeline;
+        waitInfo.pValues = &value;
+        vkContext.waitSemaphores(vkContext.device, &waitInfo, UINT64_MAX);
+    } else if (vkContext.dedicatedTransfer) {
+        recordOwnershipTransfer(cmd, written, stagingUploader.writtenCount, true);
+        vkEndCommandBuffer(cmd);
+        uint64_t value = submitTransfer(cmd);
+
+        VkCommandBuffer acquire = stagingUploader.commandBuffer;
+        vkBeginCommandBuffer(acquire, &beginInfo);
+        recordOwnershipTransfer(acquire, written, stagingUploader.writtenCount, false);
+        vkEndCommandBuffer(acquire);
+        stagingUploader.writtenCount = 0;
+
+        VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        VkTimelineSemaphoreSubmitInfo timelineInfo = {VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+        timelineInfo.waitSemaphoreValueCount = 1;
+        timelineInfo.pWaitSemaphoreValues = &value;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &vkContext.uploadTimeline;
+        submitInfo.pWaitDstStageMask = &waitStage;
+        submitInfo.pCommandBuffers = &acquire;
+        vkQueueSubmit(vkContext.graphicsQueue, 1, &submitInfo, stagingUploader.fence);
+    } else {
+        // Make the copies visible to every consumer of vertex, index, uniform and storage data
+        VkMemoryBarrier barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                                VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                             0, 1, &barrier, 0, NULL, 0, NULL);
+        vkEndCommandBuffer(cmd);
+        submitInfo.pCommandBuffers = &cmd;
+        vkQueueSubmit(vkContext.graphicsQueue, 1, &submitInfo, stagingUploader.fence);
+        stagingUploader.writtenCount = 0;
+    }
+    if (!vkContext.dedicatedTransfer || handover) {
+        vkWaitForFences(vkContext.device, 1, &stagingUploader.fence, VK_TRUE, UINT64_MAX);
+        vkResetFences(vkContext.device, 1, &stagingUploader.fence);
+    }
+    vkResetCommandBuffer(stagingUploader.commandBuffer, 0);
+    if (vkContext.dedicatedTransfer) {
+        vkResetCommandBuffer(stagingUploader.transferCommandBuffer, 0);
+    }
+
+    double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    SDL_Log("Staging: %u copies, %.1f KiB in one submit on the %s queue (%.2f ms)",
+            stagingUploader.copyCount, stagingUploader.pendingBytes / 1024.0,
+            vkContext.dedicatedTransfer ? "transfer" : "graphics", ms);
+
+    gpuRingRelease(&stagingUploader.ring, stagingUploader.ring.head);
+    stagingUploader.copyCount = 0;
+    stagingUploader.pendingBytes = 0;
+}
+
+// Registers a scene file section to be streamed into dst, which must already exist
+static void streamerAddSection(GpuBuffer* dst, SceneSection section) {
+    const SceneFileSection* fileSection = &streamer.header.sections[section];
+    if (fileSection->size == 0) {
+        return;
+    }
+    StreamSection* stream = &streamer.sections[streamer.sectionCount++];
+    stream->dst = dst;
+    stream->fileOffset = fileSection->offset;
+    stream->size = fileSection->size;
+    streamer.totalBytes += fileSection->size;
+}
+
+// Dedicated transfer queue only: frees the ring space of the oldest submitted
+// batch, first waiting for it when wait is set. Returns false if nothing was
+// retired.
+static bool streamerRetireBatch(bool wait) {
+    if (streamer.batchCount == 0) {
+        return false;
+    }
+    StreamBatch* oldest = &streamer.batches[streamer.batchHead];
+    uint64_t completed = 0;
+    vkContext.getSemaphoreCounterValue(vkContext.device, vkContext.uploadTimeline, &completed);
+    while (completed < oldest->value) {
+        if (!wait || SDL_AtomicGet(&streamer.quit)) {
+            return false;
+        }
+        // Short timeout so a quit request is noticed
+        VkSemaphoreWaitInfo waitInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &vkContext.uploadTimeline;
+        waitInfo.pValues = &oldest->value;
+        vkContext.waitSemaphores(vkContext.device, &waitInfo, 10 * SDL_NS_PER_MS);
+        vkContext.getSemaphoreCounterValue(vkContext.device, vkContext.uploadTimeline, &completed);
+    }
+    gpuRingRelease(&streamer.ring, oldest->ringMarker);
+    streamer.batchHead = (streamer.batchHead + 1) % STREAM_MAX_BATCHES;
+    streamer.batchCount--;
+    return true;
+}
+
+// Dedicated transfer queue only: records and submits one chunk's copy. The
+// last chunk also releases every streamed buffer to the graphics family.
+static void streamerSubmitChunk(VkBuffer dst, VkBufferCopy region, bool last) {
+    StreamBatch* batch = &streamer.batches[(streamer.batchHead + streamer.batchCount++) % STREAM_MAX_BATCHES];
+    VkCommandBuffer cmd = batch->commandBuffer;
+    vkResetCommandBuffer(cmd, 0);
+    VkCommandBufferBeginInfo beginInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(cmd, &beginInfo);
+    vkCmdCopyBuffer(cmd, streamer.ring.buffer.buffer, dst, 1, &region);
+    if (last) {
+        VkBuffer buffers[STREAM_MAX_SECTIONS];
+        for (uint32_t i = 0; i < streamer.sectionCount; i++) {
+            buffers[i] = streamer.sections[i].dst->buffer;
+        }
+        recordOwnershipTransfer(cmd, buffers, streamer.sectionCount, true);
+    }
+    vkEndCommandBuffer(cmd);
+    batch->value = submitTransfer(cmd);
+    batch->ringMarker = region.srcOffset + region.size;
+    if (last) {
+        streamer.finalValue = batch->value;
+        SDL_AtomicSet(&streamer.submitted, 1);
+    }
+}
+
+// Loader thread: reads every section chunk by chunk into ring space it
+// allocates. With a dedicated transfer queue it submits the copies itself and
+// recycles ring space from the timeline; otherwise it queues them for the
+// render thread, which frees the space as frames retire.
+static int streamerThreadMain(void* data) {
+    SDL_IOStream* file = SDL_IOFromFile(streamer.path, "rb");
+    if (!file) {
+        SDL_AtomicSet(&streamer.failed, 1);
+        return 0;
+    }
+
+    for (uint32_t s = 0; s < streamer.sectionCount; s++) {
+        const StreamSection* section = &streamer.sections[s];
+        if (SDL_SeekIO(file, (Sint64)section->fileOffset, SDL_IO_SEEK_SET) != (Sint64)section->fileOffset) {
+            SDL_AtomicSet(&streamer.failed, 1);
+            SDL_CloseIO(file);
+            return 0;
+        }
+        for (uint64_t done = 0; done < section->size;) {
+            VkDeviceSize size = SDL_min(section->size - done, STREAM_CHUNK_SIZE);
+            VkDeviceSize stagingOffset = 0;
+
+            if (vkContext.dedicatedTransfer) {
+                while (streamerRetireBatch(false)) {
+                }
+                while (!SDL_AtomicGet(&streamer.quit) && (streamer.batchCount == STREAM_MAX_BATCHES ||
+                       !gpuRingAlloc(&streamer.ring, size, 16, &stagingOffset))) {
+                    streamerRetireBatch(true);
+                }
+            } else {
+                // Wait for frames to retire copies and give ring space back
+                SDL_LockMutex(streamer.lock);
+                while (!SDL_AtomicGet(&streamer.quit) && (streamer.chunkCount == STREAM_MAX_CHUNKS ||
+                       !gpuRingAlloc(&streamer.ring, size, 16, &stagingOffset))) {
+                    SDL_WaitCondition(streamer.spaceFreed, streamer.lock);
+                }
+                SDL_UnlockMutex(streamer.lock);
+            }
+            if (SDL_AtomicGet(&streamer.quit)) {
+                SDL_CloseIO(file);
+                return 0;
+            }
+
+            // The allocated range is ours alone until it is queued
+            void* dst = (char*)streamer.ring.buffer.allocation.mapped + stagingOffset;
+            if (SDL_ReadIO(file, dst, size) != size) {
+                SDL_AtomicSet(&streamer.failed, 1);
+                SDL_CloseIO(file);
+                return 0;
+            }
+            gpuFlush(&streamer.ring.buffer.allocation, stagingOffset, size);
+
+            VkBufferCopy region = {stagingOffset, done, size};
+            done += size;
+            if (vkContext.dedicatedTransfer) {
+                bool last = s + 1 == streamer.sectionCount && done == section->size;
+                streamerSubmitChunk(section->dst->buffer, region, last);
+            } else {
+                SDL_LockMutex(streamer.lock);
+                StreamChunk* chunk = &streamer.chunks[(streamer.chunkHead + streamer.chunkCount++) % STREAM_MAX_CHUNKS];
+                chunk->dst = section->dst->buffer;
+                chunk->region = region;
+                SDL_UnlockMutex(streamer.lock);
+            }
+        }
+    }
+    SDL_CloseIO(file);
+    return 0;
+}
+
+static bool streamerStart(void) {
+    if (!gpuRingCreate(&streamer.ring, STREAM_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT)) {
+        SDL_Log("Failed to create streaming ring");
+        return false;
+    }
+    streamer.lock = SDL_CreateMutex();
+    streamer.spaceFreed = SDL_CreateCondition();
+    if (vkContext.dedicatedTransfer) {
+        VkCommandPoolCreateInfo poolInfo = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        poolInfo.queueFamilyIndex = vkContext.transferFamily;
+        vkCreateCommandPool(vkContext.device, &poolInfo, NULL, &streamer.transferPool);
+
+        VkCommandBuffer commandBuffers[STREAM_MAX_BATCHES];
+        VkCommandBufferAllocateInfo allocInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        allocInfo.commandPool = streamer.transferPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = STREAM_MAX_BATCHES;
+        vkAllocateCommandBuffers(vkContext.device, &allocInfo, commandBuffers);
+        for (uint32_t i = 0; i < STREAM_MAX_BATCHES; i++) {
+            streamer.batches[i].commandBuffer = commandBuffers[i];
+        }
+    }
+    streamer.startTicks = SDL_GetPerformanceCounter();
+    streamer.active = true;
+    streamer.thread = SDL_CreateThread(streamerThreadMain, "scene loader", NULL);
+    if (!streamer.thread) {
+        SDL_Log("Failed to create scene loader thread: %s", SDL_GetError());
+        return false;
+    }
+    return true;
+}
+
+static void streamerStop(void) {
+    if (streamer.thread) {
+        SDL_LockMutex(streamer.lock);
+        SDL_AtomicSet(&streamer.quit, 1);
+        SDL_SignalCondition(streamer.spaceFreed);
+        SDL_UnlockMutex(streamer.lock);
+        SDL_WaitThread(streamer.thread, NULL);
+        streamer.thread = NULL;
+    }
+}
+
+static void streamerDestroy(void) {
+    vkDestroyCommandPool(vkContext.device, streamer.transferPool, NULL);
+    gpuDestroyBuffer(&streamer.ring.buffer);
+    if (streamer.lock) {
+        SDL_DestroyCondition(streamer.spaceFreed);
+        SDL_DestroyMutex(streamer.lock);
+    }
+}
+
+// Records every chunk the loader has finished reading, or with a dedicated
+// transfer queue, the ownership acquire once all of its copies have landed.
+// From that frame on the scene is drawn.
+static void streamerRecord(VkCommandBuffer cmd, uint32_t slot) {
+    if (!streamer.active) {
+        return;
+    }
+    if (SDL_AtomicGet(&streamer.failed)) {
+        SDL_Log("Scene streaming failed reading %s", streamer.path);
+        streamer.active = false;
+        return;
+    }
+
+    if (vkContext.dedicatedTransfer) {
+        uint64_t completed = 0;
+        if (!SDL_AtomicGet(&streamer.submitted) ||
+            vkContext.getSemaphoreCounterValue(vkContext.device, vkContext.uploadTimeline, &completed) != VK_SUCCESS ||
+            completed < streamer.finalValue) {
+            return;
+        }
+        VkBuffer buffers[STREAM_MAX_SECTIONS];
+        for (uint32_t i = 0; i < streamer.sectionCount; i++) {
+            buffers[i] = streamer.sections[i].dst->buffer;
+        }
+        recordOwnershipTransfer(cmd, buffers, streamer.sectionCount, false);
+        vkContext.frameUploadWait = streamer.finalValue;
+        streamer.recordedBytes = streamer.totalBytes;
+    } else {
+        SDL_LockMutex(streamer.lock);
+        uint32_t chunkCount = streamer.chunkCount;
+        for (uint32_t i = 0; i < chunkCount; i++) {
+            const StreamChunk* chunk = &streamer.chunks[(streamer.chunkHead + i) % STREAM_MAX_CHUNKS];
+            vkCmdCopyBuffer(cmd, streamer.ring.buffer.buffer, chunk->dst, 1, &chunk->region);
+            streamer.recordedBytes += chunk->region.size;
+        }
+        streamer.chunkHead = (streamer.chunkHead + chunkCount) % STREAM_MAX_CHUNKS;
+        streamer.chunkCount = 0;
+        if (chunkCount > 0) {
+            // Chunks are allocated in order, so the last one recorded ends the range this frame uses
+            const StreamChunk* last = &streamer.chunks[(streamer.chunkHead + STREAM_MAX_CHUNKS - 1) % STREAM_MAX_CHUNKS];
+            streamer.releaseMarkers[slot] = last->region.srcOffset + last->region.size;
+            streamer.releasePending[slot] = true;
+        }
+        SDL_UnlockMutex(streamer.lock);
+        if (streamer.recordedBytes < streamer.totalBytes) {
+            return;
+        }
+
+        VkMemoryBarrier barrier = {VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &barrier, 0, NULL, 0, NULL);
+    }
+    streamer.active = false;
+    sceneResident = true;
+    commandCacheInvalidate();
+
+    double ms = ticksToMs(SDL_GetPerformanceCounter() - streamer.startTicks);
+    SDL_Log("Streamed %.2f MiB in %.1f ms (%.1f MB/s) on the %s queue, resident from frame %llu",
+            streamer.totalBytes / (1024.0 * 1024.0), ms,
+            ms > 0.0 ? (double)streamer.totalBytes / 1000.0 / ms : 0.0,
+            vkContext.dedicatedTransfer ? "transfer" : "graphics", (unsigned long long)frameCount);
+}
+
+// Called once the slot's fence has signaled: its copies are done with the ring
+static void streamerRelease(uint32_t slot) {
+    if (!streamer.releasePending[slot]) {
+        return;
+    }
+    SDL_LockMutex(streamer.lock);
+    gpuRingRelease(&streamer.ring, streamer.releaseMarkers[slot]);
+    streamer.releasePending[slot] = false;
+    SDL_SignalCondition(streamer.spaceFreed);
+    SDL_UnlockMutex(streamer.lock);
+}
+
+static void cleanupVulkan(void) {
+    uiDestroy();
+    streamerDestroy();
+    vkDestroySemaphore(vkContext.device, vkContext.uploadTimeline, NULL);
+    cullerDestroy();
+    uniformsDestroy();
+    lodDestroy();
+    gpuDestroyBuffer(&vkContext.identityInstanceBuffer);
+    gpuDestroyBuffer(&vkContext.indexBuffer);
+    gpuDestroyBuffer(&vkContext.vertexBuffer);
+    stagingDestroy();
+    vkDestroyQueryPool(vkContext.device, profiler.queryPool, NULL);
+    vkDestroyQueryPool(vkContext.device, shadingStats.pool, NULL);
+    for (uint32_t i = 0; i < vkContext.framesInFlight; i++) {
+        vkDestroyFence(vkContext.device, vkContext.frames[i].inFlightFence, NULL);
+        vkDestroySemaphore(vkContext.device, vkContext.frames[i].imageAvailableSemaphore, NULL);
+    }
+    free(vkContext.imagesInFlight);
+    // Headless runs have no swapchain and so no present semaphores
+    for (uint32_t i = 0; i < vkContext.swapchainImageCount && vkContext.renderFinishedSemaphores; i++) {
+        vkDestroySemaphore(vkContext.device, vkContext.renderFinishedSemaphores[i], NULL);
+    }
+    free(vkContext.renderFinishedSemaphores);
+    for (uint32_t i = 0; i < vkContext.framesInFlight; i++) {
+        for (uint32_t worker = 0; worker < jobs.workerCount; worker++) {
+            RecordPool* pool = &vkContext.frames[i].recordPools[worker];
+            vkDestroyCommandPool(vkContext.device, pool->pool, NULL);
+            free(pool->buffers);
+        }
+    }
+    vkDestroyCommandPool(vkContext.device, vkContext.commandPool, NULL);
     for (uint32_t i = 0; i < vkContext.swapchainImageCount; i++) {
         vkDestroyFramebuffer(vkContext.device, vkContext.framebuffers[i], NULL);
         vkDestroyImageView(vkContext.device, vkContext.swapchainImageViews[i], NULL);
     }
+    destroyDepthTargets(vkContext.depthTargets, vkContext.swapchainImageCount);
+    // Retired depth targets go back to the allocator, so this precedes its teardown
+    destroyRetiredSwapchains(true);
+    if (vkContext.headless) {
+        for (uint32_t i = 0; i < vkContext.swapchainImageCount; i++) {
+            vkDestroyImage(vkContext.device, vkContext.swapchainImages[i], NULL);
+            gpuFree(&vkContext.offscreenMemory[i]);
+        }
+    }
+    gpuAllocatorDestroy();
     free(vkContext.framebuffers);
     free(vkContext.swapchainImageViews);
     free(vkContext.swapchainImages);
     vkDestroyPipeline(vkContext.device, vkContext.graphicsPipeline, NULL);
+    vkDestroyPipeline(vkContext.device, vkContext.depthPipeline, NULL);
+    vkDestroyPipelineCache(vkContext.device, vkContext.pipelineCache, NULL);
     vkDestroyPipelineLayout(vkContext.device, vkContext.pipelineLayout, NULL);
     vkDestroyRenderPass(vkContext.device, vkContext.renderPass, NULL);
-    vkDestroySwapchainKHR(vkContext.device, vkContext.swapchain, NULL);
-    vkDestroySurfaceKHR(vkContext.instance, vkContext.surface, NULL);
+    if (vkContext.swapchain) {
+        vkDestroySwapchainKHR(vkContext.device, vkContext.swapchain, NULL);
+    }
+    if (vkContext.surface) {
+        vkDestroySurfaceKHR(vkContext.instance, vkContext.surface, NULL);
+    }
     vkDestroyDevice(vkContext.device, NULL);
     vkDestroyInstance(vkContext.instance, NULL);
 }
@@ -1,17 +1,346 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_ttf.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "frame_pacing.h"
+#include "menu_list.h"
 
 #define WINDOW_WIDTH 800
 #define WINDOW_HEIGHT 600
 #define MENU_ITEMS 4
 #define FONT_SIZE 32
+#define ROW_SPACING 20
+#define LIST_TOP (WINDOW_HEIGHT / 4)
+#define LIST_BOTTOM_MARGIN 20
+#define WHEEL_ROWS 3
+
+// Glyph atlas: every glyph is rasterized once into a single texture and text
+// is drawn as batched quads, so nothing is rasterized or uploaded per frame
+#define ATLAS_SIZE 512
+#define ATLAS_MAX_GLYPHS 512
+#define ATLAS_HASH_SIZE (ATLAS_MAX_GLYPHS * 2) // Power of two, kept at most half full
+#define ATLAS_PADDING 1
+#define TEXT_BATCH_QUADS 1024
+
+// Retained rendering: the menu lives in a target texture and only regions
+// whose contents changed are redrawn into it
+#define MAX_DIRTY_RECTS 32
+#define DIRTY_MARGIN 4 // Covers glyph overhang past the measured advance
+
+typedef struct {
+    TTF_Font *font;
+    int size;
+    Uint32 codepoint;
+} GlyphKey;
+
+typedef struct {
+    GlyphKey key;
+    SDL_Rect src; // Location in the atlas, empty for glyphs without pixels
+    int advance;
+} Glyph;
+
+// Shelf-packed cache keyed by font, size and codepoint. Glyphs are rendered
+// white so the vertex color can tint them (the batched form of a color mod).
+typedef struct {
+    SDL_Texture *texture;
+    Glyph glyphs[ATLAS_MAX_GLYPHS];
+    int glyphCount;
+    int hash[ATLAS_HASH_SIZE]; // Index into glyphs, -1 for empty
+    int shelfX;
+    int shelfY;
+    int shelfHeight;
+} GlyphAtlas;
+
+// Quads accumulated into fixed arrays and issued with one SDL_RenderGeometry
+// call per flush; no memory is allocated while drawing
+typedef struct {
+    SDL_Vertex vertices[TEXT_BATCH_QUADS * 4];
+    int indices[TEXT_BATCH_QUADS * 6];
+    int quadCount;
+} TextBatch;
 
 typedef struct {
-    const char *text;
-    SDL_Rect rect;
-    bool hovered;
-} MenuItem;
+    SDL_Rect rects[MAX_DIRTY_RECTS];
+    int count;
+    bool full; // Redraw everything, e.g. first frame or lost render targets
+} DirtyRegion;
+
+static GlyphAtlas atlas;
+static TextBatch textBatch;
+static DirtyRegion dirty;
+
+static bool atlasInit(SDL_Renderer *renderer) {
+    atlas.texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC,
+                                      ATLAS_SIZE, ATLAS_SIZE);
+    if (!atlas.texture) {
+        return false;
+    }
+    SDL_SetTextureBlendMode(atlas.texture, SDL_BLENDMODE_BLEND);
+
+    // Start from fully transparent so the padding between glyphs never bleeds
+    Uint32 *clear = calloc(ATLAS_SIZE * ATLAS_SIZE, sizeof(Uint32));
+    SDL_UpdateTexture(atlas.texture, NULL, clear, ATLAS_SIZE * sizeof(Uint32));
+    free(clear);
+
+    atlas.glyphCount = 0;
+    atlas.shelfX = 0;
+    atlas.shelfY = 0;
+    atlas.shelfHeight = 0;
+    for (int i = 0; i < ATLAS_HASH_SIZE; i++) {
+        atlas.hash[i] = -1;
+    }
+
+    // The index pattern never changes, so it is built once
+    for (int i = 0; i < TEXT_BATCH_QUADS; i++) {
+        int *quad = &textBatch.indices[i * 6];
+        quad[0] = i * 4 + 0;
+        quad[1] = i * 4 + 1;
+        quad[2] = i * 4 + 2;
+        quad[3] = i * 4 + 2;
+        quad[4] = i * 4 + 3;
+        quad[5] = i * 4 + 0;
+    }
+    textBatch.quadCount = 0;
+    return true;
+}
+
+static Uint32 glyphHash(const GlyphKey *key) {
+    Uint32 hash = (Uint32)(uintptr_t)key->font * 2654435761u;
+    hash ^= (Uint32)key->size * 40503u;
+    hash ^= key->codepoint * 2246822519u;
+    return hash ^ (hash >> 15);
+}
+
+// Reserves a rectangle on the current shelf, opening a new shelf when the row is full
+static bool atlasPack(int w, int h, SDL_Rect *rect) {
+    if (atlas.shelfX + w + ATLAS_PADDING > ATLAS_SIZE) {
+        atlas.shelfX = 0;
+        atlas.shelfY += atlas.shelfHeight + ATLAS_PADDING;
+        atlas.shelfHeight = 0;
+    }
+    if (w > ATLAS_SIZE || atlas.shelfY + h > ATLAS_SIZE) {
+        return false;
+    }
+    *rect = (SDL_Rect){atlas.shelfX, atlas.shelfY, w, h};
+    atlas.shelfX += w + ATLAS_PADDING;
+    if (h > atlas.shelfHeight) {
+        atlas.shelfHeight = h;
+    }
+    return true;
+}
+
+// Returns the cached glyph, rasterizing and uploading it on first use
+static const Glyph *atlasGetGlyph(TTF_Font *font, int size, Uint32 codepoint) {
+    GlyphKey key = {font, size, codepoint};
+    Uint32 slot = glyphHash(&key) & (ATLAS_HASH_SIZE - 1);
+    while (atlas.hash[slot] >= 0) {
+        const Glyph *glyph = &atlas.glyphs[atlas.hash[slot]];
+        if (glyph->key.font == font && glyph->key.size == size && glyph->key.codepoint == codepoint) {
+            return glyph;
+        }
+        slot = (slot + 1) & (ATLAS_HASH_SIZE - 1);
+    }
+    if (atlas.glyphCount == ATLAS_MAX_GLYPHS) {
+        return NULL;
+    }
+
+    Glyph glyph = {key};
+    int minx, maxx, miny, maxy;
+    if (TTF_GlyphMetrics32(font, codepoint, &minx, &maxx, &miny, &maxy, &glyph.advance) < 0) {
+        return NULL;
+    }
+
+    // Like rendered text, the bitmap starts at the pen position and spans the
+    // full line height, so bearing and baseline are already baked in
+
+    SDL_Surface *surface = TTF_RenderGlyph32_Blended(font, codepoint, (SDL_Color){255, 255, 255, 255});
+    if (surface && surface->w > 0 && surface->h > 0) {
+        SDL_Surface *converted = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888);
+        if (converted && atlasPack(converted->w, converted->h, &glyph.src)) {
+            SDL_UpdateTexture(atlas.texture, &glyph.src, converted->pixels, converted->pitch);
+        } else {
+            SDL_Log("Glyph atlas full, U+%04X will not be drawn", (unsigned)codepoint);
+        }
+        SDL_FreeSurface(converted);
+    }
+    SDL_FreeSurface(surface);
+
+    atlas.hash[slot] = atlas.glyphCount;
+    atlas.glyphs[atlas.glyphCount] = glyph;
+    return &atlas.glyphs[atlas.glyphCount++];
+}
+
+// Decodes one UTF-8 sequence; malformed bytes are returned as U+FFFD
+static Uint32 utf8Next(const char **text) {
+    const unsigned char *s = (const unsigned char *)*text;
+    Uint32 codepoint;
+    int length;
+    if (s[0] < 0x80) {
+        codepoint = s[0];
+        length = 1;
+    } else if ((s[0] & 0xE0) == 0xC0 && (s[1] & 0xC0) == 0x80) {
+        codepoint = ((s[0] & 0x1Fu) << 6) | (s[1] & 0x3Fu);
+        length = 2;
+    } else if ((s[0] & 0xF0) == 0xE0 && (s[1] & 0xC0) == 0x80 && (s[2] & 0xC0) == 0x80) {
+        codepoint = ((s[0] & 0x0Fu) << 12) | ((s[1] & 0x3Fu) << 6) | (s[2] & 0x3Fu);
+        length = 3;
+    } else if ((s[0] & 0xF8) == 0xF0 && (s[1] & 0xC0) == 0x80 && (s[2] & 0xC0) == 0x80 && (s[3] & 0xC0) == 0x80) {
+        codepoint = ((s[0] & 0x07u) << 18) | ((s[1] & 0x3Fu) << 12) | ((s[2] & 0x3Fu) << 6) | (s[3] & 0x3Fu);
+        length = 4;
+    } else {
+        codepoint = 0xFFFD;
+        length = 1;
+    }
+    *text += length;
+    return codepoint;
+}
+
+static int measureText(TTF_Font *font, int size, const char *text) {
+    int width = 0;
+    while (*text) {
+        const Glyph *glyph = atlasGetGlyph(font, size, utf8Next(&text));
+        if (glyph) {
+            width += glyph->advance;
+        }
+    }
+    return width;
+}
+
+static void textBatchFlush(SDL_Renderer *renderer) {
+    if (textBatch.quadCount > 0) {
+        SDL_RenderGeometry(renderer, atlas.texture, textBatch.vertices, textBatch.quadCount * 4,
+                           textBatch.indices, textBatch.quadCount * 6);
+        textBatch.quadCount = 0;
+    }
+}
+
+// Appends one quad per glyph; (x, y) is the top-left of the line
+static void drawText(SDL_Renderer *renderer, TTF_Font *font, int size, const char *text,
+                     float x, float y, SDL_Color color) {
+    SDL_FColor tint = {color.r / 255.0f, color.g / 255.0f, color.b / 255.0f, color.a / 255.0f};
+    while (*text) {
+        const Glyph *glyph = atlasGetGlyph(font, size, utf8Next(&text));
+        if (!glyph) {
+            continue;
+        }
+        if (glyph->src.w > 0) {
+            if (textBatch.quadCount == TEXT_BATCH_QUADS) {
+                textBatchFlush(renderer);
+            }
+            float x0 = x;
+            float y0 = y;
+            float x1 = x0 + glyph->src.w;
+            float y1 = y0 + glyph->src.h;
+            float u0 = (float)glyph->src.x / ATLAS_SIZE;
+            float v0 = (float)glyph->src.y / ATLAS_SIZE;
+            float u1 = (float)(glyph->src.x + glyph->src.w) / ATLAS_SIZE;
+            float v1 = (float)(glyph->src.y + glyph->src.h) / ATLAS_SIZE;
+            SDL_Vertex *quad = &textBatch.vertices[textBatch.quadCount++ * 4];
+            quad[0] = (SDL_Vertex){{x0, y0}, tint, {u0, v0}};
+            quad[1] = (SDL_Vertex){{x1, y0}, tint, {u1, v0}};
+            quad[2] = (SDL_Vertex){{x1, y1}, tint, {u1, v1}};
+            quad[3] = (SDL_Vertex){{x0, y1}, tint, {u0, v1}};
+        }
+        x += glyph->advance;
+    }
+}
+
+static void markAllDirty(void) {
+    dirty.full = true;
+    dirty.count = 0;
+}
+
+// Overlapping rects are merged so each pixel is redrawn at most once
+static void markDirty(const SDL_Rect *rect) {
+    if (dirty.full) {
+        return;
+    }
+    SDL_Rect grown = {rect->x - DIRTY_MARGIN, rect->y - DIRTY_MARGIN,
+                      rect->w + DIRTY_MARGIN * 2, rect->h + DIRTY_MARGIN * 2};
+    for (int i = 0; i < dirty.count; i++) {
+        if (SDL_HasRectIntersection(&dirty.rects[i], &grown)) {
+            SDL_GetRectUnion(&dirty.rects[i], &grown, &grown);
+            dirty.rects[i] = dirty.rects[--dirty.count];
+            i = -1; // The union may now touch rects already checked
+        }
+    }
+    if (dirty.count == MAX_DIRTY_RECTS) {
+        markAllDirty();
+        return;
+    }
+    dirty.rects[dirty.count++] = grown;
+}
+
+static bool isDirty(void) {
+    return dirty.full || dirty.count > 0;
+}
+
+static int measureRow(void *font, const char *text) {
+    return measureText(font, FONT_SIZE, text);
+}
+
+// Scrolls the list and marks the viewport for redrawing when it moved
+static bool scrollList(MenuList *list, int scrollY) {
+    if (!listScrollTo(list, scrollY)) {
+        return false;
+    }
+    markDirty(&list->viewport);
+    return true;
+}
+
+// Marks the old and new rows dirty only when the hovered row actually changes
+static void listSetHovered(MenuList *list, int hovered) {
+    if (hovered == list->hovered) {
+        return;
+    }
+    if (list->hovered >= 0) {
+        SDL_Rect rect = listItemRect(list, list->hovered);
+        markDirty(&rect);
+    }
+    if (hovered >= 0) {
+        SDL_Rect rect = listItemRect(list, hovered);
+        markDirty(&rect);
+    }
+    list->hovered = hovered;
+}
+
+// Clears each dirty rect of the canvas and redraws only the rows touching it
+static void renderDirty(SDL_Renderer *renderer, SDL_Texture *canvas, TTF_Font *font, MenuList *list) {
+    SDL_SetRenderTarget(renderer, canvas);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    if (dirty.full) {
+        dirty.rects[0] = (SDL_Rect){0, 0, WINDOW_WIDTH, WINDOW_HEIGHT};
+        dirty.count = 1;
+    }
+    for (int r = 0; r < dirty.count; r++) {
+        const SDL_Rect *rect = &dirty.rects[r];
+        SDL_SetRenderClipRect(renderer, rect);
+        SDL_RenderFillRect(renderer, &(SDL_FRect){(float)rect->x, (float)rect->y, (float)rect->w, (float)rect->h});
+
+        // Rows outside the viewport are never drawn, even when the dirty rect extends past it
+        SDL_Rect visible;
+        int first, last;
+        if (!listVisibleRows(list, rect, &visible, &first, &last)) {
+            continue;
+        }
+        SDL_SetRenderClipRect(renderer, &visible);
+        for (int i = first; i <= last; i++) {
+            SDL_Rect itemRect = listItemRect(list, i);
+            SDL_Color color = i == list->hovered ?
+                (SDL_Color){255, 255, 0, 255} :  // Yellow when hovered
+                (SDL_Color){255, 255, 255, 255}; // White normally
+            drawText(renderer, font, FONT_SIZE, list->texts[i], (float)itemRect.x, (float)itemRect.y, color);
+        }
+        // The clip rect changes with the next region, so the batch cannot span regions
+        textBatchFlush(renderer);
+    }
+    SDL_SetRenderClipRect(renderer, NULL);
+    SDL_SetRenderTarget(renderer, NULL);
+    dirty.count = 0;
+    dirty.full = false;
+}
 
 int main(int argc, char *argv[]) {
     // Initialize SDL and TTF
@@ -59,83 +388,210 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    // Menu items
+    if (!atlasInit(renderer)) {
+        SDL_Log("Glyph atlas creation failed: %s", SDL_GetError());
+        TTF_CloseFont(font);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        TTF_Quit();
+        SDL_Quit();
+        return 1;
+    }
+
+    // Menu items. --items N appends N generated entries to exercise large pickers.
+    // --target-fps N caps redraws at N per second and --latency-out FILE
+    // writes input-to-present histograms on exit.
     const char *menu_texts[MENU_ITEMS] = {"Start", "Options", "Credits", "Quit"};
-    MenuItem menu_items[MENU_ITEMS];
-    
-    // Initialize menu items
-    int y_offset = WINDOW_HEIGHT / 4;
-    for (int i = 0; i < MENU_ITEMS; i++) {
-        SDL_Surface *surface = TTF_RenderText_Solid(font, menu_texts[i], (SDL_Color){255, 255, 255, 255});
-        SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-        
-        menu_items[i].text = menu_texts[i];
-        menu_items[i].rect.x = (WINDOW_WIDTH - surface->w) / 2;
-        menu_items[i].rect.y = y_offset;
-        menu_items[i].rect.w = surface->w;
-        menu_items[i].rect.h = surface->h;
-        menu_items[i].hovered = false;
-        
-        y_offset += surface->h + 20;
-        
-        SDL_DestroyTexture(texture);
-        SDL_FreeSurface(surface);
+    int generated = 0;
+    double targetFps = 0.0;
+    const char *latencyOutput = NULL;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (SDL_strcmp(argv[i], "--items") == 0) {
+            generated = SDL_max(SDL_atoi(argv[i + 1]), 0);
+        } else if (SDL_strcmp(argv[i], "--target-fps") == 0) {
+            targetFps = SDL_atof(argv[i + 1]);
+        } else if (SDL_strcmp(argv[i], "--latency-out") == 0) {
+            latencyOutput = argv[i + 1];
+        }
+    }
+    MenuList list = {0};
+    if (!listInit(&list, menu_texts, MENU_ITEMS, generated, TTF_FontHeight(font), ROW_SPACING, measureRow, font)) {
+        SDL_Log("Out of memory for %d menu items", MENU_ITEMS + generated);
+        listDestroy(&list);
+        SDL_DestroyTexture(atlas.texture);
+        TTF_CloseFont(font);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        TTF_Quit();
+        SDL_Quit();
+        return 1;
+    }
+    list.viewport = (SDL_Rect){0, LIST_TOP, WINDOW_WIDTH, WINDOW_HEIGHT - LIST_TOP - LIST_BOTTOM_MARGIN};
+
+    // The backbuffer is undefined after a present, so the retained image lives here
+    SDL_Texture *canvas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+                                            WINDOW_WIDTH, WINDOW_HEIGHT);
+    if (!canvas) {
+        SDL_Log("Canvas creation failed: %s", SDL_GetError());
+        listDestroy(&list);
+        SDL_DestroyTexture(atlas.texture);
+        TTF_CloseFont(font);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        TTF_Quit();
+        SDL_Quit();
+        return 1;
     }
+    markAllDirty();
 
     bool running = true;
+    bool needsPresent = true;
     SDL_Event event;
+    Uint64 wakeups = 0;
+    Uint64 redraws = 0;
+    float mouseX = -1.0f, mouseY = -1.0f;
+    double worstInputMs = 0.0; // Slowest hover/scroll update, the list must stay far below 1 ms
+    FramePacer pacer;
+    pacerInit(&pacer, targetFps);
+    bool paced = false;        // The pacer has been waited on for the pending redraw
+    Uint64 workStartNs = 0;
+    Uint64 pendingInputNs = 0; // Oldest input not yet on screen
+    Uint64 lastPresentNs = 0;
+    bool idled = false;        // Slept since the last present, so the next interval is not a frame time
+    LatencyHistogram latency = {0};
+    LatencyHistogram intervals = {0};
 
     while (running) {
+        // Sleep in the OS until something happens; nothing changes on screen on its own.
+        // With a NULL event SDL_WaitEvent leaves the event queued for the loop below.
+        if (!isDirty() && !needsPresent) {
+            SDL_WaitEvent(NULL);
+            wakeups++;
+            idled = true;
+        }
+
         // Event handling
         while (SDL_PollEvent(&event)) {
+            Uint64 eventStart = SDL_GetPerformanceCounter();
             switch (event.type) {
                 case SDL_EVENT_QUIT:
                     running = false;
                     break;
+                case SDL_EVENT_WINDOW_EXPOSED:
+                    needsPresent = true;
+                    break;
+                case SDL_EVENT_RENDER_TARGETS_RESET:
+                case SDL_EVENT_RENDER_DEVICE_RESET:
+                    markAllDirty();
+                    break;
                 case SDL_EVENT_MOUSE_MOTION:
-                    for (int i = 0; i < MENU_ITEMS; i++) {
-                        menu_items[i].hovered = SDL_PointInRect(
-                            &(SDL_Point){event.motion.x, event.motion.y},
-                            &menu_items[i].rect);
+                    mouseX = event.motion.x;
+                    mouseY = event.motion.y;
+                    listSetHovered(&list, listHitTest(&list, mouseX, mouseY));
+                    break;
+                case SDL_EVENT_MOUSE_WHEEL:
+                    // Content moves under a still cursor, so the hovered row is re-resolved
+                    if (scrollList(&list, list.scrollY - (int)(event.wheel.y * list.rowHeight * WHEEL_ROWS))) {
+                        list.hovered = listHitTest(&list, mouseX, mouseY);
                     }
                     break;
+                case SDL_EVENT_KEY_DOWN: {
+                    int scrollY = list.scrollY;
+                    switch (event.key.keysym.sym) {
+                        case SDLK_PAGEUP: scrollY -= list.viewport.h; break;
+                        case SDLK_PAGEDOWN: scrollY += list.viewport.h; break;
+                        case SDLK_HOME: scrollY = 0; break;
+                        case SDLK_END: scrollY = listMaxScroll(&list); break;
+                    }
+                    if (scrollList(&list, scrollY)) {
+                        list.hovered = listHitTest(&list, mouseX, mouseY);
+                    }
+                    break;
+                }
                 case SDL_EVENT_MOUSE_BUTTON_DOWN:
-                    if (event.button.button == SDL_BUTTON_LEFT) {
-                        for (int i = 0; i < MENU_ITEMS; i++) {
-                            if (menu_items[i].hovered) {
-                                SDL_Log("Selected: %s", menu_items[i].text);
-                                if (i == 3) { // Quit
-                                    running = false;
-                                }
-                            }
+                    if (event.button.button == SDL_BUTTON_LEFT && list.hovered >= 0) {
+                        SDL_Log("Selected: %s", list.texts[list.hovered]);
+                        if (list.hovered == 3) { // Quit
+                            running = false;
                         }
                     }
                     break;
             }
+            if ((event.type == SDL_EVENT_MOUSE_MOTION || event.type == SDL_EVENT_MOUSE_WHEEL ||
+                 event.type == SDL_EVENT_KEY_DOWN || event.type == SDL_EVENT_MOUSE_BUTTON_DOWN) && pendingInputNs == 0) {
+                pendingInputNs = event.common.timestamp;
+            }
+            double eventMs = (double)(SDL_GetPerformanceCounter() - eventStart) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+            if (eventMs > worstInputMs) {
+                worstInputMs = eventMs;
+            }
         }
 
-        // Rendering
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_RenderClear(renderer);
+        // Input that changed nothing never reaches the screen, so it is not measured
+        if (!isDirty() && !needsPresent) {
+            pendingInputNs = 0;
+            continue;
+        }
+        // Paced: wait for the frame's slot, then go round once more so input
+        // that arrived during the wait makes this frame
+        if (pacer.periodNs && !paced) {
+            pacerWait(&pacer);
+            paced = true;
+            workStartNs = SDL_GetTicksNS();
+            continue;
+        }
 
-        for (int i = 0; i < MENU_ITEMS; i++) {
-            SDL_Color color = menu_items[i].hovered ? 
-                (SDL_Color){255, 255, 0, 255} :  // Yellow when hovered
-                (SDL_Color){255, 255, 255, 255}; // White normally
+        // Rendering: only dirty regions are redrawn, then the canvas is presented
+        if (isDirty()) {
+            renderDirty(renderer, canvas, font, &list);
+            needsPresent = true;
+        }
+        if (needsPresent) {
+            SDL_RenderTexture(renderer, canvas, NULL, NULL);
+            SDL_RenderPresent(renderer);
+            needsPresent = false;
+            redraws++;
 
-            SDL_Surface *surface = TTF_RenderText_Solid(font, menu_items[i].text, color);
-            SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
-            
-            SDL_RenderTexture(renderer, texture, NULL, &menu_items[i].rect);
-            
-            SDL_DestroyTexture(texture);
-            SDL_FreeSurface(surface);
+            Uint64 presentNs = SDL_GetTicksNS();
+            if (pendingInputNs) {
+                histogramAdd(&latency, (double)(presentNs - pendingInputNs) / 1e6);
+                pendingInputNs = 0;
+            }
+            if (lastPresentNs && !idled) {
+                histogramAdd(&intervals, (double)(presentNs - lastPresentNs) / 1e6);
+            }
+            lastPresentNs = presentNs;
+            idled = false;
+            if (paced) {
+                pacerFrameDone(&pacer, presentNs - workStartNs);
+                paced = false;
+            }
         }
+    }
 
-        SDL_RenderPresent(renderer);
+    SDL_Log("%llu wakeups, %llu presents, %d items, slowest event %.3f ms",
+            (unsigned long long)wakeups, (unsigned long long)redraws, list.count, worstInputMs);
+    histogramLog("Input-to-present latency", &latency);
+    histogramLog("Present interval", &intervals);
+    pacerLog(&pacer);
+    if (latencyOutput) {
+        FILE *file = fopen(latencyOutput, "w");
+        if (file) {
+            fprintf(file, "{\n  \"targetFps\": %.2f,\n  \"missedDeadlines\": %u,\n  \"histogramsMs\": {\n",
+                    targetFps, pacer.missed);
+            histogramWriteJson(file, "inputToPresent", &latency, false);
+            histogramWriteJson(file, "presentInterval", &intervals, true);
+            fprintf(file, "  }\n}\n");
+            fclose(file);
+        } else {
+            SDL_Log("Cannot write %s", latencyOutput);
+        }
     }
 
     // Cleanup
+    listDestroy(&list);
+    SDL_DestroyTexture(canvas);
+    SDL_DestroyTexture(atlas.texture);
     TTF_CloseFont(font);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -0,0 +1,166 @@
+// Frame pacing and latency histograms shared by SDL3_menu.cpp and
+// SDL3_Vilkan.cpp. The pacer spaces frames at a target rate and wakes each one
+// as late as it can, so input is sampled just before the frame is built.
+#ifndef FRAME_PACING_H
+#define FRAME_PACING_H
+
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define PACER_MIN_SPIN_NS 200000ULL   // Always spin at least this long before the wake-up time
+#define PACER_MAX_SPIN_NS 4000000ULL  // Timers worse than this are slept on anyway
+#define LATENCY_BUCKET_MS 0.25
+#define LATENCY_BUCKETS 400           // 0-100 ms; the last bucket also takes everything slower
+
+// Each frame sleeps until its predicted work would end exactly on its
+// deadline. Most of the wait goes to SDL_DelayNS. The remainder is spun away,
+// and its length follows how far the OS timer has been overshooting.
+typedef struct {
+    Uint64 periodNs;     // 0 when unpaced
+    Uint64 deadlineNs;   // When the current frame should be presented
+    Uint64 workNs;       // Predicted time from waking to present
+    Uint64 spinNs;
+    Uint64 oversleepNs;  // Smoothed SDL_DelayNS overshoot
+    Uint64 sleptNs;
+    Uint64 spunNs;
+    uint32_t frames;
+    uint32_t missed;     // Frames that ended a whole period late; the schedule restarts from them
+} FramePacer;
+
+// Fixed-width buckets, so adding a sample never allocates
+typedef struct {
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint32_t count;
+    double sumMs;
+    double minMs;
+    double maxMs;
+} LatencyHistogram;
+
+static void pacerInit(FramePacer *pacer, double targetFps) {
+    SDL_zero(*pacer);
+    pacer->periodNs = targetFps > 0.0 ? (Uint64)(1e9 / targetFps) : 0;
+    pacer->spinNs = PACER_MAX_SPIN_NS;
+}
+
+// Waits for the frame's wake-up time. Returns immediately when unpaced or
+// behind schedule.
+static void pacerWait(FramePacer *pacer) {
+    if (pacer->periodNs == 0) {
+        return;
+    }
+    Uint64 now = SDL_GetTicksNS();
+    Uint64 workNs = SDL_min(pacer->workNs, pacer->periodNs);
+    if (now > pacer->deadlineNs) {
+        // First frame, or the first after an idle stretch: run it at once and
+        // space the following frames from it
+        pacer->deadlineNs = now + workNs;
+        return;
+    }
+    Uint64 wake = pacer->deadlineNs - workNs;
+    if (now >= wake) {
+        return;
+    }
+
+    if (wake - now > pacer->spinNs) {
+        Uint64 request = wake - now - pacer->spinNs;
+        Uint64 sleepStart = now;
+        SDL_DelayNS(request);
+        now = SDL_GetTicksNS();
+        Uint64 overshoot = now - sleepStart > request ? now - sleepStart - request : 0;
+        pacer->oversleepNs = (pacer->oversleepNs * 7 + overshoot) / 8;
+        pacer->spinNs = SDL_clamp(pacer->oversleepNs * 2, PACER_MIN_SPIN_NS, PACER_MAX_SPIN_NS);
+        pacer->sleptNs += now - sleepStart;
+    }
+    Uint64 spinStart = now;
+    while (now < wake) {
+        now = SDL_GetTicksNS();
+    }
+    pacer->spunNs += now - spinStart;
+}
+
+// Called once the frame is presented, with the time since pacerWait returned.
+// The estimate jumps up at once and decays slowly, so after one slow frame the
+// next frames wake early rather than miss.
+static void pacerFrameDone(FramePacer *pacer, Uint64 workNs) {
+    if (pacer->periodNs == 0) {
+        return;
+    }
+    pacer->workNs = workNs > pacer->workNs ? workNs : (pacer->workNs * 15 + workNs) / 16;
+    pacer->frames++;
+    pacer->deadlineNs += pacer->periodNs;
+    Uint64 now = SDL_GetTicksNS();
+    if (now > pacer->deadlineNs) {
+        // Catching up would present a burst of frames; start over from now instead
+        pacer->deadlineNs = now + pacer->periodNs;
+        pacer->missed++;
+    }
+}
+
+static void pacerLog(const FramePacer *pacer) {
+    if (pacer->frames == 0) {
+        return;
+    }
+    SDL_Log("Pacing: %.1f fps target, %u of %u frames missed, %.2f ms slept and %.2f ms spun per frame, "
+            "%.2f ms predicted work",
+            1e9 / pacer->periodNs, pacer->missed, pacer->frames, pacer->sleptNs / 1e6 / pacer->frames,
+            pacer->spunNs / 1e6 / pacer->frames, pacer->workNs / 1e6);
+}
+
+static void histogramAdd(LatencyHistogram *histogram, double ms) {
+    int bucket = (int)(ms / LATENCY_BUCKET_MS);
+    histogram->buckets[SDL_clamp(bucket, 0, LATENCY_BUCKETS - 1)]++;
+    if (histogram->count == 0 || ms < histogram->minMs) {
+        histogram->minMs = ms;
+    }
+    if (ms > histogram->maxMs) {
+        histogram->maxMs = ms;
+    }
+    histogram->sumMs += ms;
+    histogram->count++;
+}
+
+// Upper edge of the bucket holding the p-th sample, so accurate to one bucket
+static double histogramPercentile(const LatencyHistogram *histogram, double p) {
+    uint32_t rank = (uint32_t)(p * (histogram->count - 1));
+    uint32_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > rank) {
+            return SDL_min((i + 1) * LATENCY_BUCKET_MS, histogram->maxMs);
+        }
+    }
+    return histogram->maxMs;
+}
+
+static void histogramLog(const char *name, const LatencyHistogram *histogram) {
+    if (histogram->count == 0) {
+        return;
+    }
+    SDL_Log("%s: avg %.2f ms, p50 %.2f, p95 %.2f, p99 %.2f, min %.2f, max %.2f over %u samples", name,
+            histogram->sumMs / histogram->count, histogramPercentile(histogram, 0.50),
+            histogramPercentile(histogram, 0.95), histogramPercentile(histogram, 0.99),
+            histogram->minMs, histogram->maxMs, histogram->count);
+}
+
+// Writes "name": {...} with the summary and the bucket counts up to the last
+// non-empty one
+static void histogramWriteJson(FILE *file, const char *name, const LatencyHistogram *histogram, bool last) {
+    int used = LATENCY_BUCKETS;
+    while (used > 0 && histogram->buckets[used - 1] == 0) {
+        used--;
+    }
+    double mean = histogram->count ? histogram->sumMs / histogram->count : 0.0;
+    fprintf(file, "    \"%s\": {\"count\": %u, \"mean\": %.3f, \"min\": %.3f, \"max\": %.3f, "
+                  "\"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"bucketMs\": %.2f, \"buckets\": [",
+            name, histogram->count, mean, histogram->minMs, histogram->maxMs,
+            histogram->count ? histogramPercentile(histogram, 0.50) : 0.0,
+            histogram->count ? histogramPercentile(histogram, 0.95) : 0.0,
+            histogram->count ? histogramPercentile(histogram, 0.99) : 0.0, LATENCY_BUCKET_MS);
+    for (int i = 0; i < used; i++) {
+        fprintf(file, "%s%u", i ? ", " : "", histogram->buckets[i]);
+    }
+    fprintf(file, "]}%s\n", last ? "" : ",");
+}
+
+#endif // FRAME_PACING_H
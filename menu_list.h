@@ -0,0 +1,126 @@
+// Virtualized menu list shared by SDL3_menu.cpp (SDL_Renderer) and the
+// overlay in SDL3_Vilkan.cpp. It holds the items, layout, scrolling and hit
+// testing; drawing and text measurement belong to the including program.
+#ifndef MENU_LIST_H
+#define MENU_LIST_H
+
+#include <SDL3/SDL.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Width of a row's text in pixels
+typedef int (*MenuMeasureFunction)(void *context, const char *text);
+
+// Items are stored structure-of-arrays and every row has the same height, so
+// the row under a point and the rows inside a rect are plain arithmetic. Only
+// rows that intersect the viewport are ever measured or drawn, independent of
+// the item count.
+typedef struct {
+    const char **texts;
+    int *widths;      // Text width in pixels, -1 until the row is first needed
+    int count;
+    char *textPool;   // Backing store for generated item names
+    SDL_Rect viewport;
+    int rowHeight;
+    int textHeight;
+    int rowSpacing;
+    int scrollY;      // Pixel offset of the viewport's top into the list
+    int hovered;      // Row under the mouse, -1 for none
+    MenuMeasureFunction measure;
+    void *measureContext;
+} MenuList;
+
+// Appends generated "Level NNNNNN" entries after the base texts. The caller
+// sets the viewport.
+static bool listInit(MenuList *list, const char **baseTexts, int baseCount, int generated, int textHeight,
+                     int rowSpacing, MenuMeasureFunction measure, void *measureContext) {
+    list->count = baseCount + generated;
+    list->texts = malloc(sizeof(const char *) * list->count);
+    list->widths = malloc(sizeof(int) * list->count);
+    list->textPool = generated > 0 ? malloc((size_t)generated * 16) : NULL;
+    if (!list->texts || !list->widths || (generated > 0 && !list->textPool)) {
+        return false;
+    }
+    for (int i = 0; i < baseCount; i++) {
+        list->texts[i] = baseTexts[i];
+    }
+    for (int i = 0; i < generated; i++) {
+        char *name = &list->textPool[(size_t)i * 16];
+        SDL_snprintf(name, 16, "Level %06d", i + 1);
+        list->texts[baseCount + i] = name;
+    }
+    for (int i = 0; i < list->count; i++) {
+        list->widths[i] = -1;
+    }
+
+    list->textHeight = textHeight;
+    list->rowSpacing = rowSpacing;
+    list->rowHeight = textHeight + rowSpacing;
+    list->viewport = (SDL_Rect){0, 0, 0, 0};
+    list->scrollY = 0;
+    list->hovered = -1;
+    list->measure = measure;
+    list->measureContext = measureContext;
+    return true;
+}
+
+static void listDestroy(MenuList *list) {
+    free(list->texts);
+    free(list->widths);
+    free(list->textPool);
+}
+
+// Window-space rect of a row's text, measured on first use
+static SDL_Rect listItemRect(MenuList *list, int index) {
+    if (list->widths[index] < 0) {
+        list->widths[index] = list->measure(list->measureContext, list->texts[index]);
+    }
+    int width = list->widths[index];
+    return (SDL_Rect){list->viewport.x + (list->viewport.w - width) / 2,
+                      list->viewport.y + index * list->rowHeight - list->scrollY,
+                      width, list->textHeight};
+}
+
+// O(1): the row follows from the y coordinate, then only that row's text is tested
+static int listHitTest(MenuList *list, float x, float y) {
+    SDL_Point point = {(int)x, (int)y};
+    if (!SDL_PointInRect(&point, &list->viewport)) {
+        return -1;
+    }
+    int row = (point.y - list->viewport.y + list->scrollY) / list->rowHeight;
+    if (row >= list->count) {
+        return -1;
+    }
+    SDL_Rect rect = listItemRect(list, row);
+    return SDL_PointInRect(&point, &rect) ? row : -1;
+}
+
+static int listMaxScroll(const MenuList *list) {
+    int contentHeight = list->count * list->rowHeight - list->rowSpacing;
+    return contentHeight > list->viewport.h ? contentHeight - list->viewport.h : 0;
+}
+
+// Returns true if the offset changed, in which case the whole viewport needs redrawing
+static bool listScrollTo(MenuList *list, int scrollY) {
+    scrollY = SDL_clamp(scrollY, 0, listMaxScroll(list));
+    if (scrollY == list->scrollY) {
+        return false;
+    }
+    list->scrollY = scrollY;
+    return true;
+}
+
+// Rows touching the part of rect inside the viewport; false when there are none
+static bool listVisibleRows(const MenuList *list, const SDL_Rect *rect, SDL_Rect *visible, int *first, int *last) {
+    if (!SDL_GetRectIntersection(rect, &list->viewport, visible)) {
+        return false;
+    }
+    *first = (visible->y - list->viewport.y + list->scrollY) / list->rowHeight;
+    *last = (visible->y + visible->h - 1 - list->viewport.y + list->scrollY) / list->rowHeight;
+    if (*last >= list->count) {
+        *last = list->count - 1;
+    }
+    return *first <= *last;
+}
+
+#endif // MENU_LIST_H
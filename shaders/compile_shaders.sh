@@ -0,0 +1,21 @@
+#!/bin/sh
+# Compiles every GLSL shader in this directory to SPIR-V ahead of time.
+# Each shader becomes <name>.spv.inc, a comma-separated list of 32-bit words
+# that SDL3_Vilkan.cpp #includes into a uint32_t array, so no GLSL compiler
+# or shader files are needed at runtime.
+#
+# Run this before building SDL3_Vilkan.cpp and whenever a shader changes.
+set -e
+
+cd "$(dirname "$0")"
+
+GLSLC=glslc
+if [ -n "$VULKAN_SDK" ]; then
+    GLSLC="$VULKAN_SDK/bin/glslc"
+fi
+
+for src in *.vert *.frag *.comp; do
+    [ -f "$src" ] || continue
+    echo "$src -> $src.spv.inc"
+    "$GLSLC" -O --target-env=vulkan1.0 -mfmt=num -o "$src.spv.inc" "$src"
+done
@@ -0,0 +1,26 @@
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec4 inInstance; // xyz offset, w uniform scale
+
+layout(push_constant) uniform Camera {
+    mat4 viewProj;
+} camera;
+
+// This object's slice of the per-frame uniform ring, picked by dynamic offset
+layout(set = 0, binding = 0) uniform Object {
+    mat4 model;
+} object;
+
+layout(location = 0) out vec3 fragColor;
+
+// The depth pre-pass and the shading pass must produce bit-identical depth
+// for the EQUAL test
+invariant gl_Position;
+
+void main() {
+    vec4 position = vec4(inPosition * inInstance.w + inInstance.xyz, 1.0);
+    gl_Position = camera.viewProj * object.model * position;
+    fragColor = inColor;
+}
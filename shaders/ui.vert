@@ -0,0 +1,18 @@
+#version 450
+
+layout(location = 0) in vec2 inPosition; // Pixels from the top left
+layout(location = 1) in vec2 inUv;
+layout(location = 2) in vec4 inColor;
+
+layout(push_constant) uniform Screen {
+    vec2 scale; // 2 / framebuffer size
+} screen;
+
+layout(location = 0) out vec2 fragUv;
+layout(location = 1) out vec4 fragColor;
+
+void main() {
+    gl_Position = vec4(inPosition * screen.scale - 1.0, 0.0, 1.0);
+    fragUv = inUv;
+    fragColor = inColor;
+}